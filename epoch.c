@@ -0,0 +1,252 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "radix_tree.h"
+
+// Epoch based reclamation
+#define EPOCH_CNT 3
+#define EPOCH_ACTIVE 1ULL
+#define EPOCH_ADVANCE_FREQ 128 /* Try to advance global epoch once per this many retires. */
+#define EPOCH_EXIT_ADVANCE_FREQ 64 /* And once per this many guard exits of threads holding retired nodes. */
+#define LIMBO_INIT_SIZE 256
+
+struct epoch_limbo {
+	unsigned long long epoch;
+	unsigned long long cnt;
+	unsigned long long size;
+	struct radix_tree_node **nodes;
+};
+
+struct epoch_pthread_elem {
+	unsigned long long state; /* (Announced epoch << 1) | EPOCH_ACTIVE */
+	unsigned long long local_epoch;
+	unsigned long long retire_cnt;
+	unsigned long long exit_cnt;
+	unsigned int nest;
+	struct epoch_limbo limbo[EPOCH_CNT];
+} __attribute__((aligned(64)));
+
+/* Limbo list left behind by an unregistered thread. */
+struct epoch_orphan {
+	struct epoch_orphan *next;
+	struct epoch_limbo limbo;
+};
+
+static struct pthread_arr epoch_pthread_arr = PTHREAD_ARR_INITIALIZER(struct epoch_pthread_elem);
+static __thread struct epoch_pthread_elem *epoch_pthread_elem = NULL;
+
+#ifndef RADIX_SINGLE_THREAD
+/* Starts from EPOCH_CNT so that (epoch - 2) never underflows. */
+static unsigned long long global_epoch = EPOCH_CNT;
+static struct epoch_orphan *orphan_head = NULL;
+static pthread_mutex_t orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static inline struct epoch_pthread_elem *get_epoch_pthread_elem(void) {
+	if (__builtin_expect(epoch_pthread_elem == NULL, 0))
+		epoch_pthread_elem = get_pthread_elem(&epoch_pthread_arr, get_tid());
+	return epoch_pthread_elem;
+}
+
+/* Return every node in LIMBO to the node allocator. */
+static void epoch_reclaim(struct epoch_limbo *limbo) {
+	unsigned long long i;
+
+	for (i = 0; i < limbo->cnt; i++)
+		return_node(limbo->nodes[i]);
+	limbo->cnt = 0;
+}
+
+#ifdef RADIX_SINGLE_THREAD
+/* Single threaded build. Trees are never shared between threads, so a node retired by a thread is referenced by
+   nobody once the thread leaves its outermost guard. Nodes are kept in the first limbo list until then. */
+void radix_epoch_enter(void) {
+	get_epoch_pthread_elem()->nest++;
+}
+
+void radix_epoch_exit(void) {
+	struct epoch_pthread_elem *elem = get_epoch_pthread_elem();
+
+	radix_assert(elem->nest > 0);
+	if (--elem->nest == 0)
+		epoch_reclaim(&elem->limbo[0]);
+}
+
+void radix_epoch_retire(struct radix_tree_node *node) {
+	struct epoch_pthread_elem *elem = get_epoch_pthread_elem();
+	struct epoch_limbo *limbo = &elem->limbo[0];
+
+	radix_assert(elem->nest > 0);
+	if (limbo->cnt == limbo->size) {
+		limbo->size = (limbo->size) ? limbo->size * 2 : LIMBO_INIT_SIZE;
+		limbo->nodes = realloc(limbo->nodes, limbo->size * sizeof(*limbo->nodes));
+		assert(limbo->nodes != NULL);
+	}
+	limbo->nodes[limbo->cnt++] = node;
+}
+
+void radix_epoch_unregister(void) {
+	struct epoch_pthread_elem *elem = epoch_pthread_elem;
+
+	if (elem == NULL)
+		return;
+	radix_assert(elem->nest == 0);
+	free(elem->limbo[0].nodes);
+	memset(&elem->limbo[0], 0, sizeof(elem->limbo[0]));
+	epoch_pthread_elem = NULL;
+}
+#else
+/* Reclaim orphaned limbo lists which became safe at EPOCH. Skip if another thread is already at it. */
+static void epoch_collect_orphan(unsigned long long epoch) {
+	struct epoch_orphan **orphanp, *orphan;
+
+	if (pthread_mutex_trylock(&orphan_lock))
+		return;
+	orphanp = &orphan_head;
+	while ((orphan = *orphanp) != NULL) {
+		if (orphan->limbo.epoch + 2 <= epoch) {
+			*orphanp = orphan->next;
+			epoch_reclaim(&orphan->limbo);
+			free(orphan->limbo.nodes);
+			free(orphan);
+		}
+		else
+			orphanp = &orphan->next;
+	}
+	pthread_mutex_unlock(&orphan_lock);
+}
+
+/* Nodes retired in global epoch E are unreachable by every thread once global epoch reaches E + 2. */
+static void epoch_collect(struct epoch_pthread_elem *elem, unsigned long long epoch) {
+	int i;
+
+	for (i = 0; i < EPOCH_CNT; i++) {
+		if (elem->limbo[i].cnt && (elem->limbo[i].epoch + 2 <= epoch))
+			epoch_reclaim(&elem->limbo[i]);
+	}
+	if (atomic_load(&orphan_head) != NULL)
+		epoch_collect_orphan(epoch);
+}
+
+static inline bool epoch_has_limbo(struct epoch_pthread_elem *elem) {
+	int i;
+
+	for (i = 0; i < EPOCH_CNT; i++) {
+		if (elem->limbo[i].cnt)
+			return true;
+	}
+	return false;
+}
+
+/* Advance global epoch if every active thread has announced EPOCH. Return true for success. */
+static bool epoch_try_advance(unsigned long long epoch) {
+	struct epoch_pthread_elem *elem;
+	unsigned long long state;
+	int i, cnt = get_tid_cnt();
+
+	for (i = 0; i < cnt; i++) {
+		if ((elem = peek_pthread_elem(&epoch_pthread_arr, i)) == NULL) {
+			i |= PTHREAD_CHUNK_SIZE - 1;
+			continue;
+		}
+		state = atomic_load(&elem->state);
+		if ((state & EPOCH_ACTIVE) && ((state >> 1) != epoch))
+			return false;
+	}
+	return atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1);
+}
+
+void radix_epoch_enter(void) {
+	struct epoch_pthread_elem *elem = get_epoch_pthread_elem();
+	unsigned long long epoch, cur_epoch;
+
+	if (elem->nest++)
+		return;
+
+	epoch = atomic_load(&global_epoch);
+	while (true) {
+		atomic_store(&elem->state, (epoch << 1) | EPOCH_ACTIVE);
+		if ((cur_epoch = atomic_load(&global_epoch)) == epoch)
+			break;
+		epoch = cur_epoch;
+	}
+
+	if (elem->local_epoch != epoch) {
+		elem->local_epoch = epoch;
+		epoch_collect(elem, epoch);
+	}
+}
+
+void radix_epoch_exit(void) {
+	struct epoch_pthread_elem *elem = get_epoch_pthread_elem();
+
+	radix_assert(elem->nest > 0);
+	if (--elem->nest)
+		return;
+	atomic_store(&elem->state, elem->local_epoch << 1);
+
+	// Threads which retire a few nodes and go on with lookups would otherwise never advance the epoch for them.
+	if (((++elem->exit_cnt % EPOCH_EXIT_ADVANCE_FREQ) == 0) && epoch_has_limbo(elem)) {
+		epoch_try_advance(atomic_load(&global_epoch));
+		epoch_collect(elem, atomic_load(&global_epoch));
+	}
+}
+
+/* Defer returning NODE to the allocator until no reader can hold a reference to it.
+   Caller should be inside an epoch guard and NODE should already be unreachable from the tree. */
+void radix_epoch_retire(struct radix_tree_node *node) {
+	struct epoch_pthread_elem *elem = get_epoch_pthread_elem();
+	/* Stamp with global epoch rather than local one. Readers which entered after this thread did may still
+	   reference NODE, and they have announced at most the current global epoch. */
+	unsigned long long epoch = atomic_load(&global_epoch);
+	struct epoch_limbo *limbo = &elem->limbo[epoch % EPOCH_CNT];
+
+	radix_assert(elem->nest > 0);
+	if (limbo->epoch != epoch) {
+		// Remaining nodes were retired at least EPOCH_CNT epochs ago.
+		epoch_reclaim(limbo);
+		limbo->epoch = epoch;
+	}
+	if (limbo->cnt == limbo->size) {
+		limbo->size = (limbo->size) ? limbo->size * 2 : LIMBO_INIT_SIZE;
+		limbo->nodes = realloc(limbo->nodes, limbo->size * sizeof(*limbo->nodes));
+		assert(limbo->nodes != NULL);
+	}
+	limbo->nodes[limbo->cnt++] = node;
+
+	if ((++elem->retire_cnt % EPOCH_ADVANCE_FREQ) == 0)
+		epoch_try_advance(epoch);
+}
+
+/* Hand limbo lists of the calling thread over to the orphan list. Caller should not be inside an epoch guard. */
+void radix_epoch_unregister(void) {
+	struct epoch_pthread_elem *elem = epoch_pthread_elem;
+	struct epoch_orphan *orphan;
+	int i;
+
+	if (elem == NULL)
+		return;
+	radix_assert(elem->nest == 0);
+	atomic_store(&elem->state, 0);
+	for (i = 0; i < EPOCH_CNT; i++) {
+		if (elem->limbo[i].cnt == 0)
+			continue;
+		orphan = (struct epoch_orphan *)malloc(sizeof(struct epoch_orphan));
+		assert(orphan != NULL);
+		orphan->limbo = elem->limbo[i];
+		memset(&elem->limbo[i], 0, sizeof(elem->limbo[i]));
+		pthread_mutex_lock(&orphan_lock);
+		orphan->next = orphan_head;
+		atomic_store(&orphan_head, orphan);
+		pthread_mutex_unlock(&orphan_lock);
+	}
+	elem->local_epoch = 0;
+	elem->retire_cnt = 0;
+	elem->exit_cnt = 0;
+	epoch_pthread_elem = NULL;
+}
+#endif
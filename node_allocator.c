@@ -3,615 +3,524 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 #include "radix_tree.h"
 
 // TID Allocator
-#define MAX_ARR_SIZE 211
-struct pthread_elem {
-	pthread_t tid;
-	int idx;
-};
-struct pthread_elem pthread_arr[MAX_ARR_SIZE] = {0, };
-int pthread_arr_idx = 0;
+/* Thread registry. Ids start from 0, are cached in thread local storage and are reused once their owner
+   unregisters. Threads register on first use and are unregistered by a pthread key destructor at exit. */
+static __thread int pthread_tid = -1;
+static int pthread_tid_cnt = 0; /* High watermark of handed out ids. */
+static int *free_tid_stack = NULL;
+static int free_tid_cnt = 0;
+static int free_tid_size = 0;
+static pthread_mutex_t tid_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tid_key;
+static pthread_once_t tid_key_once = PTHREAD_ONCE_INIT;
+
+static void tid_key_destructor (void *arg) {
+	radix_thread_unregister ();
+}
+
+static void tid_key_init (void) {
+	pthread_key_create (&tid_key, tid_key_destructor);
+}
+
+int radix_thread_register (void) {
+	int tid;
+
+	if (pthread_tid >= 0)
+		return pthread_tid;
+
+	pthread_once (&tid_key_once, tid_key_init);
+	pthread_mutex_lock (&tid_lock);
+	if (free_tid_cnt > 0)
+		tid = free_tid_stack[--free_tid_cnt];
+	else {
+		tid = pthread_tid_cnt;
+		if (tid >= PTHREAD_CHUNK_CNT * PTHREAD_CHUNK_SIZE) {
+			pthread_mutex_unlock (&tid_lock);
+			radix_assert (false);
+			return -1;
+		}
+		atomic_store (&pthread_tid_cnt, tid + 1);
+	}
+	pthread_mutex_unlock (&tid_lock);
 
-static inline int hash_function (pthread_t tid) {
-	return (tid >> 8) % MAX_ARR_SIZE;
+	pthread_setspecific (tid_key, (void *)1);
+	return (pthread_tid = tid);
+}
+
+/* Flush per-thread state of the calling thread and release its id. Caller should not be inside an epoch guard. */
+void radix_thread_unregister (void) {
+	if (pthread_tid < 0)
+		return;
+
+	radix_epoch_unregister ();
+	node_allocator_unregister ();
+
+	pthread_mutex_lock (&tid_lock);
+	if (free_tid_cnt == free_tid_size) {
+		free_tid_size = (free_tid_size) ? free_tid_size * 2 : 64;
+		free_tid_stack = realloc (free_tid_stack, free_tid_size * sizeof (int));
+		assert (free_tid_stack != NULL);
+	}
+	free_tid_stack[free_tid_cnt++] = pthread_tid;
+	pthread_mutex_unlock (&tid_lock);
+
+	pthread_setspecific (tid_key, NULL);
+	pthread_tid = -1;
 }
 
 /* Get unique thread id, starting from 0. */
 int get_tid (void) {
-	pthread_t tid = pthread_self ();
-	int h = hash_function (tid);
-	int i = h;
+	if (__builtin_expect (pthread_tid >= 0, 1))
+		return pthread_tid;
+	return radix_thread_register ();
+}
 
-	do {
-		if (pthread_arr[i].tid == 0) {
-			if (__sync_val_compare_and_swap (&pthread_arr[i].tid, 0, tid) == 0) {
-					pthread_arr[i].idx = __sync_fetch_and_add (&pthread_arr_idx, 0x1);
-					return pthread_arr[i].idx;
-			}
-		}
-		else if (pthread_equal (pthread_arr[i].tid, tid))
-			return pthread_arr[i].idx;
-		i = ((i >= MAX_ARR_SIZE - 1) ? 0 : i + 1);
-	} while (i != h);
+/* Get the upper bound of thread ids handed out so far. */
+int get_tid_cnt (void) {
+	return atomic_load (&pthread_tid_cnt);
+}
 
-	return -1;
+/* Allocate chunk IDX of ARR. Chunks are never freed, so elements never move.
+   Chunks are cache line aligned since per-thread elements are. */
+void *build_pthread_chunk (struct pthread_arr *arr, int idx) {
+	unsigned long long size = (PTHREAD_CHUNK_SIZE * arr->elem_size + 63) & ~63ULL;
+	void *chunk = aligned_alloc (64, size), *expected = NULL;
+
+	assert (chunk != NULL);
+	memset (chunk, 0, size);
+	if (!atomic_compare_exchange_strong (&arr->chunks[idx], &expected, chunk)) {
+		free (chunk);
+		return expected;
+	}
+	return chunk;
 }
 
 
 // Node allocator
-struct leaf_pthread_elem {
-	struct radix_tree_leaf *head;
-	unsigned long long alloc;
-	unsigned long long free;
+/* Slab allocator with per-thread magazines. Each thread allocates from and frees to its own pair of magazines
+   without synchronization. Full and empty magazines are exchanged with a global depot per NUMA node and type through
+   lock-free stacks. Slabs are placed on the NUMA node of their depot and objects keep it in their header, so that a
+   freed object goes back to the pools of its own NUMA node whoever frees it. Objects are never zeroed here; callers
+   initialize what they read. */
+#define MAGAZINE_SIZE 64
+#define SLAB_MAGAZINE_CNT 16 /* Magazines carved out of one slab. */
+#define STACK_TAG_SHIFT 48
+#define STACK_PTR_MASK ((1ULL << STACK_TAG_SHIFT) - 1)
+
+struct magazine {
+	struct magazine *next;
+	unsigned long long cnt;
+	void *objs[MAGAZINE_SIZE];
 };
-struct N4_pthread_elem {
-	struct N4 *head;
-	unsigned long long alloc;
-	unsigned long long free;
-};
-struct N16_pthread_elem {
-	struct N16 *head;
-	unsigned long long alloc;
-	unsigned long long free;
+
+/* Tagged pointer to top magazine. Upper bits count pops to avoid ABA. */
+struct magazine_stack {
+	unsigned long long top;
 };
-struct N48_pthread_elem {
-	struct N48 *head;
-	unsigned long long alloc;
-	unsigned long long free;
+
+struct node_depot {
+	struct magazine_stack full;
+	struct magazine_stack empty;
+	unsigned long long slab_cnt;
+} __attribute__((aligned(64)));
+
+struct node_pthread_elem {
+	struct magazine *loaded;
+	struct magazine *prev;
 };
-struct N256_pthread_elem {
-	struct N256 *head;
-	unsigned long long alloc;
-	unsigned long long free;
+
+struct node_pthread_arr_elem {
+	struct node_pthread_elem elem[RADIX_NUMA_MAX][NODE_TYPE_CNT];
+	unsigned int interleave_next;
+	/* Counters of struct radix_numa_stats, written by the owner only. */
+	unsigned long long alloc[RADIX_NUMA_MAX];
+	unsigned long long remote_alloc[RADIX_NUMA_MAX];
+	unsigned long long local_access[RADIX_NUMA_MAX];
+	unsigned long long remote_access[RADIX_NUMA_MAX];
+} __attribute__((aligned(64)));
+
+/* Objects are padded to NODE_ALIGN so that each starts a cache line. */
+#define node_align_up(SIZE) (((SIZE) + NODE_ALIGN - 1) & ~(NODE_ALIGN - 1))
+static const unsigned long long node_size[NODE_TYPE_CNT] = {
+	[LEAF_NODE] = node_align_up(sizeof(struct radix_tree_leaf)),
+	[N4] = node_align_up(sizeof(struct N4)),
+	[N8] = node_align_up(sizeof(struct N8)),
+	[N16] = node_align_up(sizeof(struct N16)),
+	[N32] = node_align_up(sizeof(struct N32)),
+	[N48] = node_align_up(sizeof(struct N48)),
+	[N256] = node_align_up(sizeof(struct N256)),
 };
 
-static struct leaf_pthread_elem leaf_pthread_arr[MAX_TRANSACTION] = {0, };
-static struct radix_tree_leaf *leaf_pool_head = NULL;
-static pthread_mutex_t leaf_pool_lock = PTHREAD_MUTEX_INITIALIZER;
-static unsigned long long leaf_malloc_cnt = 0;
-static unsigned long long leaf_pool_free_cnt = 0;
-
-static struct N4_pthread_elem N4_pthread_arr[MAX_TRANSACTION] = {0, };
-static struct N4 *N4_pool_head = NULL;
-static pthread_mutex_t N4_pool_lock = PTHREAD_MUTEX_INITIALIZER;
-static unsigned long long N4_malloc_cnt = 0;
-static unsigned long long N4_pool_free_cnt = 0;
-
-static struct N16_pthread_elem N16_pthread_arr[MAX_TRANSACTION] = {0, };
-static struct N16 *N16_pool_head = NULL;
-static pthread_mutex_t N16_pool_lock = PTHREAD_MUTEX_INITIALIZER;
-static unsigned long long N16_malloc_cnt = 0;
-static unsigned long long N16_pool_free_cnt = 0;
-
-static struct N48_pthread_elem N48_pthread_arr[MAX_TRANSACTION] = {0, };
-static struct N48 *N48_pool_head = NULL;
-static pthread_mutex_t N48_pool_lock = PTHREAD_MUTEX_INITIALIZER;
-static unsigned long long N48_malloc_cnt = 0;
-static unsigned long long N48_pool_free_cnt = 0;
-
-static struct N256_pthread_elem N256_pthread_arr[MAX_TRANSACTION] = {0, };
-static struct N256 *N256_pool_head = NULL;
-static pthread_mutex_t N256_pool_lock = PTHREAD_MUTEX_INITIALIZER;
-static unsigned long long N256_malloc_cnt = 0;
-static unsigned long long N256_pool_free_cnt = 0;
-
-static inline void *return_node_to_pool (void *node, unsigned long long length, enum node_types type){
-	void *ret_head;
-	unsigned long long i;
-
-	switch(type) {
-		{
-		struct radix_tree_leaf *append_tail;
-		case LEAF_NODE:
-			append_tail = (struct radix_tree_leaf *)node;
-			for (i = 0; i < length - 1; i++)
-				append_tail = append_tail->next;
-			ret_head = append_tail->next;
-			pthread_mutex_lock (&leaf_pool_lock);
-			append_tail->next = leaf_pool_head;
-			leaf_pool_head = (struct radix_tree_leaf *)node;
-			leaf_pool_free_cnt += length;
-			pthread_mutex_unlock (&leaf_pool_lock);
-			return ret_head;
-		}
-		{
-		struct N4 *append_tail;
-		case N4:
-			append_tail = (struct N4 *)node;
-			for (i = 0; i < length - 1; i++)
-				append_tail = append_tail->slots[0];
-			ret_head = append_tail->slots[0];
-			pthread_mutex_lock (&N4_pool_lock);
-			append_tail->slots[0] = N4_pool_head;
-			N4_pool_head = (struct N4 *)node;
-			N4_pool_free_cnt += length;
-			pthread_mutex_unlock (&N4_pool_lock);
-			return ret_head;
-		}
-		{
-		struct N16 *append_tail;
-		case N16:
-			append_tail = (struct N16 *)node;
-			for (i = 0; i < length - 1; i++)
-				append_tail = append_tail->slots[0];
-			ret_head = append_tail->slots[0];
-			pthread_mutex_lock (&N16_pool_lock);
-			append_tail->slots[0] = N16_pool_head;
-			N16_pool_head = (struct N16 *)node;
-			N16_pool_free_cnt += length;
-			pthread_mutex_unlock (&N16_pool_lock);
-			return ret_head;
-		}
-		{
-		struct N48 *append_tail;
-		case N48:
-			append_tail = (struct N48 *)node;
-			for (i = 0; i < length - 1; i++)
-				append_tail = append_tail->slots[0];
-			ret_head = append_tail->slots[0];
-			pthread_mutex_lock (&N48_pool_lock);
-			append_tail->slots[0] = N48_pool_head;
-			N48_pool_head = (struct N48 *)node;
-			N48_pool_free_cnt += length;
-			pthread_mutex_unlock (&N48_pool_lock);
-			return ret_head;
-		}
-		{
-		struct N256 *append_tail;
-		case N256:
-			append_tail = (struct N256 *)node;
-			for (i = 0; i < length - 1; i++)
-				append_tail = append_tail->slots[0];
-			ret_head = append_tail->slots[0];
-			pthread_mutex_lock (&N256_pool_lock);
-			append_tail->slots[0] = N256_pool_head;
-			N256_pool_head = (struct N256 *)node;
-			N256_pool_free_cnt += length;
-			pthread_mutex_unlock (&N256_pool_lock);
-			return ret_head;
+static struct node_depot node_depot[RADIX_NUMA_MAX][NODE_TYPE_CNT];
+static struct pthread_arr node_pthread_arr = PTHREAD_ARR_INITIALIZER(struct node_pthread_arr_elem);
+static __thread struct node_pthread_arr_elem *node_pthread_elem = NULL;
+
+// NUMA topology
+/* NUMA nodes are numbered densely from 0 as the kernel does, capped at RADIX_NUMA_MAX. Threads may migrate, so the
+   NUMA node of a thread is only a hint, refreshed on magazine refills and every so many get_thread_numa() calls. */
+static int numa_cnt = 1;
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+static __thread int thread_numa = 0;
+
+static void numa_init(void) {
+	FILE *fp = fopen("/sys/devices/system/node/possible", "r");
+	char buf[256], *p;
+	int last = 0;
+
+	if (fp == NULL)
+		return;
+	// List of ranges such as "0-1,3", of which the last bound is the highest node.
+	if (fgets(buf, sizeof(buf), fp) != NULL) {
+		for (p = buf; *p; p++) {
+			if ((*p >= '0') && (*p <= '9') && ((p == buf) || (p[-1] < '0') || (p[-1] > '9')))
+				last = atoi(p);
 		}
 	}
-	radix_unreachable();
+	fclose(fp);
+	numa_cnt = (last + 1 > RADIX_NUMA_MAX) ? RADIX_NUMA_MAX : last + 1;
 }
 
-void return_node(struct radix_tree_node *new_node){
-	free(new_node);
-	return;
-
-	pid_t tid = get_tid ();
-	switch(new_node->type){
-		{
-		struct leaf_pthread_elem *elem;
-		struct radix_tree_leaf *leaf;
-		case LEAF_NODE:
-			elem = &leaf_pthread_arr[tid];
-			leaf = (struct radix_tree_leaf *)new_node;
-			leaf->next = elem->head;
-			elem->head = leaf;
-			elem->alloc--;
-			elem->free++;
-			if ((elem->free > (elem->alloc * 2)) && (elem->alloc > 0)) {
-				elem->head = return_node_to_pool (elem->head, elem->alloc, LEAF_NODE);
-				elem->free -= elem->alloc;
-			}
-			return;
-		}
-		{
-		struct N4_pthread_elem *elem;
-		struct N4 *n4;
-		case N4:
-			elem = &N4_pthread_arr[tid];
-			n4 = (struct N4 *)new_node;
-			n4->slots[0] = elem->head;
-			elem->head = n4;
-			elem->alloc--;
-			elem->free++;
-			if ((elem->free > (elem->alloc * 2)) && (elem->alloc > 0)) {
-				elem->head = return_node_to_pool (elem->head, elem->alloc, N4);
-				elem->free -= elem->alloc;
-			}
-			return;
-		}
-		{
-		struct N16_pthread_elem *elem;
-		struct N16 *n16;
-		case N16:
-			elem = &N16_pthread_arr[tid];
-			n16 = (struct N16 *)new_node;
-			n16->slots[0] = elem->head;
-			elem->head = n16;
-			elem->alloc--;
-			elem->free++;
-			if ((elem->free > (elem->alloc * 2)) && (elem->alloc > 0)) {
-				elem->head = return_node_to_pool (elem->head, elem->alloc, N16);
-				elem->free -= elem->alloc;
-			}
-			return;
+#define THREAD_NUMA_REFRESH 1024 /* Calls of get_thread_numa() between refreshes, for threads that never allocate. */
+static __thread unsigned int thread_numa_calls = 0;
+
+static inline void refresh_thread_numa(void) {
+	unsigned int cpu, node;
+
+	if ((numa_cnt > 1) && (syscall(SYS_getcpu, &cpu, &node, NULL) == 0))
+		thread_numa = (node < numa_cnt) ? node : 0;
+}
+
+int get_thread_numa(void) {
+	if (__builtin_expect((thread_numa_calls++ % THREAD_NUMA_REFRESH) == 0, 0)) {
+		pthread_once(&numa_once, numa_init);
+		refresh_thread_numa();
+	}
+	return thread_numa;
+}
+
+int get_numa_cnt(void) {
+	pthread_once(&numa_once, numa_init);
+	return numa_cnt;
+}
+
+static inline struct node_pthread_arr_elem *get_node_pthread_arr_elem(void) {
+	if (__builtin_expect(node_pthread_elem == NULL, 0)) {
+		pthread_once(&numa_once, numa_init);
+		refresh_thread_numa();
+		node_pthread_elem = get_pthread_elem(&node_pthread_arr, get_tid());
+	}
+	return node_pthread_elem;
+}
+
+void count_numa_access(int numa) {
+	struct node_pthread_arr_elem *arr_elem = get_node_pthread_arr_elem();
+
+	if (numa == thread_numa)
+		arr_elem->local_access[thread_numa]++;
+	else
+		arr_elem->remote_access[thread_numa]++;
+}
+
+void radix_tree_numa_stats(struct radix_numa_stats *stats) {
+	struct node_pthread_arr_elem *arr_elem;
+	int tid, tid_cnt = get_tid_cnt(), i;
+
+	pthread_once(&numa_once, numa_init);
+	memset(stats, 0, sizeof(*stats));
+	stats->node_cnt = numa_cnt;
+	// Counters of unregistered threads are kept, and reused ids keep counting on top of them.
+	for (tid = 0; tid < tid_cnt; tid++) {
+		if ((arr_elem = peek_pthread_elem(&node_pthread_arr, tid)) == NULL)
+			continue;
+		for (i = 0; i < RADIX_NUMA_MAX; i++) {
+			stats->alloc[i] += __atomic_load_n(&arr_elem->alloc[i], __ATOMIC_RELAXED);
+			stats->remote_alloc[i] += __atomic_load_n(&arr_elem->remote_alloc[i], __ATOMIC_RELAXED);
+			stats->local_access[i] += __atomic_load_n(&arr_elem->local_access[i], __ATOMIC_RELAXED);
+			stats->remote_access[i] += __atomic_load_n(&arr_elem->remote_access[i], __ATOMIC_RELAXED);
 		}
-		{
-		struct N48_pthread_elem *elem;
-		struct N48 *n48;
-		case N48:
-			elem = &N48_pthread_arr[tid];
-			n48 = (struct N48 *)new_node;
-			n48->slots[0] = elem->head;
-			elem->head = n48;
-			elem->alloc--;
-			elem->free++;
-			if ((elem->free > (elem->alloc * 2)) && (elem->alloc > 0)) {
-				elem->head = return_node_to_pool (elem->head, elem->alloc, N48);
-				elem->free -= elem->alloc;
-			}
-			return;
+	}
+}
+
+static inline void magazine_push(struct magazine_stack *stack, struct magazine *mag) {
+	unsigned long long top = atomic_load(&stack->top), new_top;
+
+	do {
+		mag->next = (struct magazine *)(top & STACK_PTR_MASK);
+		new_top = (((top >> STACK_TAG_SHIFT) + 1) << STACK_TAG_SHIFT) | (unsigned long long)mag;
+	} while (!atomic_compare_exchange_weak(&stack->top, &top, new_top));
+}
+
+/* Magazines are never freed, so reading next of a concurrently popped magazine is safe and the tag catches it. */
+static inline struct magazine *magazine_pop(struct magazine_stack *stack) {
+	unsigned long long top = atomic_load(&stack->top), new_top;
+	struct magazine *mag;
+
+	do {
+		if ((mag = (struct magazine *)(top & STACK_PTR_MASK)) == NULL)
+			return NULL;
+		new_top = (((top >> STACK_TAG_SHIFT) + 1) << STACK_TAG_SHIFT) | (unsigned long long)mag->next;
+	} while (!atomic_compare_exchange_weak(&stack->top, &top, new_top));
+	return mag;
+}
+
+// Node arenas
+/* Optional 2 MiB page backing of slabs. Each node type carves slabs from arena regions of its own, so that nodes of one
+   type share few pages and a lookup path needs few TLB entries. Regions come from reserved huge pages if possible and
+   are otherwise aligned and advised for transparent huge pages. Regions are never unmapped, like slabs.
+   On multi-node hosts slabs always come from arenas, one per NUMA node and type, bound to their NUMA node before the
+   first touch. */
+#define HUGE_PAGE_SIZE (2ULL << 20)
+#define ARENA_REGION_SIZE (8 * HUGE_PAGE_SIZE)
+
+struct node_arena {
+	pthread_mutex_t lock;
+	char *cur;
+	char *end;
+};
+
+static bool arena_enabled = false;
+static struct node_arena node_arena[RADIX_NUMA_MAX][NODE_TYPE_CNT] = {
+	[0 ... RADIX_NUMA_MAX - 1] = {[0 ... NODE_TYPE_CNT - 1] = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL}}
+};
+static unsigned long long arena_hugetlb_bytes = 0;
+static unsigned long long arena_thp_bytes = 0;
+
+void radix_tree_set_huge_pages(bool enable) {
+	arena_enabled = enable;
+}
+
+void radix_tree_huge_page_stats(unsigned long long *hugetlb_bytes, unsigned long long *thp_bytes) {
+	*hugetlb_bytes = atomic_load(&arena_hugetlb_bytes);
+	*thp_bytes = atomic_load(&arena_thp_bytes);
+}
+
+/* Prefer NUMA node NUMA for pages of REGION not faulted yet. Preferred rather than bound, so that a full node spills
+   over instead of failing allocations. */
+static void bind_arena_region(char *region, unsigned long long size, int numa) {
+	unsigned long mask = 1UL << numa;
+
+	if (numa_cnt > 1)
+		syscall(SYS_mbind, region, size, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+}
+
+static char *map_arena_region(unsigned long long size, int numa) {
+	unsigned long long pad;
+	char *region;
+
+	if (!arena_enabled) {
+		region = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (region == MAP_FAILED)
+			return NULL;
+		bind_arena_region(region, size, numa);
+		return region;
+	}
+
+	region = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (region != MAP_FAILED) {
+		bind_arena_region(region, size, numa);
+		atomic_fetch_add(&arena_hugetlb_bytes, size);
+		return region;
+	}
+
+	// No reserved huge pages. Map one page more and trim, so that the region starts on a huge page boundary.
+	region = (char *)mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED)
+		return NULL;
+	pad = (HUGE_PAGE_SIZE - ((unsigned long long)region & (HUGE_PAGE_SIZE - 1))) & (HUGE_PAGE_SIZE - 1);
+	if (pad)
+		munmap(region, pad);
+	munmap(region + pad + size, HUGE_PAGE_SIZE - pad);
+	region += pad;
+	bind_arena_region(region, size, numa);
+	madvise(region, size, MADV_HUGEPAGE);
+	atomic_fetch_add(&arena_thp_bytes, size);
+	return region;
+}
+
+/* Memory for a slab of TYPE on NUMA node NUMA. From the arena of both if enabled or needed for placement, otherwise
+   from the heap. */
+static char *alloc_slab(enum node_types type, int numa, unsigned long long size) {
+	struct node_arena *arena = &node_arena[numa][type];
+	unsigned long long region_size;
+	char *slab;
+
+	if (!arena_enabled && (numa_cnt == 1))
+		return (char *)aligned_alloc(NODE_ALIGN, size);
+
+	pthread_mutex_lock(&arena->lock);
+	if (arena->end - arena->cur < size) {
+		// Rest of the region is left unused, at most one slab.
+		region_size = (size > ARENA_REGION_SIZE) ? (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1) : ARENA_REGION_SIZE;
+		if ((slab = map_arena_region(region_size, numa)) == NULL) {
+			pthread_mutex_unlock(&arena->lock);
+			return NULL;
 		}
-		{
-		struct N256_pthread_elem *elem;
-		struct N256 *n256;
-		case N256:
-			elem = &N256_pthread_arr[tid];
-			n256 = (struct N256 *)new_node;
-			n256->slots[0] = elem->head;
-			elem->head = n256;
-			elem->alloc--;
-			elem->free++;
-			if ((elem->free > (elem->alloc * 2)) && (elem->alloc > 0)) {
-				elem->head = return_node_to_pool (elem->head, elem->alloc, N256);
-				elem->free -= elem->alloc;
-			}
-			return;
+		arena->cur = slab;
+		arena->end = slab + region_size;
+	}
+	slab = arena->cur;
+	arena->cur += size;
+	pthread_mutex_unlock(&arena->lock);
+	return slab;
+}
+
+static inline struct magazine *get_empty_magazine(struct node_depot *depot) {
+	struct magazine *mag = magazine_pop(&depot->empty);
+
+	if (mag == NULL) {
+		mag = (struct magazine *)malloc(sizeof(struct magazine));
+		radix_assert(mag != NULL);
+		if (mag == NULL)
+			return NULL;
+	}
+	mag->cnt = 0;
+	return mag;
+}
+
+/* Carve a new slab of TYPE on NUMA node NUMA into full magazines. Push all but one to depot and return the remaining
+   one. */
+static struct magazine *build_slab(enum node_types type, int numa) {
+	struct node_depot *depot = &node_depot[numa][type];
+	struct magazine *mag = NULL;
+	unsigned long long size = node_size[type], i, j;
+	char *slab;
+
+	slab = alloc_slab(type, numa, size * MAGAZINE_SIZE * SLAB_MAGAZINE_CNT);
+	radix_assert(slab != NULL);
+	if (slab == NULL)
+		return NULL;
+	for (i = 0; i < SLAB_MAGAZINE_CNT; i++) {
+		if (mag != NULL)
+			magazine_push(&depot->full, mag);
+		if ((mag = get_empty_magazine(depot)) == NULL)
+			return NULL;
+		// Objects are line aligned, which also leaves the low bits free for the type tags of child slots.
+		for (j = 0; j < MAGAZINE_SIZE; j++) {
+			mag->objs[j] = slab + ((i * MAGAZINE_SIZE) + j) * size;
+			((struct radix_tree_node *)mag->objs[j])->numa = numa;
 		}
+		mag->cnt = MAGAZINE_SIZE;
 	}
+	atomic_fetch_add(&depot->slab_cnt, 1);
+	return mag;
 }
 
+/* Pre-populate depot of the calling thread's NUMA node with at least N nodes of TYPE. */
 int build_node(unsigned long long n, enum node_types type){
-	return 0;
-	unsigned long long i;
-	switch(type){
-		{
-		struct radix_tree_leaf *leaf;
-		case LEAF_NODE:
-			leaf = (struct radix_tree_leaf *)malloc(sizeof(struct radix_tree_leaf) * n);
-			radix_assert(leaf != NULL);
-			if (leaf == NULL)
-				return -1;
-			for (i = 0; i < n - 1; i++)
-				leaf[i].next = &leaf[i + 1];
-			leaf[n - 1].next = leaf_pool_head;
-			leaf_pool_head = leaf;
-			leaf_pool_free_cnt += n;
-			leaf_malloc_cnt += n;
-			return 0;
-		}
-		{
-		struct N4 *n4;
-		case N4:
-			n4 = (struct N4 *)malloc(sizeof(struct N4) * n);
-			radix_assert(n4 != NULL);
-			if (n4 == NULL)
-				return -1;
-			for (i = 0; i < n - 1; i++)
-				n4[i].slots[0] = &n4[i+1];
-			n4[n - 1].slots[0] = N4_pool_head;
-			N4_pool_head = n4;
-			N4_pool_free_cnt += n;
-			N4_malloc_cnt += n;
-			return 0;
-		}
-		{
-		struct N16 *n16;
-		case N16:
-			n16 = (struct N16 *)malloc(sizeof(struct N16) * n);
-			radix_assert(n16 != NULL);
-			if (n16 == NULL)
-				return -1;
-			for (i = 0; i < n - 1; i++)
-				n16[i].slots[0] = &n16[i+1];
-			n16[n - 1].slots[0] = N16_pool_head;
-			N16_pool_head = n16;
-			N16_pool_free_cnt += n;
-			N16_malloc_cnt += n;
-			return 0;
-		}
-		{
-		struct N48 *n48;
-		case N48:
-			n48 = (struct N48 *)malloc(sizeof(struct N48) * n);
-			radix_assert(n48 != NULL);
-			if (n48 == NULL)
-				return -1;
-			for (i = 0; i < n - 1; i++)
-				n48[i].slots[0] = &n48[i+1];
-			n48[n - 1].slots[0] = N48_pool_head;
-			N48_pool_head = n48;
-			N48_pool_free_cnt += n;
-			N48_malloc_cnt += n;
-			return 0;
-		}
-		{
-		struct N256 *n256;
-		case N256:
-			n256 = (struct N256 *)malloc(sizeof(struct N256) * n);
-			radix_assert(n256 != NULL);
-			if (n256 == NULL)
-				return -1;
-			for (i = 0; i < n - 1; i++)
-				n256[i].slots[0] = &n256[i+1];
-			n256[n - 1].slots[0] = N256_pool_head;
-			N256_pool_head = n256;
-			N256_pool_free_cnt += n;
-			N256_malloc_cnt += n;
-			return 0;
-		}
+	struct magazine *mag;
+	unsigned long long built;
+
+	get_node_pthread_arr_elem();
+	for (built = 0; built < n; built += MAGAZINE_SIZE * SLAB_MAGAZINE_CNT) {
+		if ((mag = build_slab(type, thread_numa)) == NULL)
+			return -1;
+		magazine_push(&node_depot[thread_numa][type].full, mag);
 	}
-	return -1;
+	return 0;
 }
 
-static inline void *get_node_from_pool (unsigned long long length, enum node_types type) {
-	unsigned long long i;
-	void *ret_head;
-
-	switch(type) {
-		{
-		struct radix_tree_leaf *ret_tail;
-		case LEAF_NODE:
-			pthread_mutex_lock (&leaf_pool_lock);
-		leaf_node_begin:
-			if (leaf_pool_free_cnt >= length) {
-				ret_head = (ret_tail = leaf_pool_head);
-				for (i = 0; i < length - 1; i++)
-					ret_tail = ret_tail->next;
-				leaf_pool_head = ret_tail->next;
-				leaf_pool_free_cnt -= length;
-				pthread_mutex_unlock (&leaf_pool_lock);
-				ret_tail->next = NULL;
-
-				return ret_head;
-			}
-			else {
-				if (build_node ((leaf_malloc_cnt > 5) ? leaf_malloc_cnt : 5, type) != 0)
-					return NULL;
-				goto leaf_node_begin;
-			}
-		}
-		{
-		struct N4 *ret_tail;
-		case N4:
-			pthread_mutex_lock (&N4_pool_lock);
-		n4_node_begin:
-			if (N4_pool_free_cnt >= length) {
-				ret_head = (ret_tail = N4_pool_head);
-				for (i = 0; i < length - 1; i++)
-					ret_tail = ret_tail->slots[0];
-				N4_pool_head = ret_tail->slots[0];
-				N4_pool_free_cnt -= length;
-				pthread_mutex_unlock (&N4_pool_lock);
-				ret_tail->slots[0] = NULL;
-
-				return ret_head;
-			}
-			else {
-				if (build_node ((N4_malloc_cnt > 5) ? N4_malloc_cnt : 5, type) != 0)
-					return NULL;
-				goto n4_node_begin;
-			}
-		}
-		{
-		struct N16 *ret_tail;
-		case N16:
-			pthread_mutex_lock (&N16_pool_lock);
-		n16_node_begin:
-			if (N16_pool_free_cnt >= length) {
-				ret_head = (ret_tail = N16_pool_head);
-				for (i = 0; i < length - 1; i++)
-					ret_tail = ret_tail->slots[0];
-				N16_pool_head = ret_tail->slots[0];
-				N16_pool_free_cnt -= length;
-				pthread_mutex_unlock (&N16_pool_lock);
-				ret_tail->slots[0] = NULL;
-
-				return ret_head;
-			}
-			else {
-				if (build_node ((N16_malloc_cnt > 5) ? N16_malloc_cnt : 5, type) != 0)
-					return NULL;
-				goto n16_node_begin;
-			}
-		}
-		{
-		struct N48 *ret_tail;
-		case N48:
-			pthread_mutex_lock (&N48_pool_lock);
-		n48_node_begin:
-			if (N48_pool_free_cnt >= length) {
-				ret_head = (ret_tail = N48_pool_head);
-				for (i = 0; i < length - 1; i++)
-					ret_tail = ret_tail->slots[0];
-				N48_pool_head = ret_tail->slots[0];
-				N48_pool_free_cnt -= length;
-				pthread_mutex_unlock (&N48_pool_lock);
-				ret_tail->slots[0] = NULL;
-
-				return ret_head;
-			}
-			else {
-				//printf("build N48\n");
-				if (build_node ((N48_malloc_cnt > 5) ? N48_malloc_cnt : 5, type) != 0)
-					return NULL;
-				goto n48_node_begin;
-			}
-		}
-		{
-		struct N256 *ret_tail;
-		case N256:
-			pthread_mutex_lock (&N256_pool_lock);
-		n256_node_begin:
-			if (N256_pool_free_cnt >= length) {
-				ret_head = (ret_tail = N256_pool_head);
-				for (i = 0; i < length - 1; i++)
-					ret_tail = ret_tail->slots[0];
-				N256_pool_head = ret_tail->slots[0];
-				N256_pool_free_cnt -= length;
-				pthread_mutex_unlock (&N256_pool_lock);
-				ret_tail->slots[0] = NULL;
-
-				return ret_head;
-			}
-			else {
-				//printf("build N256\n");
-				if (build_node ((N256_malloc_cnt > 5) ? N256_malloc_cnt : 5, type) != 0)
-					return NULL;
-				goto n256_node_begin;
-			}
-		}
+void return_node(struct radix_tree_node *new_node){
+	struct node_pthread_elem *elem = &get_node_pthread_arr_elem()->elem[new_node->numa][new_node->type];
+	struct node_depot *depot = &node_depot[new_node->numa][new_node->type];
+	struct magazine *mag;
+
+	if ((elem->loaded != NULL) && (elem->loaded->cnt < MAGAZINE_SIZE)) {
+		elem->loaded->objs[elem->loaded->cnt++] = new_node;
+		return;
 	}
-	radix_unreachable();
+	if ((elem->prev != NULL) && (elem->prev->cnt < MAGAZINE_SIZE)) {
+		mag = elem->loaded;
+		elem->loaded = elem->prev;
+		elem->prev = mag;
+		elem->loaded->objs[elem->loaded->cnt++] = new_node;
+		return;
+	}
+
+	// Both magazines are full or missing. Drain one full magazine to depot.
+	if (elem->prev != NULL)
+		magazine_push(&depot->full, elem->prev);
+	elem->prev = elem->loaded;
+	// Objects live inside slabs and cannot be freed one by one, so the node is dropped if no magazine is left.
+	if ((elem->loaded = get_empty_magazine(depot)) == NULL)
+		return;
+	elem->loaded->objs[elem->loaded->cnt++] = new_node;
 }
 
-/* Allocate node of type TYPE. Caller should fill zero if necessary. */
-struct radix_tree_node *get_node(enum node_types type){
-	pid_t tid = get_tid ();
+/* Allocate node of type TYPE on NUMA node NUMA. Caller should fill zero if necessary. */
+struct radix_tree_node *get_node_on(enum node_types type, int numa){
+	struct node_pthread_arr_elem *arr_elem = get_node_pthread_arr_elem();
+	struct node_pthread_elem *elem;
+	struct node_depot *depot;
 	struct radix_tree_node *node;
-	unsigned long long pool_request_size;
-	switch(type){
-		{
-		struct radix_tree_leaf *leaf;
-		struct leaf_pthread_elem *elem;
-		case LEAF_NODE:
-			node = (struct radix_tree_node *)calloc(1, sizeof(struct radix_tree_leaf));
-			node->type = LEAF_NODE;
-			return node;
-
-			elem = &leaf_pthread_arr[tid];
-			if (elem->head != NULL) {
-				leaf = elem->head;
-				elem->head = leaf->next;
-				elem->alloc++;
-				elem->free--;
-			}
-			else {
-				pool_request_size = (elem->alloc) ? elem->alloc*2 : 100;
-				leaf = get_node_from_pool (pool_request_size, type);
-				if (leaf != NULL) {
-					elem->head = leaf->next;
-					elem->alloc++;
-					elem->free = pool_request_size - 1;
-				}
-			}
-			leaf->node.type = LEAF_NODE;
-			return (struct radix_tree_node*)leaf;
-		}
-		{
-		struct N4 *n4;
-		struct N4_pthread_elem *elem;
-		case N4:
-			node = (struct radix_tree_node *)calloc(1, sizeof(struct N4));
-			node->type = N4;
-			return node;
-
-			elem = &N4_pthread_arr[tid];
-			if (elem->head != NULL) {
-				n4 = elem->head;
-				elem->head = n4->slots[0];
-				elem->alloc++;
-				elem->free--;
-			}
-			else {
-				pool_request_size = (elem->alloc) ? elem->alloc*2: 100;
-				n4 = get_node_from_pool (pool_request_size, type);
-				if (n4 != NULL) {
-					elem->head = n4->slots[0];
-					elem->alloc++;
-					elem->free = pool_request_size - 1;
-				}
-			}
-			n4->node.type = N4;
-			return (struct radix_tree_node*)n4;
-		}
-		{
-		struct N16 *n16;
-		struct N16_pthread_elem *elem;
-		case N16:
-			node = (struct radix_tree_node *)calloc(1, sizeof(struct N16));
-			node->type = N16;
-			return node;
-
-			elem = &N16_pthread_arr[tid];
-			if (elem->head != NULL) {
-				n16 = elem->head;
-				elem->head = n16->slots[0];
-				elem->alloc++;
-				elem->free--;
-			}
-			else {
-				pool_request_size = (elem->alloc) ? elem->alloc*2: 100;
-				n16 = get_node_from_pool (pool_request_size, type);
-				if (n16 != NULL) {
-					elem->head = n16->slots[0];
-					elem->alloc++;
-					elem->free = pool_request_size - 1;
-				}
-			}
-			n16->node.type = N16;
-			return (struct radix_tree_node*)n16;
-		}
-		{
-		struct N48 *n48;
-		struct N48_pthread_elem *elem;
-		case N48:
-			node = (struct radix_tree_node *)calloc(1, sizeof(struct N48));
-			node->type = N48;
-			return node;
-
-			elem = &N48_pthread_arr[tid];
-			if (elem->head != NULL) {
-				n48 = elem->head;
-				elem->head = n48->slots[0];
-				elem->alloc++;
-				elem->free--;
-			}
-			else {
-				pool_request_size = (elem->alloc) ? elem->alloc*2: 100;
-				n48 = get_node_from_pool (pool_request_size, type);
-				if (n48 != NULL) {
-					elem->head = n48->slots[0];
-					elem->alloc++;
-					elem->free = pool_request_size - 1;
-				}
-			}
-			n48->node.type = N48;
-			return (struct radix_tree_node*)n48;
+	struct magazine *mag;
+
+	if (numa == RADIX_NUMA_LOCAL)
+		numa = thread_numa;
+	else if (numa == RADIX_NUMA_INTERLEAVE)
+		numa = arr_elem->interleave_next++ % numa_cnt;
+	else if (numa >= numa_cnt)
+		numa = 0; // Policy set for a node this host lacks.
+	elem = &arr_elem->elem[numa][type];
+	depot = &node_depot[numa][type];
+
+	if ((elem->loaded == NULL) || (elem->loaded->cnt == 0)) {
+		if ((elem->prev != NULL) && (elem->prev->cnt > 0)) {
+			mag = elem->loaded;
+			elem->loaded = elem->prev;
+			elem->prev = mag;
 		}
-		{
-		struct N256 *n256;
-		struct N256_pthread_elem *elem;
-		case N256:
-			node = (struct radix_tree_node *)calloc(1, sizeof(struct N256));
-			node->type = N256;
-			return node;
-
-			elem = &N256_pthread_arr[tid];
-			if (elem->head != NULL) {
-				n256 = elem->head;
-				elem->head = n256->slots[0];
-				elem->alloc++;
-				elem->free--;
-			}
-			else {
-				pool_request_size = (elem->alloc) ? elem->alloc*2: 100;
-				n256 = get_node_from_pool (pool_request_size, type);
-				if (n256 != NULL) {
-					elem->head = n256->slots[0];
-					elem->alloc++;
-					elem->free = pool_request_size - 1;
-				}
-			}
-			n256->node.type = N256;
-			return (struct radix_tree_node*)n256;
+		else {
+			// Both magazines are empty or missing. Refill from depot.
+			refresh_thread_numa();
+			if ((mag = magazine_pop(&depot->full)) == NULL)
+				mag = build_slab(type, numa);
+			if (mag == NULL)
+				return NULL;
+			if (elem->prev != NULL)
+				magazine_push(&depot->empty, elem->prev);
+			elem->prev = elem->loaded;
+			elem->loaded = mag;
 		}
 	}
-	radix_unreachable();
+
+	node = (struct radix_tree_node *)elem->loaded->objs[--elem->loaded->cnt];
+	node->type = type;
+	arr_elem->alloc[numa]++;
+	if (numa != thread_numa)
+		arr_elem->remote_alloc[numa]++;
+	return node;
+}
+
+static inline void drain_magazine(struct node_depot *depot, struct magazine *mag) {
+	if (mag == NULL)
+		return;
+	magazine_push((mag->cnt) ? &depot->full : &depot->empty, mag);
 }
 
+/* Hand magazines of the calling thread back to depot. */
+void node_allocator_unregister(void) {
+	struct node_pthread_elem *elem;
+	int numa, type;
+
+	if (node_pthread_elem == NULL)
+		return;
+	for (numa = 0; numa < numa_cnt; numa++) {
+		for (type = 0; type < NODE_TYPE_CNT; type++) {
+			elem = &node_pthread_elem->elem[numa][type];
+			drain_magazine(&node_depot[numa][type], elem->loaded);
+			drain_magazine(&node_depot[numa][type], elem->prev);
+			elem->loaded = NULL;
+			elem->prev = NULL;
+		}
+	}
+	node_pthread_elem = NULL;
+}
@@ -0,0 +1,456 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <immintrin.h>
+
+#include "radix_tree.h"
+
+// Node search kernels
+/* Kernels are built for each instruction set with target attributes, so the tree is compiled for baseline x86-64 and
+   radix_tree_init() picks the widest set the running CPU supports. Closest key search scores lanes by distance,
+   KEY - k for smaller keys and 0x100 + k - KEY for larger ones, so that one unsigned minimum picks the winner: equal key
+   first, then the largest smaller key, then the smallest larger key. Ties go to the highest lane. */
+#define NO_DIST 0xFFFF
+
+static inline enum radix_tree_lookup_results closest_result(unsigned short min_dist, unsigned char key, unsigned char *ret_key) {
+	if (min_dist == NO_DIST)
+		return ENOEXIST_RADIX;
+	*ret_key = (min_dist < 0x100) ? key - min_dist : key + (min_dist - 0x100);
+	if (min_dist == 0)
+		return RET_MATCH_NODE;
+	return (min_dist < 0x100) ? RET_PREV_NODE : RET_NEXT_NODE;
+}
+
+static inline unsigned int count_mask(int count) {
+	return (unsigned int)((1ULL << count) - 1);
+}
+
+/* Closest bit search over the 256 bit map of N48 and N256. Keys map to bits most significant first, so the floor is the
+   lowest set bit below KEY in its word, or in the nearest non-zero word before it. WORDS has a bit for each non-zero
+   word of INDEX, which is what the vector kernels compute in one test. */
+static inline enum radix_tree_lookup_results closest_bit_result(const unsigned long long *index, unsigned int words,
+		unsigned char key, unsigned char *ret_key) {
+	unsigned char index_idx = key / BITS_PER_INDEX, index_pos = key % BITS_PER_INDEX;
+	unsigned int before = words & ((1U << index_idx) - 1);
+	unsigned long long bitfield;
+	int i;
+
+	if ((bitfield = index[index_idx] & ~(ULLONG_MAX >> index_pos))) {
+		*ret_key = (index_idx * BITS_PER_INDEX) + (BITS_PER_INDEX - 1) - __builtin_ctzll(bitfield);
+		return RET_PREV_NODE;
+	}
+	if (before) {
+		i = 31 - __builtin_clz(before);
+		*ret_key = (i * BITS_PER_INDEX) + (BITS_PER_INDEX - 1) - __builtin_ctzll(index[i]);
+		return RET_PREV_NODE;
+	}
+	if ((bitfield = index[index_idx] & ((ULLONG_MAX >> index_pos) >> 1))) {
+		*ret_key = (index_idx * BITS_PER_INDEX) + __builtin_clzll(bitfield);
+		return RET_NEXT_NODE;
+	}
+	if ((words >>= index_idx + 1)) {
+		i = index_idx + 1 + __builtin_ctz(words);
+		*ret_key = (i * BITS_PER_INDEX) + __builtin_clzll(index[i]);
+		return RET_NEXT_NODE;
+	}
+	return ENOEXIST_RADIX;
+}
+
+// Scalar
+static unsigned int match_key_scalar(const unsigned char *keys, int lanes, unsigned char key) {
+	unsigned int mask = 0;
+	int i;
+
+	for (i = 0; i < lanes; i++)
+		mask |= (unsigned int)(keys[i] == key) << i;
+	return mask;
+}
+
+static unsigned int match_key16_scalar(const unsigned char *keys, unsigned char key) {
+	return match_key_scalar(keys, 16, key);
+}
+
+static unsigned int match_key32_scalar(const unsigned char *keys, unsigned char key) {
+	return match_key_scalar(keys, 32, key);
+}
+
+static enum radix_tree_lookup_results closest_key_scalar(const unsigned char *keys_, void *const *slots, int capacity,
+		int count, unsigned char key, int *pos, unsigned char *ret_key) {
+	unsigned short dist, min_dist = NO_DIST;
+	unsigned char keys[32];
+	int i;
+
+	memcpy(keys, keys_, count);
+	barrier();
+	for (i = 0; i < count; i++) {
+		if (slots[i] == NULL)
+			continue;
+		dist = (keys[i] <= key) ? key - keys[i] : 0x100 + keys[i] - key;
+		if (dist <= min_dist) {
+			min_dist = dist;
+			*pos = i;
+		}
+	}
+	return closest_result(min_dist, key, ret_key);
+}
+
+/* Words may be read at different times, which callers tolerate. */
+static enum radix_tree_lookup_results closest_bit256_scalar(const unsigned long long *bitmap, unsigned long long *snapshot,
+		unsigned char key, unsigned char *ret_key) {
+	unsigned int words = 0;
+	int i;
+
+	for (i = 0; i < RADIX_TREE_INDEX_SIZE; i++) {
+		snapshot[i] = bitmap[i];
+		words |= (unsigned int)(snapshot[i] != 0) << i;
+	}
+	return closest_bit_result(snapshot, words, key, ret_key);
+}
+
+static int find_byte256_scalar(const unsigned char *map, unsigned char val) {
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		if (map[i] == val)
+			return i;
+	}
+	return -1;
+}
+
+// SSE4.2
+__attribute__((target("sse4.2")))
+static unsigned int match_key16_sse42(const unsigned char *keys, unsigned char key) {
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(key), _mm_loadu_si128((__m128i *)keys)));
+}
+
+__attribute__((target("sse4.2")))
+static unsigned int match_key32_sse42(const unsigned char *keys, unsigned char key) {
+	__m128i key_ = _mm_set1_epi8(key);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(key_, _mm_loadu_si128((__m128i *)keys))) |
+	       ((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(key_, _mm_loadu_si128((__m128i *)&keys[16]))) << 16);
+}
+
+/* Mask of non-NULL slots among the first COUNT, reading all CAPACITY slots two at a time. */
+__attribute__((target("sse4.2")))
+static inline unsigned int slot_mask_sse42(void *const *slots, int capacity, int count) {
+	unsigned int valid = 0;
+	int i;
+
+	for (i = 0; i < capacity; i += 2)
+		valid |= (~_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(_mm_loadu_si128((__m128i *)&slots[i]), _mm_setzero_si128()))) & 0x3) << i;
+	return valid & count_mask(count);
+}
+
+/* Distances of 8 lanes of KEYS_ widened to 16 bits, NO_DIST for lanes not set in VALID. */
+__attribute__((target("sse4.2")))
+static inline __m128i dist8_sse42(__m128i keys_, __m128i key_, unsigned int valid) {
+	const __m128i bits = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+	__m128i le = _mm_cmpeq_epi16(_mm_min_epu16(keys_, key_), keys_), dist;
+
+	dist = _mm_blendv_epi8(_mm_add_epi16(_mm_sub_epi16(keys_, key_), _mm_set1_epi16(0x100)), _mm_sub_epi16(key_, keys_), le);
+	return _mm_or_si128(dist, _mm_andnot_si128(_mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16(valid & 0xFF), bits), bits), _mm_set1_epi16(-1)));
+}
+
+/* Closest key over 8 * N lanes. */
+__attribute__((target("sse4.2")))
+static inline enum radix_tree_lookup_results closest_key_sse42(const unsigned char *keys, void *const *slots, int capacity, int count,
+		int n, unsigned char key, int *pos, unsigned char *ret_key) {
+	__m128i raw[2], dist[4], key_ = _mm_set1_epi16(key), min;
+	unsigned short min_dist;
+	unsigned int valid, eq;
+	int i;
+
+	for (i = 0; i < n / 2; i++)
+		raw[i] = _mm_loadu_si128((__m128i *)&keys[i * 16]);
+	barrier();
+	valid = slot_mask_sse42(slots, capacity, count);
+	min = _mm_set1_epi16(-1);
+	for (i = 0; i < n; i++) {
+		dist[i] = dist8_sse42(_mm_cvtepu8_epi16((i & 1) ? _mm_srli_si128(raw[i / 2], 8) : raw[i / 2]), key_, valid >> (i * 8));
+		min = _mm_min_epu16(min, dist[i]);
+	}
+	min_dist = _mm_extract_epi16(_mm_minpos_epu16(min), 0);
+	if (min_dist == NO_DIST)
+		return ENOEXIST_RADIX;
+	for (i = n - 1; i >= 0; i--) {
+		if ((eq = _mm_movemask_epi8(_mm_cmpeq_epi16(dist[i], _mm_set1_epi16(min_dist))))) {
+			*pos = (i * 8) + (31 - __builtin_clz(eq)) / 2;
+			break;
+		}
+	}
+	return closest_result(min_dist, key, ret_key);
+}
+
+__attribute__((target("sse4.2")))
+static enum radix_tree_lookup_results closest_key16_sse42(const unsigned char *keys, void *const *slots, int capacity,
+		int count, unsigned char key, int *pos, unsigned char *ret_key) {
+	return closest_key_sse42(keys, slots, capacity, count, 2, key, pos, ret_key);
+}
+
+__attribute__((target("sse4.2")))
+static enum radix_tree_lookup_results closest_key32_sse42(const unsigned char *keys, void *const *slots, int capacity,
+		int count, unsigned char key, int *pos, unsigned char *ret_key) {
+	return closest_key_sse42(keys, slots, capacity, count, 4, key, pos, ret_key);
+}
+
+__attribute__((target("sse4.2")))
+static int find_byte256_sse42(const unsigned char *map, unsigned char val) {
+	__m128i val_ = _mm_set1_epi8(val);
+	unsigned int mask;
+	int i;
+
+	for (i = 0; i < 256; i += 16) {
+		if ((mask = _mm_movemask_epi8(_mm_cmpeq_epi8(val_, _mm_loadu_si128((__m128i *)&map[i])))))
+			return i + __builtin_ctz(mask);
+	}
+	return -1;
+}
+
+/* Two 16 byte loads, so the halves of the snapshot may be read at different times. */
+__attribute__((target("sse4.2")))
+static enum radix_tree_lookup_results closest_bit256_sse42(const unsigned long long *bitmap, unsigned long long *snapshot,
+		unsigned char key, unsigned char *ret_key) {
+	__m128i lo = _mm_loadu_si128((__m128i *)bitmap), hi = _mm_loadu_si128((__m128i *)&bitmap[2]);
+	unsigned int words;
+
+	_mm_storeu_si128((__m128i *)snapshot, lo);
+	_mm_storeu_si128((__m128i *)&snapshot[2], hi);
+	words = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(lo, _mm_setzero_si128()))) |
+		(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(hi, _mm_setzero_si128()))) << 2);
+	return closest_bit_result(snapshot, ~words & 0xF, key, ret_key);
+}
+
+// AVX2
+__attribute__((target("avx2")))
+static unsigned int match_key32_avx2(const unsigned char *keys, unsigned char key) {
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_set1_epi8(key), _mm256_loadu_si256((__m256i *)keys)));
+}
+
+/* Mask of non-NULL slots among the first COUNT, reading all CAPACITY slots four at a time. */
+__attribute__((target("avx2")))
+static inline unsigned int slot_mask_avx2(void *const *slots, int capacity, int count) {
+	unsigned int valid = 0;
+	int i;
+
+	for (i = 0; i < capacity; i += 4)
+		valid |= (~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i *)&slots[i]), _mm256_setzero_si256()))) & 0xF) << i;
+	return valid & count_mask(count);
+}
+
+/* Distances of 16 lanes of KEYS widened to 16 bits, NO_DIST for lanes not set in VALID. */
+__attribute__((target("avx2")))
+static inline __m256i dist16_avx2(__m128i keys, __m256i key_, unsigned int valid) {
+	const __m256i bits = _mm256_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, (short)32768);
+	__m256i keys_ = _mm256_cvtepu8_epi16(keys), le = _mm256_cmpeq_epi16(_mm256_min_epu16(keys_, key_), keys_), dist;
+
+	dist = _mm256_blendv_epi8(_mm256_add_epi16(_mm256_sub_epi16(keys_, key_), _mm256_set1_epi16(0x100)), _mm256_sub_epi16(key_, keys_), le);
+	return _mm256_or_si256(dist, _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_and_si256(_mm256_set1_epi16((short)valid), bits), bits),
+							 _mm256_set1_epi16(-1)));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned short min_epu16_avx2(__m256i dist) {
+	return _mm_extract_epi16(_mm_minpos_epu16(_mm_min_epu16(_mm256_castsi256_si128(dist), _mm256_extracti128_si256(dist, 1))), 0);
+}
+
+__attribute__((target("avx2")))
+static enum radix_tree_lookup_results closest_key16_avx2(const unsigned char *keys, void *const *slots, int capacity,
+		int count, unsigned char key, int *pos, unsigned char *ret_key) {
+	__m128i raw = _mm_loadu_si128((__m128i *)keys);
+	__m256i dist;
+	unsigned short min_dist;
+
+	barrier();
+	dist = dist16_avx2(raw, _mm256_set1_epi16(key), slot_mask_avx2(slots, capacity, count));
+	if ((min_dist = min_epu16_avx2(dist)) == NO_DIST)
+		return ENOEXIST_RADIX;
+	*pos = (31 - __builtin_clz(_mm256_movemask_epi8(_mm256_cmpeq_epi16(dist, _mm256_set1_epi16(min_dist))))) / 2;
+	return closest_result(min_dist, key, ret_key);
+}
+
+__attribute__((target("avx2")))
+static enum radix_tree_lookup_results closest_key32_avx2(const unsigned char *keys, void *const *slots, int capacity,
+		int count, unsigned char key, int *pos, unsigned char *ret_key) {
+	__m256i raw = _mm256_loadu_si256((__m256i *)keys), key_ = _mm256_set1_epi16(key), lo, hi;
+	unsigned short min_dist;
+	unsigned int valid, eq;
+
+	barrier();
+	valid = slot_mask_avx2(slots, capacity, count);
+	lo = dist16_avx2(_mm256_castsi256_si128(raw), key_, valid);
+	hi = dist16_avx2(_mm256_extracti128_si256(raw, 1), key_, valid >> 16);
+	if ((min_dist = min_epu16_avx2(_mm256_min_epu16(lo, hi))) == NO_DIST)
+		return ENOEXIST_RADIX;
+	if ((eq = _mm256_movemask_epi8(_mm256_cmpeq_epi16(hi, _mm256_set1_epi16(min_dist)))))
+		*pos = 16 + (31 - __builtin_clz(eq)) / 2;
+	else
+		*pos = (31 - __builtin_clz(_mm256_movemask_epi8(_mm256_cmpeq_epi16(lo, _mm256_set1_epi16(min_dist))))) / 2;
+	return closest_result(min_dist, key, ret_key);
+}
+
+__attribute__((target("avx2")))
+static int find_byte256_avx2(const unsigned char *map, unsigned char val) {
+	__m256i val_ = _mm256_set1_epi8(val);
+	unsigned int mask;
+	int i;
+
+	for (i = 0; i < 256; i += 32) {
+		if ((mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(val_, _mm256_loadu_si256((__m256i *)&map[i])))))
+			return i + __builtin_ctz(mask);
+	}
+	return -1;
+}
+
+/* A single 32 byte load snapshots the whole bitmap. */
+__attribute__((target("avx2")))
+static enum radix_tree_lookup_results closest_bit256_avx2(const unsigned long long *bitmap, unsigned long long *snapshot,
+		unsigned char key, unsigned char *ret_key) {
+	__m256i index_ = _mm256_loadu_si256((__m256i *)bitmap);
+
+	_mm256_storeu_si256((__m256i *)snapshot, index_);
+	return closest_bit_result(snapshot, ~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(index_, _mm256_setzero_si256()))) & 0xF,
+				  key, ret_key);
+}
+
+// AVX-512
+__attribute__((target("avx512bw,avx512vl")))
+static unsigned int match_key16_avx512(const unsigned char *keys, unsigned char key) {
+	return _mm_cmpeq_epi8_mask(_mm_set1_epi8(key), _mm_loadu_si128((__m128i *)keys));
+}
+
+__attribute__((target("avx512bw,avx512vl")))
+static unsigned int match_key32_avx512(const unsigned char *keys, unsigned char key) {
+	return _mm256_cmpeq_epi8_mask(_mm256_set1_epi8(key), _mm256_loadu_si256((__m256i *)keys));
+}
+
+/* Mask of non-NULL slots among the first COUNT, reading all CAPACITY slots. Plain loads are used as masked loads turn
+   out slower on the lookup path. */
+__attribute__((target("avx512bw,avx512vl")))
+static inline unsigned int slot_mask_avx512(void *const *slots, int capacity, int count) {
+	unsigned int valid = 0;
+	__m512i v;
+	int i;
+
+	if (capacity == 4)
+		valid = _mm256_test_epi64_mask(_mm256_loadu_si256((__m256i *)slots), _mm256_loadu_si256((__m256i *)slots));
+	else {
+		for (i = 0; i < capacity; i += 8) {
+			v = _mm512_loadu_si512((__m512i *)&slots[i]);
+			valid |= (unsigned int)_mm512_test_epi64_mask(v, v) << i;
+		}
+	}
+	return valid & count_mask(count);
+}
+
+__attribute__((target("avx512bw,avx512vl")))
+static enum radix_tree_lookup_results closest_key16_avx512(const unsigned char *keys, void *const *slots, int capacity,
+		int count, unsigned char key, int *pos, unsigned char *ret_key) {
+	__m256i keys_ = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)keys)), key_ = _mm256_set1_epi16(key), dist;
+	unsigned short le = _mm256_cmple_epu16_mask(keys_, key_), min_dist;
+	unsigned int valid;
+
+	barrier();
+	valid = slot_mask_avx512(slots, capacity, count);
+	dist = _mm256_mask_sub_epi16(_mm256_add_epi16(_mm256_sub_epi16(keys_, key_), _mm256_set1_epi16(0x100)), le, key_, keys_);
+	dist = _mm256_mask_mov_epi16(_mm256_set1_epi16(-1), valid, dist);
+	min_dist = _mm_extract_epi16(_mm_minpos_epu16(_mm_min_epu16(_mm256_castsi256_si128(dist), _mm256_extracti128_si256(dist, 1))), 0);
+	if (min_dist == NO_DIST)
+		return ENOEXIST_RADIX;
+	*pos = 31 - __builtin_clz(_mm256_cmpeq_epi16_mask(dist, _mm256_set1_epi16(min_dist)));
+	return closest_result(min_dist, key, ret_key);
+}
+
+__attribute__((target("avx512bw,avx512vl")))
+static enum radix_tree_lookup_results closest_key32_avx512(const unsigned char *keys, void *const *slots, int capacity,
+		int count, unsigned char key, int *pos, unsigned char *ret_key) {
+	__m512i keys_ = _mm512_cvtepu8_epi16(_mm256_loadu_si256((__m256i *)keys)), key_ = _mm512_set1_epi16(key), dist;
+	unsigned int le = _mm512_cmple_epu16_mask(keys_, key_), valid;
+	unsigned short min_dist;
+	__m256i min;
+
+	barrier();
+	valid = slot_mask_avx512(slots, capacity, count);
+	dist = _mm512_mask_sub_epi16(_mm512_add_epi16(_mm512_sub_epi16(keys_, key_), _mm512_set1_epi16(0x100)), le, key_, keys_);
+	dist = _mm512_mask_mov_epi16(_mm512_set1_epi16(-1), valid, dist);
+	min = _mm256_min_epu16(_mm512_castsi512_si256(dist), _mm512_extracti64x4_epi64(dist, 1));
+	min_dist = _mm_extract_epi16(_mm_minpos_epu16(_mm_min_epu16(_mm256_castsi256_si128(min), _mm256_extracti128_si256(min, 1))), 0);
+	if (min_dist == NO_DIST)
+		return ENOEXIST_RADIX;
+	*pos = 31 - __builtin_clz(_mm512_cmpeq_epi16_mask(dist, _mm512_set1_epi16(min_dist)));
+	return closest_result(min_dist, key, ret_key);
+}
+
+__attribute__((target("avx512bw,avx512vl")))
+static int find_byte256_avx512(const unsigned char *map, unsigned char val) {
+	__m512i val_ = _mm512_set1_epi8(val);
+	unsigned long long mask;
+	int i;
+
+	for (i = 0; i < 256; i += 64) {
+		if ((mask = _mm512_cmpeq_epi8_mask(val_, _mm512_loadu_si512((__m512i *)&map[i]))))
+			return i + __builtin_ctzll(mask);
+	}
+	return -1;
+}
+
+__attribute__((target("avx512bw,avx512vl")))
+static enum radix_tree_lookup_results closest_bit256_avx512(const unsigned long long *bitmap, unsigned long long *snapshot,
+		unsigned char key, unsigned char *ret_key) {
+	__m256i index_ = _mm256_loadu_si256((__m256i *)bitmap);
+
+	_mm256_storeu_si256((__m256i *)snapshot, index_);
+	return closest_bit_result(snapshot, _mm256_test_epi64_mask(index_, index_), key, ret_key);
+}
+
+// Dispatch
+static const struct node_search_ops search_ops_table[] = {
+	{"avx512", match_key16_avx512, match_key32_avx512, closest_key16_avx512, closest_key32_avx512, find_byte256_avx512, closest_bit256_avx512},
+	{"avx2", match_key16_sse42, match_key32_avx2, closest_key16_avx2, closest_key32_avx2, find_byte256_avx2, closest_bit256_avx2},
+	{"sse4.2", match_key16_sse42, match_key32_sse42, closest_key16_sse42, closest_key32_sse42, find_byte256_sse42, closest_bit256_sse42},
+	{"scalar", match_key16_scalar, match_key32_scalar, closest_key_scalar, closest_key_scalar, find_byte256_scalar, closest_bit256_scalar},
+};
+#define SEARCH_OPS_CNT (sizeof(search_ops_table) / sizeof(search_ops_table[0]))
+
+/* Scalar kernels until radix_tree_init() runs, so that trees work without it. */
+struct node_search_ops radix_search_ops = {"scalar", match_key16_scalar, match_key32_scalar, closest_key_scalar, closest_key_scalar, find_byte256_scalar, closest_bit256_scalar};
+
+static bool search_ops_supported(const struct node_search_ops *ops) {
+	__builtin_cpu_init();
+	if (!strcmp(ops->name, "avx512"))
+		return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+	if (!strcmp(ops->name, "avx2"))
+		return __builtin_cpu_supports("avx2");
+	if (!strcmp(ops->name, "sse4.2"))
+		return __builtin_cpu_supports("sse4.2");
+	return true;
+}
+
+const struct node_search_ops *get_node_search_ops(const char *name) {
+	int i;
+
+	for (i = 0; i < SEARCH_OPS_CNT; i++) {
+		if (((name == NULL) || !strcmp(name, search_ops_table[i].name)) && search_ops_supported(&search_ops_table[i]))
+			return &search_ops_table[i];
+	}
+	return NULL;
+}
+
+void node_search_init(void) {
+	radix_search_ops = *get_node_search_ops(NULL);
+}
+
+const char *radix_tree_search_kernel(void) {
+	return radix_search_ops.name;
+}
+
+int radix_tree_set_search_kernel(const char *name) {
+	const struct node_search_ops *ops = get_node_search_ops(name);
+
+	if (ops == NULL)
+		return -1;
+	radix_search_ops = *ops;
+	return 0;
+}
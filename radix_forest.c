@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "radix_tree.h"
+
+#define shard_span(FOREST) (1ULL << (FOREST)->shard_shift)
+#define shard_base(FOREST, SHARD) ((unsigned long long)(SHARD) << (FOREST)->shard_shift)
+
+/* Counters of SHARD for the calling thread. Only the owner thread writes them. */
+static inline struct radix_forest_stats *get_shard_stats(struct radix_forest *forest, int shard) {
+	return (struct radix_forest_stats *)get_pthread_elem(&forest->stats, get_tid()) + shard;
+}
+
+int radix_forest_create(struct radix_forest *forest, int key_bits, int shard_bits) {
+	int i;
+
+	if ((shard_bits < 1) || (shard_bits > RADIX_FOREST_MAX_SHARD_BITS))
+		return -1;
+	memset(forest, 0x0, sizeof(*forest));
+	forest->shard_cnt = 1 << shard_bits;
+	forest->shards = (struct radix_tree_root *)malloc(forest->shard_cnt * sizeof(struct radix_tree_root));
+	assert(forest->shards != NULL);
+	for (i = 0; i < forest->shard_cnt; i++) {
+		if (radix_tree_create_key_bits(&forest->shards[i], key_bits) != 0) {
+			free(forest->shards);
+			forest->shards = NULL;
+			return -1;
+		}
+	}
+	forest->key_size = key_bits / RADIX_TREE_ENTRY_BIT_SIZE;
+	forest->shard_shift = key_bits - shard_bits;
+	// Per-thread counters of all shards are rounded to lines, so threads do not share lines.
+	forest->stats.elem_size = (forest->shard_cnt * sizeof(struct radix_forest_stats) + 63) & ~63ULL;
+	return 0;
+}
+
+void radix_forest_destroy(struct radix_forest *forest) {
+	int i;
+
+	for (i = 0; i < forest->shard_cnt; i++)
+		radix_tree_destroy(&forest->shards[i]);
+	for (i = 0; i < PTHREAD_CHUNK_CNT; i++)
+		free(forest->stats.chunks[i]);
+	free(forest->shards);
+	memset(forest, 0x0, sizeof(*forest));
+}
+
+/* Insert operation entry point. The last shard is left to clip the extent at the end of the key space. */
+void radix_forest_insert(struct radix_forest *forest, unsigned long long index, unsigned long long length, void *log_addr, int tx_id) {
+	unsigned long long piece;
+	int shard;
+
+	if (is_fault_index(index, forest->key_size)) {
+		radix_assert(false);
+		return;
+	}
+	do {
+		shard = radix_forest_shard(forest, index);
+		piece = shard_span(forest) - (index - shard_base(forest, shard));
+		if ((length < piece) || (shard == forest->shard_cnt - 1))
+			piece = length;
+		radix_tree_insert(&forest->shards[shard], index, piece, log_addr, tx_id);
+		get_shard_stats(forest, shard)->inserts++;
+		index += piece;
+		log_addr += piece;
+		length -= piece;
+	} while (length);
+}
+
+/* Lookup operation entry point. A piece never covers an index out of its shard, so only the next leaf may be found in
+   a following shard, as the first leaf of the first non-empty one. */
+enum radix_tree_lookup_results radix_forest_lookup(struct radix_forest *forest, unsigned long long index, struct radix_tree_leaf **leaf) {
+	enum radix_tree_lookup_results ret;
+	int shard;
+
+	if (is_fault_index(index, forest->key_size)) {
+		*leaf = NULL;
+		return EFAULT_RADIX;
+	}
+	shard = radix_forest_shard(forest, index);
+	get_shard_stats(forest, shard)->lookups++;
+	ret = radix_tree_lookup(&forest->shards[shard], index, leaf);
+	while ((ret == ENOEXIST_RADIX) && (++shard < forest->shard_cnt)) {
+		if ((ret = radix_tree_lookup(&forest->shards[shard], shard_base(forest, shard), leaf)) != ENOEXIST_RADIX)
+			ret = RET_NEXT_NODE;
+	}
+	return ret;
+}
+
+enum radix_tree_lookup_results radix_forest_lookup_extent(struct radix_forest *forest, unsigned long long index, struct radix_tree_extent *extent) {
+	enum radix_tree_lookup_results ret;
+	int shard;
+
+	if (is_fault_index(index, forest->key_size))
+		return EFAULT_RADIX;
+	shard = radix_forest_shard(forest, index);
+	get_shard_stats(forest, shard)->lookups++;
+	ret = radix_tree_lookup_extent(&forest->shards[shard], index, extent);
+	while ((ret == ENOEXIST_RADIX) && (++shard < forest->shard_cnt)) {
+		if ((ret = radix_tree_lookup_extent(&forest->shards[shard], shard_base(forest, shard), extent)) != ENOEXIST_RADIX)
+			ret = RET_NEXT_NODE;
+	}
+	return ret;
+}
+
+void radix_forest_remove(struct radix_forest *forest, struct radix_tree_leaf *leaf) {
+	int shard = radix_forest_shard(forest, leaf->node.offset);
+
+	radix_tree_remove(&forest->shards[shard], leaf);
+	get_shard_stats(forest, shard)->removes++;
+}
+
+/* State of a forest scan. PENDING holds pieces that end at the end of the shard being scanned, until the piece at the
+   start of the next shard shows whether they continue. */
+struct forest_scan {
+	radix_tree_scan_fn fn;
+	void *arg;
+	struct radix_tree_extent pending;
+	bool has_pending;
+	bool stop;
+	unsigned long long cnt;
+	unsigned long long shard_end; /* End of the scanned shard, 0 if the scan ends in it. */
+	struct radix_forest_stats *stats;
+};
+
+static inline int forest_scan_emit(struct forest_scan *scan, const struct radix_tree_extent *extent) {
+	scan->cnt++;
+	scan->stop = (scan->fn(extent, scan->arg) != 0);
+	return scan->stop;
+}
+
+static int forest_scan_fn(const struct radix_tree_extent *extent, void *arg) {
+	struct forest_scan *scan = (struct forest_scan *)arg;
+	struct radix_tree_extent *pending = &scan->pending;
+
+	scan->stats->scanned++;
+	if (scan->has_pending) {
+		if ((pending->offset + pending->length == extent->offset) && (pending->log_addr + pending->length == extent->log_addr) &&
+		    (pending->tx_id == extent->tx_id)) {
+			pending->length += extent->length;
+		}
+		else {
+			scan->has_pending = false;
+			if (forest_scan_emit(scan, pending))
+				return 1;
+			*pending = *extent;
+		}
+	}
+	else
+		*pending = *extent;
+
+	if ((scan->shard_end != 0) && (pending->offset + pending->length == scan->shard_end)) {
+		scan->has_pending = true;
+		return 0;
+	}
+	scan->has_pending = false;
+	return forest_scan_emit(scan, pending);
+}
+
+/* Scan operation entry point. Shards are scanned one after another, each under its own leaf locks. Pieces held over
+   are passed on by the first extent that does not continue them, or at the end. */
+unsigned long long radix_forest_scan(struct radix_forest *forest, unsigned long long start, unsigned long long end, radix_tree_scan_fn fn, void *arg) {
+	struct forest_scan scan;
+	unsigned long long shard_start;
+	int shard;
+
+	if ((start >= end) || is_fault_index(start, forest->key_size))
+		return 0;
+
+	memset(&scan, 0x0, sizeof(scan));
+	scan.fn = fn;
+	scan.arg = arg;
+	for (shard = radix_forest_shard(forest, start), shard_start = start; shard < forest->shard_cnt; shard++) {
+		// The end of the last shard of a 64-bit key space wraps to 0, which also marks the scan ending in the shard.
+		scan.shard_end = shard_base(forest, shard) + shard_span(forest);
+		if ((shard == forest->shard_cnt - 1) || (scan.shard_end >= end))
+			scan.shard_end = 0;
+		scan.stats = get_shard_stats(forest, shard);
+		radix_tree_scan(&forest->shards[shard], shard_start, scan.shard_end ? scan.shard_end : end, forest_scan_fn, &scan);
+		if (scan.stop || (scan.shard_end == 0))
+			break;
+		shard_start = scan.shard_end;
+	}
+	if (scan.has_pending && !scan.stop)
+		forest_scan_emit(&scan, &scan.pending);
+	return scan.cnt;
+}
+
+void radix_forest_shard_stats(struct radix_forest *forest, int shard, struct radix_forest_stats *stats) {
+	struct radix_forest_stats *elem;
+	int tid, tid_cnt = get_tid_cnt();
+
+	memset(stats, 0, sizeof(*stats));
+	for (tid = 0; tid < tid_cnt; tid++) {
+		if ((elem = peek_pthread_elem(&forest->stats, tid)) == NULL)
+			continue;
+		elem += shard;
+		stats->inserts += __atomic_load_n(&elem->inserts, __ATOMIC_RELAXED);
+		stats->removes += __atomic_load_n(&elem->removes, __ATOMIC_RELAXED);
+		stats->lookups += __atomic_load_n(&elem->lookups, __ATOMIC_RELAXED);
+		stats->scanned += __atomic_load_n(&elem->scanned, __ATOMIC_RELAXED);
+	}
+}
+
+static int count_extent(const struct radix_tree_extent *extent, void *arg) {
+	return 0;
+}
+
+unsigned long long radix_forest_shard_extents(struct radix_forest *forest, int shard) {
+	unsigned long long end = shard_base(forest, shard) + shard_span(forest);
+
+	// The last shard of a 64-bit key space ends past ULLONG_MAX, which scans cannot cover.
+	if (end == 0)
+		end = ULLONG_MAX;
+	return radix_tree_scan(&forest->shards[shard], shard_base(forest, shard), end, count_extent, NULL);
+}
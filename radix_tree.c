@@ -5,36 +5,81 @@
 #include <assert.h>
 #include <stdatomic.h>
 #include <immintrin.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "radix_tree.h"
 
+#ifdef RADIX_SINGLE_THREAD
+/* Single threaded build. Each tree is used by one thread only, so root and node locks turn into plain accesses and
+   restart paths compile away. Only the obsolete bit is kept, for cursors and removes holding an unlinked leaf. */
+#define get_root_node(SLOT) (*(SLOT))
+#define root_write_unlock(SLOT, NEW_ROOT_NODE) (*(SLOT) = (NEW_ROOT_NODE))
+#define root_write_lock_or_restart(SLOT, ROOT_NODE) (false)
+#define root_cas(SLOT, OLD_ROOT_NODE, NEW_ROOT_NODE) (*(SLOT) = (NEW_ROOT_NODE), (OLD_ROOT_NODE))
+
+#define get_version(NODE) ((NODE)->lock_n_obsolete)
+#define is_locked(VERSION) (false)
+#define is_obsolete(VERSION) ((VERSION) & 1)
+#define write_unlock(NODE) ((void)(NODE))
+#define write_unlock_obsolete(NODE) ((NODE)->lock_n_obsolete |= 1)
+#define mark_obsolete(NODE) ((NODE)->lock_n_obsolete |= 1)
+#define read_unlock_or_restart(NODE, START_READ) (false)
+#define check_or_restart(NODE, START_READ) (false)
+
+static inline void write_lock(struct radix_tree_node *node) {
+}
+
+static inline bool lock_version_or_restart(struct radix_tree_node *node, unsigned int *version) {
+	return false;
+}
+#else
 // Mutex implementation for Radix tree root
+/* Root pointers are locked by their top bit. SLOT is the root_node of a tree, or a slot of its directory. */
 #define ROOT_LOCK_BIT (1ULL << 63)
-#define get_root_node(ROOT) \
-	((typeof((ROOT)->root_node))(((unsigned long long)atomic_load(&(ROOT)->root_node)) & (ROOT_LOCK_BIT - 1)))
-#define root_write_unlock(ROOT, NEW_ROOT_NODE) (atomic_store(&(ROOT)->root_node, (NEW_ROOT_NODE)))
-#define root_write_lock_or_restart(ROOT, ROOT_NODE) \
-	(__sync_val_compare_and_swap(&(ROOT)->root_node, (ROOT_NODE), \
-				     (typeof((ROOT)->root_node))(((unsigned long long)(ROOT_NODE)) | ROOT_LOCK_BIT)) != (ROOT_NODE))
-#define ROOT_END_OFS (1ULL << 40)
+#define get_root_node(SLOT) \
+	((typeof(*(SLOT)))(((unsigned long long)atomic_load(SLOT)) & (ROOT_LOCK_BIT - 1)))
+#define root_write_unlock(SLOT, NEW_ROOT_NODE) (atomic_store(SLOT, (NEW_ROOT_NODE)))
+#define root_write_lock_or_restart(SLOT, ROOT_NODE) \
+	(__sync_val_compare_and_swap(SLOT, (ROOT_NODE), \
+				     (typeof(*(SLOT)))(((unsigned long long)(ROOT_NODE)) | ROOT_LOCK_BIT)) != (ROOT_NODE))
+#define root_cas(SLOT, OLD_ROOT_NODE, NEW_ROOT_NODE) (__sync_val_compare_and_swap(SLOT, (OLD_ROOT_NODE), (NEW_ROOT_NODE)))
 
 // Mutex implememtation for Radix tree nodes
+/* Version is 32 bits to keep the header in 16 bytes. A reader misses a change only if a node sees 2^30 writes
+   within its read section. */
 #define get_version(NODE) (atomic_load(&(NODE)->lock_n_obsolete))
 #define is_locked(VERSION) (((VERSION) & 0b10) == 0b10)
 #define is_obsolete(VERSION) ((VERSION) & 1)
 #define write_unlock(NODE) (atomic_fetch_add(&(NODE)->lock_n_obsolete, 0b10))
 #define write_unlock_obsolete(NODE) (atomic_fetch_add(&(NODE)->lock_n_obsolete, 0b11))
+#define mark_obsolete(NODE) (atomic_fetch_or(&(NODE)->lock_n_obsolete, 0b1))
 #define read_unlock_or_restart(NODE, START_READ) ((START_READ) != atomic_load(&(NODE)->lock_n_obsolete))
 #define check_or_restart(NODE, START_READ) (read_unlock_or_restart(NODE, START_READ))
 
 
+static void spin_yield(void);
+
+/* Pause in a wait loop, and give up the CPU every SPIN_YIELD_PAUSES pauses in case the holder has been preempted. */
+#define SPIN_YIELD_PAUSES 1024
+static inline void spin_wait(unsigned int *spins) {
+	if (++*spins < SPIN_YIELD_PAUSES)
+		_mm_pause();
+	else {
+		*spins = 0;
+		spin_yield();
+	}
+}
+
 /* Return true for restart needed, false for success. */
 static inline bool write_lock_or_restart(struct radix_tree_node *node) {
-	unsigned long long version;
+	unsigned int version, spins = 0;
 	do {
 		version = get_version(node);
 		while (is_locked(version)) {
-			_mm_pause();
+			spin_wait(&spins);
 			version = get_version(node);
 		}
 		if (is_obsolete(version))
@@ -43,7 +88,16 @@ static inline bool write_lock_or_restart(struct radix_tree_node *node) {
 	return false;
 }
 
-static inline bool lock_version_or_restart(struct radix_tree_node *node, unsigned long long *version) {
+/* Spin until NODE is write locked. Used for leaves, whose fields are published under the version as a seqlock. */
+static inline void write_lock(struct radix_tree_node *node) {
+	unsigned int version, spins = 0;
+	do {
+		while (is_locked(version = get_version(node)))
+			spin_wait(&spins);
+	} while (!atomic_compare_exchange_weak(&node->lock_n_obsolete, &version, version + 0b10));
+}
+
+static inline bool lock_version_or_restart(struct radix_tree_node *node, unsigned int *version) {
 	if (is_locked(*version) || is_obsolete(*version))
 		return true;
 	if (atomic_compare_exchange_strong(&node->lock_n_obsolete, version, *version + 0b10)) {
@@ -53,102 +107,446 @@ static inline bool lock_version_or_restart(struct radix_tree_node *node, unsigne
 	else
 		return true;
 }
+#endif
+
+// Leaf lock
+/* Futex based lock word. Spin briefly, then mark contended and park until the holder wakes a waiter. */
+#define LEAF_UNLOCKED 0
+#define LEAF_LOCKED 1
+#define LEAF_CONTENDED 2 /* Locked, and waiters may be parked on the futex. */
+#define LEAF_LOCK_SPIN 100
+
+#ifdef RADIX_SINGLE_THREAD
+static inline void leaf_lock(struct radix_tree_leaf *leaf) {
+}
+
+static inline void leaf_unlock(struct radix_tree_leaf *leaf) {
+}
+#else
+static inline void leaf_lock(struct radix_tree_leaf *leaf) {
+	unsigned int state = LEAF_UNLOCKED;
+	int i;
+
+	if (atomic_compare_exchange_strong(&leaf->lock, &state, LEAF_LOCKED))
+		return;
+	for (i = 0; (i < LEAF_LOCK_SPIN) && (state == LEAF_LOCKED); i++) {
+		_mm_pause();
+		if ((state = atomic_load(&leaf->lock)) == LEAF_UNLOCKED) {
+			if (atomic_compare_exchange_strong(&leaf->lock, &state, LEAF_LOCKED))
+				return;
+		}
+	}
+	while (atomic_exchange(&leaf->lock, LEAF_CONTENDED) != LEAF_UNLOCKED)
+		syscall(SYS_futex, &leaf->lock, FUTEX_WAIT_PRIVATE, LEAF_CONTENDED, NULL, NULL, 0);
+}
+
+static inline void leaf_unlock(struct radix_tree_leaf *leaf) {
+	if (atomic_exchange(&leaf->lock, LEAF_UNLOCKED) == LEAF_CONTENDED)
+		syscall(SYS_futex, &leaf->lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+#endif
+
+// Contention manager
+/* Writers that restart back off for a random number of pauses below a bound, which doubles on every restart up to
+   max_backoff. A writer which runs out of its restart budget while holding no leaf lock queues on an MCS lock picked by
+   the node it restarted at, and keeps it until done, so that writers fighting over a node go through it in turn
+   instead of restarting together. Writers holding leaf locks only back off, as the queue holder may be waiting for
+   their leaves. An operation holds at most one queue lock, so queue locks never nest. */
+#define BACKOFF_MIN 4
+#define CONTENTION_LOCK_SHIFT 10
+#define CONTENTION_LOCK_CNT (1 << CONTENTION_LOCK_SHIFT)
+#define MCS_GRANTED 0
+#define MCS_WAITING 1
+#define MCS_PARKED 2 /* Waiting on the futex, so the releaser should wake it. */
+
+static int restart_budget = 8;
+static unsigned int max_backoff = 1024;
+
+void radix_tree_set_contention(int budget, unsigned int backoff) {
+	restart_budget = budget;
+	max_backoff = backoff;
+}
+
+struct contention {
+	unsigned int restarts;
+	unsigned int backoff; /* Bound of the next backoff. */
+	struct mcs_lock *lock; /* Queue lock held, if any. */
+};
+
+struct mcs_qnode {
+	struct mcs_qnode *next;
+	unsigned int state;
+} __attribute__((aligned(64)));
+
+struct mcs_lock {
+	struct mcs_qnode *tail;
+} __attribute__((aligned(64)));
+
+/* Counters of struct radix_contention_stats, written by the owner only. */
+struct contention_pthread_elem {
+	unsigned long long restarts;
+	unsigned long long backoffs;
+	unsigned long long backoff_pauses;
+	unsigned long long fallbacks;
+	unsigned long long queued;
+	unsigned long long spin_yields;
+} __attribute__((aligned(64)));
+
+static struct pthread_arr contention_pthread_arr = PTHREAD_ARR_INITIALIZER(struct contention_pthread_elem);
+
+void radix_tree_contention_stats(struct radix_contention_stats *stats) {
+	struct contention_pthread_elem *elem;
+	int tid, tid_cnt = get_tid_cnt();
+
+	memset(stats, 0, sizeof(*stats));
+	for (tid = 0; tid < tid_cnt; tid++) {
+		if ((elem = peek_pthread_elem(&contention_pthread_arr, tid)) == NULL)
+			continue;
+		stats->restarts += __atomic_load_n(&elem->restarts, __ATOMIC_RELAXED);
+		stats->backoffs += __atomic_load_n(&elem->backoffs, __ATOMIC_RELAXED);
+		stats->backoff_pauses += __atomic_load_n(&elem->backoff_pauses, __ATOMIC_RELAXED);
+		stats->fallbacks += __atomic_load_n(&elem->fallbacks, __ATOMIC_RELAXED);
+		stats->queued += __atomic_load_n(&elem->queued, __ATOMIC_RELAXED);
+		stats->spin_yields += __atomic_load_n(&elem->spin_yields, __ATOMIC_RELAXED);
+	}
+}
+
+static inline struct contention_pthread_elem *get_contention_pthread_elem(void) {
+	return (struct contention_pthread_elem *)get_pthread_elem(&contention_pthread_arr, get_tid());
+}
+
+#ifdef RADIX_SINGLE_THREAD
+#define contention_init(CM) ((void)(CM))
+#define contention_restart(CM, NODE, FALLBACK) ((void)(CM))
+#define contention_done(CM) ((void)(CM))
+#else
+static struct mcs_lock contention_locks[CONTENTION_LOCK_CNT];
+static __thread struct mcs_qnode contention_qnode;
+static __thread unsigned int backoff_seed = 0;
+
+static void spin_yield(void) {
+	get_contention_pthread_elem()->spin_yields++;
+	sched_yield();
+}
+
+/* Return true if LOCK was held by others. */
+static bool mcs_lock(struct mcs_lock *lock, struct mcs_qnode *qnode) {
+	struct mcs_qnode *prev;
+	unsigned int state;
+	int i;
+
+	qnode->next = NULL;
+	atomic_store(&qnode->state, MCS_WAITING);
+	if ((prev = atomic_exchange(&lock->tail, qnode)) == NULL)
+		return false;
+	atomic_store(&prev->next, qnode);
+	for (i = 0; (i < LEAF_LOCK_SPIN) && (atomic_load(&qnode->state) != MCS_GRANTED); i++)
+		_mm_pause();
+	while ((state = atomic_load(&qnode->state)) != MCS_GRANTED) {
+		if ((state == MCS_PARKED) || atomic_compare_exchange_strong(&qnode->state, &state, MCS_PARKED))
+			syscall(SYS_futex, &qnode->state, FUTEX_WAIT_PRIVATE, MCS_PARKED, NULL, NULL, 0);
+	}
+	return true;
+}
+
+static void mcs_unlock(struct mcs_lock *lock, struct mcs_qnode *qnode) {
+	struct mcs_qnode *next = atomic_load(&qnode->next), *expected = qnode;
+	unsigned int spins = 0;
+
+	if (next == NULL) {
+		if (atomic_compare_exchange_strong(&lock->tail, &expected, NULL))
+			return;
+		// A successor has swapped the tail but not linked itself yet.
+		while ((next = atomic_load(&qnode->next)) == NULL)
+			spin_wait(&spins);
+	}
+	if (atomic_exchange(&next->state, MCS_GRANTED) == MCS_PARKED)
+		syscall(SYS_futex, &next->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static inline void contention_init(struct contention *cm) {
+	cm->restarts = 0;
+	cm->backoff = BACKOFF_MIN;
+	cm->lock = NULL;
+}
+
+/* Called on every restart at NODE, the last node visited or the root pointer. FALLBACK tells whether the caller holds
+   no leaf lock, so that it may queue. */
+static void contention_restart(struct contention *cm, void *node, bool fallback) {
+	struct contention_pthread_elem *elem = get_contention_pthread_elem();
+	unsigned int pauses, i;
+
+	elem->restarts++;
+	cm->restarts++;
+	if (fallback && (cm->lock == NULL) && (restart_budget >= 0) && (cm->restarts > (unsigned int)restart_budget)) {
+		cm->lock = &contention_locks[((unsigned long long)node * 0x9E3779B97F4A7C15ULL) >> (BITS_PER_INDEX - CONTENTION_LOCK_SHIFT)];
+		elem->fallbacks++;
+		if (mcs_lock(cm->lock, &contention_qnode))
+			elem->queued++;
+		return;
+	}
+	if (max_backoff == 0)
+		return;
+	// Xorshift per thread for jitter, so that writers which failed together do not retry together.
+	if (backoff_seed == 0)
+		backoff_seed = (get_tid() * 2654435761U) | 1;
+	backoff_seed ^= backoff_seed << 13;
+	backoff_seed ^= backoff_seed >> 17;
+	backoff_seed ^= backoff_seed << 5;
+	pauses = backoff_seed % cm->backoff;
+	for (i = 0; i < pauses; i++)
+		_mm_pause();
+	elem->backoffs++;
+	elem->backoff_pauses += pauses;
+	if (cm->backoff < max_backoff)
+		cm->backoff = (cm->backoff * 2 < max_backoff) ? cm->backoff * 2 : max_backoff;
+}
+
+static inline void contention_done(struct contention *cm) {
+	if (cm->lock != NULL)
+		mcs_unlock(cm->lock, &contention_qnode);
+}
+#endif
 
 // Radix tree node grabage collector.
-static void return_node_to_gc(struct radix_tree_node *node) {
-	//printf("return node\n");
-	return;
+static inline void return_node_to_gc(struct radix_tree_node *node) {
+	radix_epoch_retire(node);
 }
 
 // Radix tree ops
+/* Keys are KEY_SIZE bytes, one per level, and leaves sit at level KEY_SIZE. Head and tail of the leaf list are
+   marked by level rather than by an offset past the key space, since 64-bit keys leave no such offset. */
+#define SENTINEL_LEVEL 0xFF
+#define is_sentinel(LEAF) ((LEAF)->node.level == SENTINEL_LEVEL)
+/* Bits of INDEX below the prefix of LEVEL. */
+#define index_suffix(INDEX, KEY_SIZE, LEVEL) INDEX_GE(INDEX, BITS_PER_INDEX - (((KEY_SIZE) - (LEVEL)) * RADIX_TREE_ENTRY_BIT_SIZE))
+#define key_at_level(INDEX, KEY_SIZE, LEVEL) (((INDEX) >> (((KEY_SIZE) - 1 - (LEVEL)) * RADIX_TREE_ENTRY_BIT_SIZE)) & RADIX_TREE_MAP_MASK)
 #define is_leaf(NODE) ((NODE)->type == LEAF_NODE)
+/* Child slots hold pointers tagged with the child type in the low bits, which are free as nodes are 8 byte aligned.
+   Leaves are left untagged since LEAF_NODE is 0. Traversal learns the child type from the slot without reading the child. */
+#define NODE_TAG_MASK 0x7ULL
+#define slot_node(SLOT) ((struct radix_tree_node *)((unsigned long long)(SLOT) & ~NODE_TAG_MASK))
+#define slot_type(SLOT) ((unsigned char)((unsigned long long)(SLOT) & NODE_TAG_MASK))
 #define is_fault_node(NODE, KEY, PARENT_LEVEL) \
 		((KEY) != (((NODE)->offset >> ((((NODE)->level - (PARENT_LEVEL) - 1) * RADIX_TREE_ENTRY_BIT_SIZE))) & RADIX_TREE_MAP_MASK))
 #define test_leaf_range_or_restart(PREV, NEXT, IDX) \
-	((((PREV)->node.offset != ROOT_END_OFS) && ((PREV)->node.offset >= (IDX))) || ((NEXT)->node.offset <= (IDX)))
+	((!is_sentinel(PREV) && ((PREV)->node.offset >= (IDX))) || (!is_sentinel(NEXT) && ((NEXT)->node.offset <= (IDX))))
 
-int radix_tree_init() {
+static inline void *tag_node(struct radix_tree_node *node) {
+	return (void *)((unsigned long long)node | node->type);
+}
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void radix_tree_init_once(void) {
+	node_search_init();
 	build_node(10000, LEAF_NODE);
 	build_node(10000, N4);
+	build_node(10000, N8);
 	build_node(10000, N16);
+	build_node(10000, N32);
 	build_node(10000, N48);
 	build_node(10000, N256);
+}
+
+int radix_tree_init() {
+	pthread_once(&init_once, radix_tree_init_once);
 	return 0;
 }
 
+static void replica_retire(struct radix_tree_root *root, void *slot);
+
 void radix_tree_destroy(struct radix_tree_root *root) {
-	return;
+	int numa, numa_cnt = get_numa_cnt();
+
+	radix_epoch_enter();
+	for (numa = 0; numa < numa_cnt; numa++) {
+		replica_retire(root, (root->replica[numa] == NULL) ? NULL : tag_node(root->replica[numa]));
+		root->replica[numa] = NULL;
+	}
+	radix_epoch_exit();
+	root->replica_levels = 0;
+	pthread_mutex_destroy(&root->replica_lock);
+	free(root->dir);
+	root->dir = NULL;
 }
 
 void radix_tree_create(struct radix_tree_root *root) {
+	radix_tree_create_key_bits(root, OFFSET_SIZE * RADIX_TREE_ENTRY_BIT_SIZE);
+}
+
+int radix_tree_create_key_bits(struct radix_tree_root *root, int key_bits) {
+	if ((key_bits < 40) || (key_bits > BITS_PER_INDEX) || (key_bits % RADIX_TREE_ENTRY_BIT_SIZE))
+		return -1;
 	memset(root, 0x0, sizeof(*root));
-	root->head.node.offset = ROOT_END_OFS;
-	root->tail.node.offset = ROOT_END_OFS;
+	pthread_mutex_init(&root->replica_lock, NULL);
+	root->key_size = key_bits / RADIX_TREE_ENTRY_BIT_SIZE;
+	root->head.node.type = LEAF_NODE;
+	root->head.node.level = SENTINEL_LEVEL;
+	root->tail.node.type = LEAF_NODE;
+	root->tail.node.level = SENTINEL_LEVEL;
+	root->tail.node.offset = ULLONG_MAX;
 	root->head.next = &root->tail;
 	root->tail.prev = &root->head;
-	pthread_mutex_init(&root->head.lock, NULL);
-	pthread_mutex_init(&root->tail.lock, NULL);
+	return 0;
+}
+
+int radix_tree_set_numa_policy(struct radix_tree_root *root, enum radix_numa_policy policy, int numa_node, int interleave_levels) {
+	if ((numa_node < 0) || (numa_node >= RADIX_NUMA_MAX) || (interleave_levels < 0) || (interleave_levels > root->key_size))
+		return -1;
+	root->numa_policy = policy;
+	root->numa_node = numa_node;
+	root->numa_interleave_levels = interleave_levels;
+	return 0;
+}
+
+/* NUMA node argument of get_node_on() for a new node of ROOT at LEVEL. */
+static inline int node_numa(struct radix_tree_root *root, unsigned char level) {
+	if (level < root->numa_interleave_levels)
+		return RADIX_NUMA_INTERLEAVE;
+	return (root->numa_policy == RADIX_NUMA_BIND) ? root->numa_node : RADIX_NUMA_LOCAL;
+}
+
+// Directory
+#define dir_index(INDEX, KEY_SIZE) ((INDEX) >> (((KEY_SIZE) * RADIX_TREE_ENTRY_BIT_SIZE) - RADIX_DIR_BITS))
+
+/* Root pointer of the subtree of ROOT holding INDEX, which should be in the key space. Subtrees of a directory keep
+   absolute levels, so that they start below level 1 and are traversed from level 0 as a whole tree is. */
+static inline struct radix_tree_node **root_slot(struct radix_tree_root *root, unsigned long long index) {
+	if (__builtin_expect(root->dir == NULL, 1))
+		return &root->root_node;
+	return &root->dir->slots[dir_index(index, root->key_size)];
+}
+
+/* Mark SLOT of DIR used before a subtree is published there. The bit of the slot goes first, as searches read the
+   bit of its word first. */
+static inline void dir_mark_used(struct radix_tree_dir *dir, int slot) {
+	int word = slot / 64;
+
+	if (!(dir->used[word] & (1ULL << (slot % 64))))
+		atomic_fetch_or(&dir->used[word], 1ULL << (slot % 64));
+	if (!(dir->used_words[word / 64] & (1ULL << (word % 64))))
+		atomic_fetch_or(&dir->used_words[word / 64], 1ULL << (word % 64));
+}
+
+/* Closest slot of DIR before SLOT marked used, -1 if none. */
+static int dir_prev_used(struct radix_tree_dir *dir, int slot) {
+	int word = slot / 64, group = word / 64;
+	unsigned long long bits = dir->used[word] & ((1ULL << (slot % 64)) - 1), words;
+
+	if (bits == 0) {
+		words = dir->used_words[group] & ((1ULL << (word % 64)) - 1);
+		while (words == 0) {
+			if (group == 0)
+				return -1;
+			words = dir->used_words[--group];
+		}
+		word = group * 64 + 63 - __builtin_clzll(words);
+		bits = dir->used[word];
+	}
+	return word * 64 + 63 - __builtin_clzll(bits);
+}
+
+/* Closest slot of DIR after SLOT marked used, -1 if none. */
+static int dir_next_used(struct radix_tree_dir *dir, int slot) {
+	int word = slot / 64, group = word / 64;
+	unsigned long long bits = dir->used[word] & ~((2ULL << (slot % 64)) - 1), words;
+
+	if (bits == 0) {
+		words = dir->used_words[group] & ~((2ULL << (word % 64)) - 1);
+		while (words == 0) {
+			if (++group == RADIX_DIR_SIZE / 64 / 64)
+				return -1;
+			words = dir->used_words[group];
+		}
+		word = group * 64 + __builtin_ctzll(words);
+		bits = dir->used[word];
+	}
+	return word * 64 + __builtin_ctzll(bits);
+}
+
+int radix_tree_set_directory(struct radix_tree_root *root, bool enable) {
+	if ((root->head.next != &root->tail) || (root->replica_levels != 0))
+		return -1;
+	if (enable && (root->dir == NULL)) {
+		root->dir = (struct radix_tree_dir *)aligned_alloc(NODE_ALIGN, sizeof(struct radix_tree_dir));
+		if (root->dir == NULL)
+			return -1;
+		memset(root->dir, 0, sizeof(struct radix_tree_dir));
+	}
+	else if (!enable) {
+		free(root->dir);
+		root->dir = NULL;
+	}
+	return 0;
+}
+
+int radix_tree_set_opaque_values(struct radix_tree_root *root, bool enable) {
+	if (root->head.next != &root->tail)
+		return -1;
+	root->opaque_values = enable;
+	return 0;
+}
+
+/* LOG_ADDR for the part of LEAF from OFFSET on. */
+static inline void *leaf_log_addr_at(struct radix_tree_root *root, struct radix_tree_leaf *leaf, unsigned long long offset) {
+	return root->opaque_values ? leaf->log_addr : leaf->log_addr + (offset - leaf->node.offset);
+}
+
+/* Largest length of extent starting at INDEX. The end of 64-bit keys can reach ULLONG_MAX at most. */
+static inline unsigned long long max_extent_length(unsigned char key_size, unsigned long long index) {
+	unsigned long long max_length = (ULLONG_MAX >> (BITS_PER_INDEX - (key_size * RADIX_TREE_ENTRY_BIT_SIZE))) - index;
+
+	return (key_size < sizeof(unsigned long long)) ? max_length + 1 : max_length;
 }
 
 static inline void radix_tree_do_insert(struct radix_tree_root *root, unsigned long long index, unsigned long long length, void *log_addr, int tx_id, bool lock_leaf_);
 static inline void radix_tree_do_remove(struct radix_tree_root *root, struct radix_tree_leaf *leaf, bool lock_leaf);
 
-/* Get child with KEY from PARENT_ node and store child node to NODEP. Parent LEVEL should be given to check child key again.
+/* Get child with KEY from PARENT_ node of TYPE and store its tagged slot to SLOTP and its key to KEYP. Parent LEVEL should be
+   given to check child key again. Unless VALIDATE, the check is left to the caller so that the child is not read here.
    If there is child with KEY, return that child. If there is no child with KEY, look for closest previous node and return if
    exist. If there is no previous node, look for closest next node and return. */
-static inline enum radix_tree_lookup_results get_child_range(struct radix_tree_node *parent_, struct radix_tree_node **nodep, unsigned char key, unsigned char level) {
-	struct radix_tree_node *i_node, *ret_node;
+static inline enum radix_tree_lookup_results get_child_range(struct radix_tree_node *parent_, unsigned char type, void **slotp,
+		unsigned char *keyp, unsigned char key, unsigned char level, bool validate) {
+	enum radix_tree_lookup_results ret;
+	struct radix_tree_node *ret_node;
+	void *ret_slot;
 	unsigned char index_idx, index_pos, bit_idx;
-	unsigned char ret_key, i_key, idx;
+	unsigned char ret_key, idx;
 	unsigned long long bitfield;
-	int i, i_diff, ret_diff, count;
+	int i, count;
 
-	switch (parent_->type) {
+	switch (type) {
 		{
 		struct N4 *parent;
 		case N4:
 			parent = (struct N4 *)parent_;
 n4_begin:
 			count = parent->node.count;
-			ret_diff = INT_MAX;
-			ret_node = NULL;
-			ret_key = 0;
-			for (i = count - 1; i >= 0; i--) {
-				i_key = parent->key[i];
-				barrier();
-				i_diff = (int)i_key - (int)key;
-				if (i_diff == 0) {
-					if ((i_node = parent->slots[i]) != NULL) {
-						if (is_fault_node(i_node, key, level))
-							goto n4_begin;
-						*nodep = i_node;
-						return RET_MATCH_NODE;
-					}
-				}
-				else if (i_diff < 0) {
-					if ((ret_diff > 0) || (ret_diff < i_diff)) {
-						if ((i_node = parent->slots[i]) != NULL) {
-							ret_diff = i_diff;
-							ret_node = i_node;
-							ret_key = i_key;
-						}
-					}
-				}
-				else {
-					if ((ret_diff > 0) && (ret_diff > i_diff)) {
-						if ((i_node = parent->slots[i]) != NULL) {
-							ret_diff = i_diff;
-							ret_node = i_node;
-							ret_key = i_key;
-						}
-					}
-				}
-			}
-			radix_assert(ret_node != NULL);
-			*nodep = ret_node;
-			if (is_fault_node(ret_node, ret_key, level))
+			barrier();
+			ret = radix_search_ops.closest_key16(parent->key, parent->slots, 4, count, key, &i, &ret_key);
+			radix_assert(ret != ENOEXIST_RADIX);
+			if (((ret_node = slot_node(ret_slot = parent->slots[i])) == NULL) || (validate && is_fault_node(ret_node, ret_key, level)))
 				goto n4_begin;
-			return (ret_key < key) ? RET_PREV_NODE : RET_NEXT_NODE;
+			*slotp = ret_slot;
+			*keyp = ret_key;
+			return ret;
+		}
+		{
+		struct N8 *parent;
+		case N8:
+			parent = (struct N8 *)parent_;
+n8_begin:
+			count = parent->node.count;
+			barrier();
+			ret = radix_search_ops.closest_key16(parent->key, parent->slots, 8, count, key, &i, &ret_key);
+			radix_assert(ret != ENOEXIST_RADIX);
+			if (((ret_node = slot_node(ret_slot = parent->slots[i])) == NULL) || (validate && is_fault_node(ret_node, ret_key, level)))
+				goto n8_begin;
+			*slotp = ret_slot;
+			*keyp = ret_key;
+			return ret;
 		}
 		{
 		struct N16 *parent;
@@ -157,45 +555,28 @@ n4_begin:
 n16_begin:
 			count = parent->node.count;
 			barrier();
-			ret_diff = INT_MAX;
-			ret_node = NULL;
-			ret_key = 0;
-			for (i = count - 1; i >= 0; i--) {
-				i_key = parent->key[i];
-				barrier();
-				i_diff = (int)i_key - (int)key;
-				if (i_diff == 0) {
-					if ((i_node = parent->slots[i]) != NULL) {
-						if (is_fault_node(i_node, key, level))
-							goto n16_begin;
-						*nodep = i_node;
-						return RET_MATCH_NODE;
-					}
-				}
-				else if (i_diff < 0) {
-					if ((ret_diff > 0) || (ret_diff < i_diff)) {
-						if ((i_node = parent->slots[i]) != NULL) {
-							ret_diff = i_diff;
-							ret_node = i_node;
-							ret_key = i_key;
-						}
-					}
-				}
-				else {
-					if ((ret_diff > 0) && (ret_diff > i_diff)) {
-						if ((i_node = parent->slots[i]) != NULL) {
-							ret_diff = i_diff;
-							ret_node = i_node;
-							ret_key = i_key;
-						}
-					}
-				}
-			}
-			radix_assert(ret_node != NULL);
-			*nodep = ret_node;
-			if (is_fault_node(ret_node, ret_key, level))
+			ret = radix_search_ops.closest_key16(parent->key, parent->slots, 16, count, key, &i, &ret_key);
+			radix_assert(ret != ENOEXIST_RADIX);
+			if (((ret_node = slot_node(ret_slot = parent->slots[i])) == NULL) || (validate && is_fault_node(ret_node, ret_key, level)))
 				goto n16_begin;
-			return (ret_key < key) ? RET_PREV_NODE : RET_NEXT_NODE;
+			*slotp = ret_slot;
+			*keyp = ret_key;
+			return ret;
+		}
+		{
+		struct N32 *parent;
+		case N32:
+			parent = (struct N32 *)parent_;
+n32_begin:
+			count = parent->node.count;
+			barrier();
+			ret = radix_search_ops.closest_key32(parent->key, parent->slots, 32, count, key, &i, &ret_key);
+			radix_assert(ret != ENOEXIST_RADIX);
+			if (((ret_node = slot_node(ret_slot = parent->slots[i])) == NULL) || (validate && is_fault_node(ret_node, ret_key, level)))
+				goto n32_begin;
+			*slotp = ret_slot;
+			*keyp = ret_key;
+			return ret;
 		}
 		{
 		struct N48 *parent;
@@ -203,28 +584,25 @@ n16_begin:
 			parent = (struct N48 *)parent_;
 n48_begin:
 			if ((idx = parent->key[key]) != N48_NO_ENT) {
-				if ((ret_node = parent->slots[idx]) != NULL) {
-					if (is_fault_node(ret_node, key, level))
+				if ((ret_node = slot_node(ret_slot = parent->slots[idx])) != NULL) {
+					if ((validate && is_fault_node(ret_node, key, level)))
 						goto n48_begin;
-					*nodep = ret_node;
+					*slotp = ret_slot;
+					*keyp = key;
 					return RET_MATCH_NODE;
 				}
 			}
 			
+			// Fast path on a snapshot of the bitmap. Bits are set after and cleared before their slots, so the closest bit is
+			// almost always live. Words may be read at different times, which the slow path below tolerates.
 			unsigned long long index[RADIX_TREE_INDEX_SIZE];
-			__m256i index_;
-			for (i = 0; i < RADIX_TREE_INDEX_SIZE; i++)
-				index[i] = parent->index[i];
-			while (true) {
-				barrier();
-				index_ = _mm256_loadu_si256((__m256i *)parent->index);
-				if (!_mm256_cmpneq_epi64_mask(_mm256_loadu_si256((__m256i *)index), index_))
-					break;
-				barrier();
-				for (i = 0; i < RADIX_TREE_INDEX_SIZE; i++)
-					index[i] = parent->index[i];
-				if (!_mm256_cmpneq_epi64_mask(_mm256_loadu_si256((__m256i *)index), index_))
-					break;
+			ret = radix_search_ops.closest_bit256(parent->index, index, key, &ret_key);
+			if ((ret != ENOEXIST_RADIX) && ((idx = parent->key[ret_key]) != N48_NO_ENT) && ((ret_node = slot_node(ret_slot = parent->slots[idx])) != NULL)) {
+				if ((validate && is_fault_node(ret_node, ret_key, level)))
+					goto n48_begin;
+				*slotp = ret_slot;
+				*keyp = ret_key;
+				return ret;
 			}
 
 			index_idx = key / BITS_PER_INDEX;
@@ -236,10 +614,11 @@ n48_begin:
 				ret_key = (index_idx * BITS_PER_INDEX) + (BITS_PER_INDEX - 1) - bit_idx;
 				idx = parent->key[ret_key];
 				if (idx != N48_NO_ENT) {
-					if ((ret_node = parent->slots[idx]) != NULL) {
-						if (is_fault_node(ret_node, ret_key, level))
+					if ((ret_node = slot_node(ret_slot = parent->slots[idx])) != NULL) {
+						if ((validate && is_fault_node(ret_node, ret_key, level)))
 							goto n48_begin;
-						*nodep = ret_node;
+						*slotp = ret_slot;
+						*keyp = ret_key;
 						return RET_PREV_NODE;
 					}
 				}
@@ -252,10 +631,11 @@ n48_begin:
 					ret_key = (i * BITS_PER_INDEX) + (BITS_PER_INDEX - 1) - bit_idx;
 					idx = parent->key[ret_key];
 					if (idx != N48_NO_ENT) {
-						if ((ret_node = parent->slots[idx]) != NULL) {
-							if (is_fault_node(ret_node, ret_key, level))
+						if ((ret_node = slot_node(ret_slot = parent->slots[idx])) != NULL) {
+							if ((validate && is_fault_node(ret_node, ret_key, level)))
 								goto n48_begin;
-							*nodep = ret_node;
+							*slotp = ret_slot;
+							*keyp = ret_key;
 							return RET_PREV_NODE;
 						}
 					}
@@ -269,10 +649,11 @@ n48_begin:
 				ret_key = (index_idx * BITS_PER_INDEX) + bit_idx;
 				idx = parent->key[ret_key];
 				if (idx != N48_NO_ENT) {
-					if ((ret_node = parent->slots[idx]) != NULL) {
-						if (is_fault_node(ret_node, ret_key, level))
+					if ((ret_node = slot_node(ret_slot = parent->slots[idx])) != NULL) {
+						if ((validate && is_fault_node(ret_node, ret_key, level)))
 							goto n48_begin;
-						*nodep = ret_node;
+						*slotp = ret_slot;
+						*keyp = ret_key;
 						return RET_NEXT_NODE;
 					}
 				}
@@ -285,10 +666,11 @@ n48_begin:
 					ret_key = (i * BITS_PER_INDEX) + bit_idx;
 					idx = parent->key[ret_key];
 					if (idx != N48_NO_ENT) {
-						if ((ret_node = parent->slots[idx]) != NULL) {
-							if (is_fault_node(ret_node, ret_key, level))
+						if ((ret_node = slot_node(ret_slot = parent->slots[idx])) != NULL) {
+							if ((validate && is_fault_node(ret_node, ret_key, level)))
 								goto n48_begin;
-							*nodep = ret_node;
+							*slotp = ret_slot;
+							*keyp = ret_key;
 							return RET_NEXT_NODE;
 						}
 					}
@@ -302,27 +684,20 @@ n48_begin:
 		default:
 			parent = (struct N256 *)parent_;
 
-			radix_assert(parent_->type == N256);
+			radix_assert(type == N256);
 
-			if ((ret_node = parent->slots[key]) != NULL) {
-				*nodep = ret_node;
+			if ((ret_slot = parent->slots[key]) != NULL) {
+				*slotp = ret_slot;
+				*keyp = key;
 				return RET_MATCH_NODE;
 			}
 
 			unsigned long long index[RADIX_TREE_INDEX_SIZE];
-			__m256i index_;
-			for (i = 0; i < RADIX_TREE_INDEX_SIZE; i++)
-				index[i] = parent->index[i];
-			while (true) {
-				barrier();
-				index_ = _mm256_loadu_si256((__m256i *)parent->index);
-				if (!_mm256_cmpneq_epi64_mask(_mm256_loadu_si256((__m256i *)index), index_))
-					break;
-				barrier();
-				for (i = 0; i < RADIX_TREE_INDEX_SIZE; i++)
-					index[i] = parent->index[i];
-				if (!_mm256_cmpneq_epi64_mask(_mm256_loadu_si256((__m256i *)index), index_))
-					break;
+			ret = radix_search_ops.closest_bit256(parent->index, index, key, &ret_key);
+			if ((ret != ENOEXIST_RADIX) && ((ret_slot = parent->slots[ret_key]) != NULL)) {
+				*slotp = ret_slot;
+				*keyp = ret_key;
+				return ret;
 			}
 
 			index_idx = key / BITS_PER_INDEX;
@@ -331,8 +706,10 @@ n48_begin:
 			bitfield = INDEX_LE(index[index_idx], index_pos);
 			while (bitfield) {
 				idx = __builtin_ctzll(bitfield);
-				if ((ret_node = parent->slots[(index_idx * BITS_PER_INDEX) + (BITS_PER_INDEX - 1) - idx]) != NULL) {
-					*nodep = ret_node;
+				ret_key = (index_idx * BITS_PER_INDEX) + (BITS_PER_INDEX - 1) - idx;
+				if ((ret_slot = parent->slots[ret_key]) != NULL) {
+					*slotp = ret_slot;
+					*keyp = ret_key;
 					return RET_PREV_NODE;
 				}
 				bitfield ^= (1ULL << idx);
@@ -341,8 +718,10 @@ n48_begin:
 				bitfield = index[i];
 				while (bitfield) {
 					idx = __builtin_ctzll(bitfield);
-					if ((ret_node = parent->slots[(i * BITS_PER_INDEX) + (BITS_PER_INDEX - 1) - idx]) != NULL) {
-						*nodep = ret_node;
+					ret_key = (i * BITS_PER_INDEX) + (BITS_PER_INDEX - 1) - idx;
+					if ((ret_slot = parent->slots[ret_key]) != NULL) {
+						*slotp = ret_slot;
+						*keyp = ret_key;
 						return RET_PREV_NODE;
 					}
 					bitfield ^= (1ULL << idx);
@@ -352,8 +731,10 @@ n48_begin:
 			bitfield = INDEX_GE(index[index_idx], index_pos);
 			while (bitfield) {
 				idx = __builtin_clzll(bitfield);
-				if ((ret_node = parent->slots[(index_idx * BITS_PER_INDEX) + idx]) != NULL) {
-					*nodep = ret_node;
+				ret_key = (index_idx * BITS_PER_INDEX) + idx;
+				if ((ret_slot = parent->slots[ret_key]) != NULL) {
+					*slotp = ret_slot;
+					*keyp = ret_key;
 					return RET_NEXT_NODE;
 				}
 				bitfield ^= (1ULL << ((BITS_PER_INDEX - 1) - idx));
@@ -362,8 +743,10 @@ n48_begin:
 				bitfield = index[i];
 				while (bitfield) {
 					idx = __builtin_clzll(bitfield);
-					if ((ret_node = parent->slots[(i * BITS_PER_INDEX) + idx]) != NULL) {
-						*nodep = ret_node;
+					ret_key = (i * BITS_PER_INDEX) + idx;
+					if ((ret_slot = parent->slots[ret_key]) != NULL) {
+						*slotp = ret_slot;
+						*keyp = ret_key;
 						return RET_NEXT_NODE;
 					}
 					bitfield ^= (1ULL << ((BITS_PER_INDEX - 1) - idx));
@@ -374,9 +757,9 @@ n48_begin:
 	radix_unreachable();
 }
 
-/* Get ramaining child in PARENT_ node whose key is not equal to KEY.
+/* Get tagged slot of ramaining child in PARENT_ node whose key is not equal to KEY.
    This function should be called after acquiring PARENT_ lock. */
-static inline struct radix_tree_node *get_child_remain(struct radix_tree_node *parent_, unsigned char key) {
+static inline void *get_child_remain(struct radix_tree_node *parent_, unsigned char key) {
 	int idx, index_idx, index_pos;
 	switch (parent_->type) {
 		{
@@ -386,12 +769,24 @@ static inline struct radix_tree_node *get_child_remain(struct radix_tree_node *p
 			return ((parent->key[0] != key) ? parent->slots[0] : parent->slots[1]);
 		}
 		{
+		struct N8 *parent;
+		case N8:
+			parent = (struct N8 *)parent_;
+			return ((parent->key[0] != key) ? parent->slots[0] : parent->slots[1]);
+		}
+		{
 		struct N16 *parent;
 		case N16:
 			parent = (struct N16 *)parent_;
 			return ((parent->key[0] != key) ? parent->slots[0] : parent->slots[1]);
 		}
 		{
+		struct N32 *parent;
+		case N32:
+			parent = (struct N32 *)parent_;
+			return ((parent->key[0] != key) ? parent->slots[0] : parent->slots[1]);
+		}
+		{
 		struct N48 *parent;
 		case N48:
 			parent = (struct N48 *)parent_;
@@ -447,7 +842,7 @@ n4_begin:
 			barrier();
 			for (idx = count - 1; idx >= 0; idx--) {
 				if (parent->key[idx] == key) {
-					if ((child = parent->slots[idx]) != NULL) {
+					if ((child = slot_node(parent->slots[idx])) != NULL) {
 						if (is_fault_node(child, key, level))
 							goto n4_begin;
 						return child;
@@ -457,16 +852,35 @@ n4_begin:
 			return NULL;
 		}
 		{
+		struct N8 *parent;
+		case N8:
+			parent = (struct N8 *)parent_;
+n8_begin:
+			count = parent->node.count;
+			barrier();
+			unsigned int bitfield = radix_search_ops.match_key16(parent->key, key) & ((1U << count) - 1);
+			while (bitfield) {
+				unsigned char pos = 31 - __builtin_clz(bitfield);
+				if ((child = slot_node(parent->slots[pos])) != NULL) {
+					if (is_fault_node(child, key, level))
+						goto n8_begin;
+					return child;
+				}
+				bitfield ^= (1 << pos);
+			}
+			return NULL;
+		}
+		{
 		struct N16 *parent;
 		case N16:
 			parent = (struct N16 *)parent_;
 n16_begin:
 			count = parent->node.count;
 			barrier();
-			unsigned short bitfield = _mm_cmpeq_epi8_mask(_mm_set1_epi8(key), _mm_loadu_si128((__m128i *)parent->key)) & ((1 << count) - 1);
+			unsigned int bitfield = radix_search_ops.match_key16(parent->key, key) & ((1U << count) - 1);
 			while (bitfield) {
 				unsigned char pos = 31 - __builtin_clz(bitfield);
-				if ((child = parent->slots[pos]) != NULL) {
+				if ((child = slot_node(parent->slots[pos])) != NULL) {
 					if (is_fault_node(child, key, level))
 						goto n16_begin;
 					return child;
@@ -476,13 +890,32 @@ n16_begin:
 			return NULL;
 		}
 		{
+		struct N32 *parent;
+		case N32:
+			parent = (struct N32 *)parent_;
+n32_begin:
+			count = parent->node.count;
+			barrier();
+			unsigned int bitfield = radix_search_ops.match_key32(parent->key, key) & (unsigned int)((1ULL << count) - 1);
+			while (bitfield) {
+				unsigned char pos = 31 - __builtin_clz(bitfield);
+				if ((child = slot_node(parent->slots[pos])) != NULL) {
+					if (is_fault_node(child, key, level))
+						goto n32_begin;
+					return child;
+				}
+				bitfield ^= (1U << pos);
+			}
+			return NULL;
+		}
+		{
 		struct N48 *parent;
 		case N48:
 			parent = (struct N48 *)parent_;
 n48_begin:
 			if ((idx = parent->key[key]) == N48_NO_ENT)
 				return NULL;
-			child = parent->slots[idx];
+			child = slot_node(parent->slots[idx]);
 			if (child == NULL)
 				return NULL;
 			if (is_fault_node(child, key, level))
@@ -493,16 +926,16 @@ n48_begin:
 		struct N256 *parent;
 		case N256:
 			parent = (struct N256 *)parent_;
-			return parent->slots[key];
+			return slot_node(parent->slots[key]);
 		}
 		default:
 			radix_unreachable();
 	}
 }
 
-/* Insert CHILD node to PARENT_ node with KEY. Return true for success, false for failure(need to expand node).
+/* Insert CHILD slot, tagged by tag_node(), to PARENT_ node with KEY. Return true for success, false for failure(need to expand node).
    WRITE OPERATION, PARENT_ lock should be acquired by caller. */
-static inline bool insert_child(struct radix_tree_node *parent_, unsigned char key, struct radix_tree_node *child) {
+static inline bool insert_child(struct radix_tree_node *parent_, unsigned char key, void *child) {
 	int idx;
 	unsigned char index_idx;
 	unsigned long long bitfield, bitmask;
@@ -521,6 +954,19 @@ static inline bool insert_child(struct radix_tree_node *parent_, unsigned char k
 			return true;
 		}
 		{
+		struct N8 *parent;
+		case N8:
+			parent = (struct N8 *)parent_;
+			if ((idx = parent->node.count) == 8)
+				return false;
+			parent->key[idx] = key;
+			barrier();
+			parent->slots[idx] = child;
+			barrier();
+			parent_->count = idx + 1;
+			return true;
+		}
+		{
 		struct N16 *parent;
 		case N16:
 			parent = (struct N16 *)parent_;
@@ -534,6 +980,19 @@ static inline bool insert_child(struct radix_tree_node *parent_, unsigned char k
 			return true;
 		}
 		{
+		struct N32 *parent;
+		case N32:
+			parent = (struct N32 *)parent_;
+			if ((idx = parent->node.count) == 32)
+				return false;
+			parent->key[idx] = key;
+			barrier();
+			parent->slots[idx] = child;
+			barrier();
+			parent_->count = idx + 1;
+			return true;
+		}
+		{
 		struct N48 *parent;
 		case N48:
 			parent = (struct N48 *)parent_;
@@ -576,9 +1035,9 @@ static inline bool insert_child(struct radix_tree_node *parent_, unsigned char k
 	}
 }
 
-/* Insert CHILD node to PARENT_ node with KEY. This function must succeed. 
+/* Insert CHILD slot, tagged by tag_node(), to PARENT_ node with KEY. This function must succeed. 
    No internal synchronization, PARENT_ should not be inserted to tree yet. */
-static inline void insert_child_force(struct radix_tree_node *parent_, unsigned char key, struct radix_tree_node *child) {
+static inline void insert_child_force(struct radix_tree_node *parent_, unsigned char key, void *child) {
 	switch (parent_->type) {
 		{
 		struct N4 *parent;
@@ -591,6 +1050,16 @@ static inline void insert_child_force(struct radix_tree_node *parent_, unsigned
 			break;
 		}
 		{
+		struct N8 *parent;
+		case N8:
+			parent = (struct N8 *)parent_;
+			int idx = parent_->count++;
+			radix_assert(idx < 8);
+			parent->key[idx] = key;
+			parent->slots[idx] = child;
+			break;
+		}
+		{
 		struct N16 *parent;
 		case N16:
 			parent = (struct N16 *)parent_;
@@ -601,6 +1070,16 @@ static inline void insert_child_force(struct radix_tree_node *parent_, unsigned
 			break;
 		}
 		{
+		struct N32 *parent;
+		case N32:
+			parent = (struct N32 *)parent_;
+			int idx = parent_->count++;
+			radix_assert(idx < 32);
+			parent->key[idx] = key;
+			parent->slots[idx] = child;
+			break;
+		}
+		{
 		struct N48 *parent;
 		case N48:
 			parent = (struct N48 *)parent_;
@@ -657,6 +1136,30 @@ static inline void delete_child(struct radix_tree_node *parent_, unsigned char k
 			return;
 		}
 		{
+		struct N8 *parent;
+		case N8:
+			parent = (struct N8 *)parent_;
+			last_idx = parent_->count - 1;
+			if (parent->key[last_idx] == key) {
+				parent_->count--;
+				barrier();
+				parent->slots[last_idx] = NULL;
+				return;
+			}
+			idx = __builtin_ctz(radix_search_ops.match_key16(parent->key, key));
+			radix_assert(idx < last_idx);
+			parent->slots[idx] = NULL;
+			barrier();
+			parent->key[idx] = parent->key[last_idx];
+			barrier();
+			parent->slots[idx] = parent->slots[last_idx];
+			barrier();
+			parent_->count = last_idx;
+			parent->slots[last_idx] = NULL;
+			barrier();
+			return;
+		}
+		{
 		struct N16 *parent;
 		case N16:
 			parent = (struct N16 *)parent_;
@@ -667,8 +1170,31 @@ static inline void delete_child(struct radix_tree_node *parent_, unsigned char k
 				parent->slots[last_idx] = NULL;
 				return;
 			}
-			short cmp = _mm_cmpeq_epi8_mask(_mm_set1_epi8(key), _mm_loadu_si128((__m128i *)parent->key));
-			idx = __builtin_ctz(cmp);
+			idx = __builtin_ctz(radix_search_ops.match_key16(parent->key, key));
+			radix_assert(idx < last_idx);
+			parent->slots[idx] = NULL;
+			barrier();
+			parent->key[idx] = parent->key[last_idx];
+			barrier();
+			parent->slots[idx] = parent->slots[last_idx];
+			barrier();
+			parent_->count = last_idx;
+			parent->slots[last_idx] = NULL;
+			barrier();
+			return;
+		}
+		{
+		struct N32 *parent;
+		case N32:
+			parent = (struct N32 *)parent_;
+			last_idx = parent_->count - 1;
+			if (parent->key[last_idx] == key) {
+				parent_->count--;
+				barrier();
+				parent->slots[last_idx] = NULL;
+				return;
+			}
+			idx = __builtin_ctz(radix_search_ops.match_key32(parent->key, key));
 			radix_assert(idx < last_idx);
 			parent->slots[idx] = NULL;
 			barrier();
@@ -699,16 +1225,8 @@ static inline void delete_child(struct radix_tree_node *parent_, unsigned char k
 				return;
 			}
 			
-			unsigned char i, last_key = N48_NO_ENT;
-			unsigned long long bitfield;
-			for (i = 0; i < RADIX_TREE_INDEX_SIZE; i++) {
-				bitfield = _mm512_cmpeq_epi8_mask(_mm512_set1_epi8(last_idx), _mm512_loadu_si512((__m512i *)&parent->key[64 * i]));
-				if (bitfield) {
-					last_key = (64 * i) + __builtin_ctzll(bitfield);
-					break;
-				}
-			}
-			radix_assert(last_idx != N48_NO_ENT);
+			int last_key = radix_search_ops.find_byte256(parent->key, last_idx);
+			radix_assert(last_key >= 0);
 			radix_assert(parent->key[last_key] == last_idx);
 
 			parent->slots[idx] = NULL;
@@ -737,7 +1255,8 @@ static inline void delete_child(struct radix_tree_node *parent_, unsigned char k
 	}
 }
 
-static inline void update_child(struct radix_tree_node *parent_, unsigned char key, struct radix_tree_node *new_child) {
+/* Replace child with KEY in PARENT_ node by NEW_CHILD slot, tagged by tag_node(). */
+static inline void update_child(struct radix_tree_node *parent_, unsigned char key, void *new_child) {
 	switch (parent_->type) {
 		{
 		struct N4 *parent;
@@ -754,12 +1273,21 @@ static inline void update_child(struct radix_tree_node *parent_, unsigned char k
 			radix_unreachable();
 		}
 		{
+		struct N8 *parent;
+		case N8:
+			parent = (struct N8 *)parent_;
+			unsigned int bitfield = radix_search_ops.match_key16(parent->key, key);
+			radix_assert(bitfield);
+			radix_assert(parent->slots[__builtin_ctz(bitfield)] != NULL);
+			radix_assert(__builtin_ctz(bitfield) < parent->node.count);
+			parent->slots[__builtin_ctz(bitfield)] = new_child;
+			return;
+		}
+		{
 		struct N16 *parent;
 		case N16:
 			parent = (struct N16 *)parent_;
-			__m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(key), _mm_loadu_si128((__m128i *)parent->key));
-			unsigned bitfield = _mm_movemask_epi8(cmp);
-			radix_assert((bitfield >> 16) == 0);
+			unsigned int bitfield = radix_search_ops.match_key16(parent->key, key);
 			radix_assert(bitfield);
 			radix_assert(parent->slots[__builtin_ctz(bitfield)] != NULL);
 			radix_assert(__builtin_ctz(bitfield) < parent->node.count);
@@ -767,7 +1295,18 @@ static inline void update_child(struct radix_tree_node *parent_, unsigned char k
 			return;
 		}
 		{
-		struct N48 *parent;
+		struct N32 *parent;
+		case N32:
+			parent = (struct N32 *)parent_;
+			unsigned int bitfield = radix_search_ops.match_key32(parent->key, key);
+			radix_assert(bitfield);
+			radix_assert(parent->slots[__builtin_ctz(bitfield)] != NULL);
+			radix_assert(__builtin_ctz(bitfield) < parent->node.count);
+			parent->slots[__builtin_ctz(bitfield)] = new_child;
+			return;
+		}
+		{
+		struct N48 *parent;
 		case N48:
 			parent = (struct N48 *)parent_;
 			radix_assert(parent->key[key] != N48_NO_ENT);
@@ -800,8 +1339,12 @@ static inline bool radix_node_need_expand(struct radix_tree_node *node) {
 	switch (node->type) {
 		case N4:
 			return (node->count == 4);
+		case N8:
+			return (node->count == 8);
 		case N16:
 			return (node->count == 16);
+		case N32:
+			return (node->count == 32);
 		case N48:
 			return (node->count == 48);
 		default:
@@ -809,18 +1352,18 @@ static inline bool radix_node_need_expand(struct radix_tree_node *node) {
 	}
 }
 
-/* Expand NODE_ to larger node type. Allocate new node, copy all the child and return the new node.
+/* Expand NODE_ to larger node type. Allocate new node on NUMA, copy all the child and return the new node.
    WRITE OPERATION, NODE_ lock should be acquired by caller. */
-static inline struct radix_tree_node *radix_node_expand(struct radix_tree_node *node_) {
+static inline struct radix_tree_node *radix_node_expand(struct radix_tree_node *node_, int numa) {
 	int i;
 	unsigned char key;
 	switch (node_->type) {
 		{
 		struct N4 *node;
-		struct N16 *new_node;
+		struct N8 *new_node;
 		case N4:
 			node = (struct N4 *)node_;
-			new_node = (struct N16 *)get_node(N16);
+			new_node = (struct N8 *)get_node_on(N8, numa);
 			radix_assert(node->node.count == 4);
 			init_node(&new_node->node, node_->level, 4, node_->offset);
 			for (i = 0; i < 4; i++) {
@@ -831,17 +1374,47 @@ static inline struct radix_tree_node *radix_node_expand(struct radix_tree_node *
 			return (struct radix_tree_node *)new_node;
 		}
 		{
+		struct N8 *node;
+		struct N16 *new_node;
+		case N8:
+			node = (struct N8 *)node_;
+			new_node = (struct N16 *)get_node_on(N16, numa);
+			radix_assert(node->node.count == 8);
+			init_node(&new_node->node, node_->level, 8, node_->offset);
+			for (i = 0; i < 8; i++) {
+				radix_assert(node->slots[i] != NULL);
+				new_node->key[i] = node->key[i];
+				new_node->slots[i] = node->slots[i];
+			}
+			return (struct radix_tree_node *)new_node;
+		}
+		{
 		struct N16 *node;
-		struct N48 *new_node;
+		struct N32 *new_node;
 		case N16:
 			node = (struct N16 *)node_;
-			new_node = (struct N48 *)get_node(N48);
+			new_node = (struct N32 *)get_node_on(N32, numa);
 			radix_assert(node->node.count == 16);
 			init_node(&new_node->node, node_->level, 16, node_->offset);
+			for (i = 0; i < 16; i++) {
+				radix_assert(node->slots[i] != NULL);
+				new_node->key[i] = node->key[i];
+				new_node->slots[i] = node->slots[i];
+			}
+			return (struct radix_tree_node *)new_node;
+		}
+		{
+		struct N32 *node;
+		struct N48 *new_node;
+		case N32:
+			node = (struct N32 *)node_;
+			new_node = (struct N48 *)get_node_on(N48, numa);
+			radix_assert(node->node.count == 32);
+			init_node(&new_node->node, node_->level, 32, node_->offset);
 			memset(new_node->key, N48_NO_ENT, sizeof(new_node->key));
 			memset(new_node->index, 0, sizeof(new_node->index));
 			memset(new_node->slots, 0, sizeof(new_node->slots));
-			for (i = 0; i < 16; i++) {
+			for (i = 0; i < 32; i++) {
 				radix_assert(node->slots[i] != NULL);
 				key = node->key[i];
 				new_node->key[key] = i;
@@ -855,7 +1428,7 @@ static inline struct radix_tree_node *radix_node_expand(struct radix_tree_node *
 		struct N256 *new_node;
 		case N48:
 			node = (struct N48 *)node_;
-			new_node = (struct N256 *)get_node(N256);
+			new_node = (struct N256 *)get_node_on(N256, numa);
 			radix_assert(node->node.count == 48);
 			init_node(&new_node->node, node_->level, 48, node_->offset);
 			memset(new_node->slots, 0, sizeof(new_node->slots));
@@ -882,12 +1455,140 @@ static inline struct radix_tree_node *radix_node_expand(struct radix_tree_node *
 	}
 }
 
+/* Shrink thresholds. A node shrinks once its count drops to the threshold, which leaves room for several
+   inserts before the smaller node has to expand again. */
+#define N8_SHRINK_CNT 3
+#define N16_SHRINK_CNT 6
+#define N32_SHRINK_CNT 12
+#define N48_SHRINK_CNT 24
+#define N256_SHRINK_CNT 36
+
+/* Return true if NODE should shrink after removing one child. NODE lock should be acquired by caller. */
+static inline bool radix_node_need_shrink(struct radix_tree_node *node) {
+	switch (node->type) {
+		case N8:
+			return (node->count - 1 <= N8_SHRINK_CNT);
+		case N16:
+			return (node->count - 1 <= N16_SHRINK_CNT);
+		case N32:
+			return (node->count - 1 <= N32_SHRINK_CNT);
+		case N48:
+			return (node->count - 1 <= N48_SHRINK_CNT);
+		case N256:
+			// Count of full N256 wraps around to 0.
+			return (node->count != 0) && (node->count - 1 <= N256_SHRINK_CNT);
+		default:
+			return false;
+	}
+}
+
+/* Shrink NODE_ to smaller node type. Allocate new node on NUMA, copy all the child except the one with KEY and return the new node.
+   WRITE OPERATION, NODE_ lock should be acquired by caller. */
+static inline struct radix_tree_node *radix_node_shrink(struct radix_tree_node *node_, unsigned char key, int numa) {
+	int i;
+	switch (node_->type) {
+		{
+		struct N8 *node;
+		struct radix_tree_node *new_node;
+		case N8:
+			node = (struct N8 *)node_;
+			new_node = get_node_on(N4, numa);
+			radix_assert(node->node.count - 1 <= 4);
+			init_node(new_node, node_->level, 0, node_->offset);
+			for (i = 0; i < node->node.count; i++) {
+				radix_assert(node->slots[i] != NULL);
+				if (node->key[i] != key)
+					insert_child_force(new_node, node->key[i], node->slots[i]);
+			}
+			return new_node;
+		}
+		{
+		struct N16 *node;
+		struct radix_tree_node *new_node;
+		case N16:
+			node = (struct N16 *)node_;
+			new_node = get_node_on(N8, numa);
+			radix_assert(node->node.count - 1 <= 8);
+			init_node(new_node, node_->level, 0, node_->offset);
+			for (i = 0; i < node->node.count; i++) {
+				radix_assert(node->slots[i] != NULL);
+				if (node->key[i] != key)
+					insert_child_force(new_node, node->key[i], node->slots[i]);
+			}
+			return new_node;
+		}
+		{
+		struct N32 *node;
+		struct radix_tree_node *new_node;
+		case N32:
+			node = (struct N32 *)node_;
+			new_node = get_node_on(N16, numa);
+			radix_assert(node->node.count - 1 <= 16);
+			init_node(new_node, node_->level, 0, node_->offset);
+			for (i = 0; i < node->node.count; i++) {
+				radix_assert(node->slots[i] != NULL);
+				if (node->key[i] != key)
+					insert_child_force(new_node, node->key[i], node->slots[i]);
+			}
+			return new_node;
+		}
+		{
+		struct N48 *node;
+		struct N32 *new_node;
+		case N48:
+			node = (struct N48 *)node_;
+			new_node = (struct N32 *)get_node_on(N32, numa);
+			radix_assert(node->node.count - 1 <= 32);
+			init_node(&new_node->node, node_->level, 0, node_->offset);
+			for (i = 0; i < RADIX_TREE_INDEX_SIZE; i++) {
+				unsigned long long bitfield = node->index[i];
+				int bit_idx, i_key;
+				while (bitfield) {
+					bit_idx = __builtin_ctzll(bitfield);
+					i_key = (BITS_PER_INDEX * i) + (BITS_PER_INDEX - 1) - bit_idx;
+					radix_assert(node->key[i_key] != N48_NO_ENT);
+					if ((i_key != key) && (node->slots[node->key[i_key]] != NULL))
+						insert_child_force(&new_node->node, i_key, node->slots[node->key[i_key]]);
+					bitfield ^= (1ULL << bit_idx);
+				}
+			}
+			return (struct radix_tree_node *)new_node;
+		}
+		{
+		struct N256 *node;
+		struct N48 *new_node;
+		case N256:
+			node = (struct N256 *)node_;
+			new_node = (struct N48 *)get_node_on(N48, numa);
+			init_node(&new_node->node, node_->level, 0, node_->offset);
+			memset(new_node->key, N48_NO_ENT, sizeof(new_node->key));
+			memset(new_node->index, 0, sizeof(new_node->index));
+			for (i = 0; i < RADIX_TREE_INDEX_SIZE; i++) {
+				unsigned long long bitfield = node->index[i];
+				int bit_idx, i_key;
+				while (bitfield) {
+					bit_idx = __builtin_ctzll(bitfield);
+					i_key = (BITS_PER_INDEX * i) + (BITS_PER_INDEX - 1) - bit_idx;
+					radix_assert(node->slots[i_key] != NULL);
+					if (i_key != key)
+						insert_child_force(&new_node->node, i_key, node->slots[i_key]);
+					bitfield ^= (1ULL << bit_idx);
+				}
+			}
+			radix_assert(new_node->node.count <= 48);
+			return (struct radix_tree_node *)new_node;
+		}
+		default:
+			radix_unreachable();
+	}
+}
+
 /* Check prefix between CUR_INDEX and TARGET_PREFIX_ with CUR_LEVEL and TARGET_LEVEL.
    If prefix match, return PREFIX_MATCH. Otherwise, return PREFIX_PREV or PREFIX_NEXT accordingly. */
 enum check_prefix_result {PREFIX_PREV, PREFIX_MATCH, PREFIX_NEXT};
 static inline enum check_prefix_result check_prefix(unsigned long long cur_index, unsigned long long target_prefix_,
-		unsigned char cur_level, unsigned char target_level) {
-	unsigned long long cur_prefix = cur_index >> ((RADIX_TREE_HEIGHT + 1 - target_level) * RADIX_TREE_ENTRY_BIT_SIZE);
+		unsigned char cur_level, unsigned char target_level, unsigned char key_size) {
+	unsigned long long cur_prefix = index_prefix(cur_index, key_size, target_level);
 	unsigned long long target_prefix = INDEX_GE(target_prefix_, 64 - (target_level - cur_level) * 8);
 
 	if (cur_prefix == target_prefix)
@@ -898,63 +1599,439 @@ static inline enum check_prefix_result check_prefix(unsigned long long cur_index
 		return PREFIX_NEXT;
 }
 
-/* Do lookup with given ROOT and INDEX. */
-static inline struct radix_tree_node *radix_tree_do_lookup(struct radix_tree_node *root, unsigned long long index) {
-	struct radix_tree_node *node = root;
-	unsigned long long cur_index = index;
-	unsigned char level = 0;
-
-	while (node != NULL) {
-		if (is_leaf(node))
-			return node;
-		if (level != node->level) {
-			radix_assert (level < node->level);
-			switch (check_prefix(cur_index, node->offset, level, node->level)) {
-				case PREFIX_PREV:
-					cur_index = INDEX_GE(ULLONG_MAX, 24 + (8 * node->level));
-					break;
-				case PREFIX_MATCH:
-					cur_index = INDEX_GE(cur_index, 24 + (8 * node->level));
-					break;
-				case PREFIX_NEXT:
-					cur_index = 0;
-					break;
+// Replicas
+/* Lookups of a tree with replica levels start from a copy of its inner nodes above that level on their own NUMA node,
+   so that lines every lookup reads are not shared across sockets. Writers to replicated nodes count themselves in
+   replica_begin before the write and in replica_end once it is copied, and lookups traverse copies only while no write
+   is in between, like a sequence lock. Copies are never locked and change only under replica_lock during such a write.
+   A write recopies the written node together with the replicated nodes below it. */
+static inline bool is_replicated(struct radix_tree_root *root, struct radix_tree_node *node) {
+	return !is_leaf(node) && (node->level < root->replica_levels);
+}
+
+static inline unsigned long long node_type_size(unsigned char type) {
+	switch (type) {
+		case N4:
+			return sizeof(struct N4);
+		case N8:
+			return sizeof(struct N8);
+		case N16:
+			return sizeof(struct N16);
+		case N32:
+			return sizeof(struct N32);
+		case N48:
+			return sizeof(struct N48);
+		case N256:
+			return sizeof(struct N256);
+		default:
+			radix_unreachable();
+	}
+}
+
+/* Store addresses of the child slots of NODE_ in use to SLOTS and return their number. */
+static int child_slots(struct radix_tree_node *node_, void **slots[RADIX_TREE_MAP_SIZE]) {
+	void **node_slots;
+	int i, cnt = 0;
+
+	switch (node_->type) {
+		case N4:
+			node_slots = ((struct N4 *)node_)->slots;
+			break;
+		case N8:
+			node_slots = ((struct N8 *)node_)->slots;
+			break;
+		case N16:
+			node_slots = ((struct N16 *)node_)->slots;
+			break;
+		case N32:
+			node_slots = ((struct N32 *)node_)->slots;
+			break;
+		{
+		struct N48 *node;
+		case N48:
+			node = (struct N48 *)node_;
+			for (i = 0; i < 256; i++) {
+				if ((node->key[i] != N48_NO_ENT) && (node->slots[node->key[i]] != NULL))
+					slots[cnt++] = &node->slots[node->key[i]];
+			}
+			return cnt;
+		}
+		{
+		struct N256 *node;
+		case N256:
+			node = (struct N256 *)node_;
+			for (i = 0; i < 256; i++) {
+				if (node->slots[i] != NULL)
+					slots[cnt++] = &node->slots[i];
 			}
-			level = node->level;
+			return cnt;
+		}
+		default:
+			radix_unreachable();
+	}
+	for (i = 0; i < node_->count; i++) {
+		if (node_slots[i] != NULL)
+			slots[cnt++] = &node_slots[i];
+	}
+	return cnt;
+}
+
+/* Address of the slot of copy NODE_ for KEY, NULL if none. */
+static void **copy_child_slot(struct radix_tree_node *node_, unsigned char key) {
+	unsigned char *keys;
+	void **slots;
+	int i;
+
+	switch (node_->type) {
+		case N4:
+			keys = ((struct N4 *)node_)->key;
+			slots = ((struct N4 *)node_)->slots;
+			break;
+		case N8:
+			keys = ((struct N8 *)node_)->key;
+			slots = ((struct N8 *)node_)->slots;
+			break;
+		case N16:
+			keys = ((struct N16 *)node_)->key;
+			slots = ((struct N16 *)node_)->slots;
+			break;
+		case N32:
+			keys = ((struct N32 *)node_)->key;
+			slots = ((struct N32 *)node_)->slots;
+			break;
+		case N48:
+			if (((struct N48 *)node_)->key[key] == N48_NO_ENT)
+				return NULL;
+			slots = &((struct N48 *)node_)->slots[((struct N48 *)node_)->key[key]];
+			return (*slots != NULL) ? slots : NULL;
+		case N256:
+			slots = &((struct N256 *)node_)->slots[key];
+			return (*slots != NULL) ? slots : NULL;
+		default:
+			radix_unreachable();
+	}
+	for (i = 0; i < node_->count; i++) {
+		if ((keys[i] == key) && (slots[i] != NULL))
+			return &slots[i];
+	}
+	return NULL;
+}
+
+/* Copy NODE to COPY of the same type under the version of NODE. */
+static void replica_copy_node(struct radix_tree_node *copy, struct radix_tree_node *node) {
+	unsigned char numa = copy->numa;
+	unsigned int version;
+
+	do {
+		version = get_version(node);
+		while (is_locked(version)) {
+			_mm_pause();
+			version = get_version(node);
+		}
+		memcpy(copy, node, node_type_size(node->type));
+		barrier();
+	} while (read_unlock_or_restart(node, version));
+	// An obsolete NODE is recopied by the writer that replaced it, meanwhile lookups should not restart on the copy.
+	copy->numa = numa;
+	copy->lock_n_obsolete = version & ~1U;
+}
+
+/* Copy NODE on NUMA together with the replicated nodes below it, and return the tagged slot of the copy. Leaves and
+   nodes below the replicated levels are shared as they are. */
+static void *replica_copy(struct radix_tree_root *root, struct radix_tree_node *node, int numa) {
+	struct radix_tree_node *copy;
+	void **slots[RADIX_TREE_MAP_SIZE];
+	int i, cnt;
+
+	if ((node == NULL) || !is_replicated(root, node))
+		return (node == NULL) ? NULL : tag_node(node);
+
+	copy = get_node_on(node->type, numa);
+	replica_copy_node(copy, node);
+
+	cnt = child_slots(copy, slots);
+	for (i = 0; i < cnt; i++)
+		*slots[i] = replica_copy(root, slot_node(*slots[i]), numa);
+	return tag_node(copy);
+}
+
+/* Retire copies under SLOT, which lookups can no longer reach. */
+static void replica_retire(struct radix_tree_root *root, void *slot) {
+	struct radix_tree_node *copy = slot_node(slot);
+	void **slots[RADIX_TREE_MAP_SIZE];
+	int i, cnt;
+
+	if ((copy == NULL) || !is_replicated(root, copy))
+		return;
+	cnt = child_slots(copy, slots);
+	for (i = 0; i < cnt; i++)
+		replica_retire(root, *slots[i]);
+	return_node_to_gc(copy);
+}
+
+/* Recopy the whole replica of NUMA. */
+static void replica_rebuild(struct radix_tree_root *root, int numa) {
+	struct radix_tree_node *old = root->replica[numa];
+
+	atomic_store(&root->replica[numa], slot_node(replica_copy(root, get_root_node(&root->root_node), numa)));
+	replica_retire(root, (old == NULL) ? NULL : tag_node(old));
+}
+
+/* Recopy NODE into the replica of NUMA, in place of the copy at its key path. Return false if the replica has no slot
+   there, when the write that made one is yet to be copied. */
+static bool replica_graft(struct radix_tree_root *root, struct radix_tree_node *node, int numa) {
+	struct radix_tree_node *copy = root->replica[numa], *parent = NULL;
+	void **slot = NULL, *old;
+
+	while ((copy != NULL) && is_replicated(root, copy) && (copy->level < node->level)) {
+		if ((node->offset >> ((node->level - copy->level) * RADIX_TREE_ENTRY_BIT_SIZE)) != copy->offset)
+			return false;
+		slot = copy_child_slot(copy, (node->offset >> ((node->level - copy->level - 1) * RADIX_TREE_ENTRY_BIT_SIZE)) & RADIX_TREE_MAP_MASK);
+		if (slot == NULL)
+			return false;
+		parent = copy;
+		copy = slot_node(*slot);
+	}
+
+	if (parent == NULL) {
+		if (node != get_root_node(&root->root_node))
+			return false;
+		replica_rebuild(root, numa);
+		return true;
+	}
+	// Lookups may still be reading the old copy without having checked the write count yet, so it is never written in
+	// place. A fresh copy is grafted and the old one is retired.
+	old = *slot;
+	barrier();
+	*slot = replica_copy(root, node, numa);
+	replica_retire(root, old);
+	return true;
+}
+
+/* Start a write to NODE of ROOT, or to the root pointer if NODE is NULL, with the locks for it held. Return true if
+   replicas hold NODE, and replica_write_end() should follow once the locks are released. */
+static inline bool replica_write_begin(struct radix_tree_root *root, struct radix_tree_node *node) {
+	if ((root->replica_levels == 0) || ((node != NULL) && !is_replicated(root, node)))
+		return false;
+	atomic_fetch_add(&root->replica_begin, 1);
+	return true;
+}
+
+/* Copy the write to NODE of ROOT started by replica_write_begin() to every replica if BEGAN. */
+static void replica_write_end(struct radix_tree_root *root, struct radix_tree_node *node, bool began) {
+	int numa, numa_cnt = get_numa_cnt();
+
+	if (!began)
+		return;
+	radix_epoch_enter();
+	pthread_mutex_lock(&root->replica_lock);
+	// An obsolete NODE was replaced after the write, and is recopied along with the parent of its replacement.
+	if ((node == NULL) || !is_obsolete(get_version(node))) {
+		for (numa = 0; numa < numa_cnt; numa++) {
+			if ((node == NULL) || !replica_graft(root, node, numa))
+				replica_rebuild(root, numa);
 		}
-		switch (get_child_range(node, &node, (unsigned char)(cur_index >> ((RADIX_TREE_HEIGHT - level) * RADIX_TREE_ENTRY_BIT_SIZE)), level)) {
-			case RET_PREV_NODE:
-				level++;
-				cur_index = INDEX_GE(ULLONG_MAX, 24 + (8 * level));
+	}
+	pthread_mutex_unlock(&root->replica_lock);
+	radix_epoch_exit();
+	atomic_fetch_add(&root->replica_end, 1);
+}
+
+/* Node lookups of ROOT for INDEX should start from. The local copy if no replicated node is being written, with the
+   write count to check by lookup_valid() stored to SEQ. Trees with replicas have no directory, so INDEX matters only
+   for the directory. */
+static inline struct radix_tree_node *lookup_root(struct radix_tree_root *root, unsigned long long index, unsigned long long *seq) {
+	struct radix_tree_node *copy;
+
+	*seq = ULLONG_MAX;
+	if (__builtin_expect(root->replica_levels == 0, 1))
+		return get_root_node(root_slot(root, index));
+	*seq = atomic_load(&root->replica_end);
+	if ((atomic_load(&root->replica_begin) != *seq) || ((copy = atomic_load(&root->replica[get_thread_numa()])) == NULL)) {
+		*seq = ULLONG_MAX;
+		return get_root_node(&root->root_node);
+	}
+	return copy;
+}
+
+/* Return false if a lookup from lookup_root() with SEQ raced with a write to replicated nodes and should be redone. */
+static inline bool lookup_valid(struct radix_tree_root *root, unsigned long long seq) {
+	if (seq == ULLONG_MAX)
+		return true;
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load(&root->replica_begin) == seq;
+}
+
+int radix_tree_set_replicas(struct radix_tree_root *root, int levels) {
+#ifdef RADIX_SINGLE_THREAD
+	return -1;
+#else
+	int numa, numa_cnt = get_numa_cnt();
+
+	if ((levels < 0) || (levels >= root->key_size) || (root->dir != NULL))
+		return -1;
+	radix_epoch_enter();
+	for (numa = 0; numa < numa_cnt; numa++) {
+		replica_retire(root, (root->replica[numa] == NULL) ? NULL : tag_node(root->replica[numa]));
+		root->replica[numa] = NULL;
+	}
+	root->replica_levels = levels;
+	for (numa = 0; (levels > 0) && (numa < numa_cnt); numa++)
+		replica_rebuild(root, numa);
+	radix_epoch_exit();
+	return 0;
+#endif
+}
+
+/* Do lookup with given ROOT and INDEX. */
+#define LOOKUP_BATCH_GROUP 16 /* Traversals in flight. Enough to cover DRAM latency with a few misses each. */
+
+/* Traversal state of a lookup. Batched lookups keep one per key and advance them in turn. */
+struct lookup_state {
+	void *slot; /* Tagged slot of the next node. */
+	unsigned long long cur_index;
+	unsigned char level;
+	unsigned char key; /* Key the slot was found with, checked against the node on visiting it. */
+	bool check;
+	void *parent; /* Parent with its state, to step again if the slot was reused meanwhile. */
+	unsigned long long parent_index;
+	unsigned char parent_level;
+};
+
+/* Start STATE from ROOT node for INDEX. */
+static inline void lookup_state_init(struct lookup_state *state, struct radix_tree_node *root, unsigned long long index) {
+	state->slot = (root == NULL) ? NULL : tag_node(root);
+	state->cur_index = index;
+	state->level = 0;
+	state->check = false;
+}
+
+/* Descend STATE by one node in a tree of KEY_SIZE byte keys. Return false once STATE has reached a leaf or NULL.
+   The child slot is taken without reading the child. Its key is checked when the child is visited anyway, on the next step. */
+static inline __attribute__((always_inline)) bool radix_tree_lookup_step(struct lookup_state *state, unsigned char key_size) {
+	struct radix_tree_node *node = slot_node(state->slot);
+	unsigned long long cur_index = state->cur_index;
+	unsigned char level = state->level, type = slot_type(state->slot);
+
+	if (node == NULL)
+		return false;
+#ifdef RADIX_NUMA_STATS
+	count_numa_access(node->numa);
+#endif
+	if (state->check && is_fault_node(node, state->key, level - 1)) {
+		state->slot = state->parent;
+		state->cur_index = state->parent_index;
+		state->level = state->parent_level;
+		state->check = false;
+		return true;
+	}
+	if (type == LEAF_NODE)
+		return false;
+	state->parent = state->slot;
+	state->parent_index = cur_index;
+	state->parent_level = level;
+	if (level != node->level) {
+		radix_assert (level < node->level);
+		switch (check_prefix(cur_index, node->offset, level, node->level, key_size)) {
+			case PREFIX_PREV:
+				cur_index = index_suffix(ULLONG_MAX, key_size, node->level);
 				break;
-			case RET_NEXT_NODE:
-				cur_index = 0;
-				level++;
+			case PREFIX_MATCH:
+				cur_index = index_suffix(cur_index, key_size, node->level);
 				break;
-			case RET_MATCH_NODE:
-				level++;
-				cur_index = INDEX_GE(cur_index, 24 + (8 * level));
+			case PREFIX_NEXT:
+				cur_index = 0;
 				break;
-			default:
-				//TODO: If there is empty node, this point is reachable.
-				assert(false);
 		}
+		level = node->level;
 	}
+	// Slots of N256 are never reused for another key.
+	state->check = (type != N256);
+	switch (get_child_range(node, type, &state->slot, &state->key, key_at_level(cur_index, key_size, level), level, false)) {
+		case RET_PREV_NODE:
+			level++;
+			cur_index = index_suffix(ULLONG_MAX, key_size, level);
+			break;
+		case RET_NEXT_NODE:
+			cur_index = 0;
+			level++;
+			break;
+		case RET_MATCH_NODE:
+			level++;
+			cur_index = index_suffix(cur_index, key_size, level);
+			break;
+		default:
+			//TODO: If there is empty node, this point is reachable.
+			assert(false);
+	}
+	state->cur_index = cur_index;
+	state->level = level;
+	return true;
+}
+
+/* Prefetch the node STATE is about to visit, and the line of it likely holding the next slot, picked by the slot tag. */
+static inline __attribute__((always_inline)) void lookup_state_prefetch(struct lookup_state *state, unsigned char key_size) {
+	char *node = (char *)slot_node(state->slot);
 
+	// Key guess assumes no compressed path below, a miss only costs a useless prefetch.
+	__builtin_prefetch(node);
+	switch (slot_type(state->slot)) {
+		case N8:
+			__builtin_prefetch(node + 64);
+			break;
+		case N16:
+			__builtin_prefetch(node + 64);
+			__builtin_prefetch(node + 128);
+			break;
+		case N32:
+			__builtin_prefetch(node + 64);
+			__builtin_prefetch(node + 128);
+			__builtin_prefetch(node + 192);
+			__builtin_prefetch(node + 256);
+			break;
+		case N48:
+			__builtin_prefetch(&((struct N48 *)node)->key[key_at_level(state->cur_index, key_size, state->level)]);
+			break;
+		case N256:
+			__builtin_prefetch(&((struct N256 *)node)->slots[key_at_level(state->cur_index, key_size, state->level)]);
+			break;
+	}
+}
+
+static inline __attribute__((always_inline)) struct radix_tree_node *radix_tree_do_lookup(struct radix_tree_node *root, unsigned long long index, unsigned char key_size) {
+	struct lookup_state state;
+
+	lookup_state_init(&state, root, index);
+	while (radix_tree_lookup_step(&state, key_size));
+	return slot_node(state.slot);
+}
+
+/* Leaf of ROOT closest to INDEX, whose directory slot is empty. The last leaf of the closest non-empty slot before, or
+   the first one of the closest after if there is none. Return NULL if ROOT is empty. */
+static struct radix_tree_leaf *dir_neighbor_leaf(struct radix_tree_root *root, unsigned long long index) {
+	struct radix_tree_dir *dir = root->dir;
+	struct radix_tree_node *node;
+	int slot = dir_index(index, root->key_size), i;
+
+	for (i = dir_prev_used(dir, slot); i >= 0; i = dir_prev_used(dir, i)) {
+		if ((node = get_root_node(&dir->slots[i])) != NULL)
+			return (struct radix_tree_leaf *)radix_tree_do_lookup(node, index, root->key_size);
+	}
+	for (i = dir_next_used(dir, slot); i >= 0; i = dir_next_used(dir, i)) {
+		if ((node = get_root_node(&dir->slots[i])) != NULL)
+			return (struct radix_tree_leaf *)radix_tree_do_lookup(node, index, root->key_size);
+	}
 	return NULL;
 }
 
-/* Lookup operation entry point. Find leaf with INDEX from ROOT and store the leaf to LEAF. */
-enum radix_tree_lookup_results radix_tree_lookup(struct radix_tree_root *root, unsigned long long index, struct radix_tree_leaf **leaf) {
+/* Classify RET_LEAF found by radix_tree_do_lookup() for INDEX and store the leaf to return to LEAF. RET_LEAF is NULL
+   for an empty subtree of a directory, then a leaf of another one is taken. */
+static inline enum radix_tree_lookup_results lookup_result(struct radix_tree_root *root, unsigned long long index,
+							   struct radix_tree_leaf *ret_leaf, struct radix_tree_leaf **leaf) {
 	unsigned long long ret_index;
-	struct radix_tree_leaf *ret_leaf;
 
-	if (index >> (RADIX_TREE_ENTRY_BIT_SIZE * OFFSET_SIZE)) {
-		*leaf = NULL;
-		return EFAULT_RADIX;
-	}
-	
-	ret_leaf = (struct radix_tree_leaf *)radix_tree_do_lookup(get_root_node(root), index);
+	if ((ret_leaf == NULL) && (root->dir != NULL))
+		ret_leaf = dir_neighbor_leaf(root, index);
 	if (ret_leaf == NULL) {
 		*leaf = NULL;
 		return ENOEXIST_RADIX;
@@ -968,6 +2045,13 @@ enum radix_tree_lookup_results radix_tree_lookup(struct radix_tree_root *root, u
 		return RET_MATCH_NODE;
 	}
 	else if (ret_index > index) {
+		// Lookup lands on the next leaf when the previous one lives in a smaller subtree. It may still cover INDEX.
+		struct radix_tree_leaf *prev_leaf = ret_leaf->prev;
+		if ((prev_leaf != NULL) && (prev_leaf != &root->head) && (prev_leaf->node.offset < index) &&
+				(prev_leaf->node.offset + prev_leaf->length > index)) {
+			*leaf = prev_leaf;
+			return RET_PREV_NODE;
+		}
 		*leaf = ret_leaf;
 		return RET_NEXT_NODE;
 	}
@@ -977,20 +2061,204 @@ enum radix_tree_lookup_results radix_tree_lookup(struct radix_tree_root *root, u
 			return RET_PREV_NODE;
 		}
 		else {
-			if ((*leaf = ret_leaf->next) != NULL)
+			if ((*leaf = ret_leaf->next) != &root->tail)
 				return RET_NEXT_NODE;
+			*leaf = NULL;
+			return ENOEXIST_RADIX;
+		}
+	}
+}
+
+/* Lookup operation entry point. Find leaf with INDEX from ROOT and store the leaf to LEAF. */
+enum radix_tree_lookup_results radix_tree_lookup(struct radix_tree_root *root, unsigned long long index, struct radix_tree_leaf **leaf) {
+	enum radix_tree_lookup_results ret;
+	struct radix_tree_leaf *ret_leaf;
+	struct radix_tree_node *root_node;
+	unsigned long long seq;
+
+	if (is_fault_index(index, root->key_size)) {
+		*leaf = NULL;
+		return EFAULT_RADIX;
+	}
+	
+	radix_epoch_enter();
+	root_node = lookup_root(root, index, &seq);
+restart:
+	// Traversal is specialized by key size, so shifts of the default 40-bit tree stay constant.
+	switch (root->key_size) {
+		case 5:
+			ret_leaf = (struct radix_tree_leaf *)radix_tree_do_lookup(root_node, index, 5);
+			break;
+		case 6:
+			ret_leaf = (struct radix_tree_leaf *)radix_tree_do_lookup(root_node, index, 6);
+			break;
+		case 7:
+			ret_leaf = (struct radix_tree_leaf *)radix_tree_do_lookup(root_node, index, 7);
+			break;
+		default:
+			ret_leaf = (struct radix_tree_leaf *)radix_tree_do_lookup(root_node, index, 8);
+			break;
+	}
+	if (!lookup_valid(root, seq)) {
+		root_node = get_root_node(&root->root_node);
+		seq = ULLONG_MAX;
+		goto restart;
+	}
+	ret = lookup_result(root, index, ret_leaf, leaf);
+	radix_epoch_exit();
+	return ret;
+}
+
+/* Batched lookup entry point. Traversals of up to LOOKUP_BATCH_GROUP keys are advanced in turn, one node per round,
+   and the next child of each is prefetched along with the line of its next slot, picked by the slot tag without waiting
+   for the child, so cache misses of different keys overlap instead of serializing. */
+void radix_tree_lookup_batch(struct radix_tree_root *root, const unsigned long long *indexes, int cnt,
+			     struct radix_tree_leaf **leaves, enum radix_tree_lookup_results *results) {
+	struct lookup_state states[LOOKUP_BATCH_GROUP];
+	unsigned char active[LOOKUP_BATCH_GROUP];
+	struct radix_tree_node *root_node;
+	unsigned char key_size = root->key_size;
+	unsigned long long seq;
+	int base, group_cnt, active_cnt, i, j;
+
+	radix_epoch_enter();
+	for (base = 0; base < cnt; base += LOOKUP_BATCH_GROUP) {
+		group_cnt = (cnt - base < LOOKUP_BATCH_GROUP) ? cnt - base : LOOKUP_BATCH_GROUP;
+		// Keys of a group start from the same node, unless each has its own subtree in the directory.
+		root_node = lookup_root(root, 0, &seq);
+group_restart:
+		active_cnt = 0;
+		for (i = 0; i < group_cnt; i++) {
+			if (is_fault_index(indexes[base + i], key_size))
+				lookup_state_init(&states[i], NULL, indexes[base + i]);
+			else
+				lookup_state_init(&states[i], (root->dir == NULL) ? root_node : lookup_root(root, indexes[base + i], &seq), indexes[base + i]);
+			if (states[i].slot != NULL)
+				active[active_cnt++] = i;
+		}
+
+		while (active_cnt) {
+			for (i = 0, j = 0; i < active_cnt; i++) {
+				if (!radix_tree_lookup_step(&states[active[i]], key_size))
+					continue;
+				lookup_state_prefetch(&states[active[i]], key_size);
+				active[j++] = active[i];
+			}
+			active_cnt = j;
+		}
+		if (!lookup_valid(root, seq)) {
+			root_node = get_root_node(&root->root_node);
+			seq = ULLONG_MAX;
+			goto group_restart;
+		}
+
+		for (i = 0; i < group_cnt; i++) {
+			if (is_fault_index(indexes[base + i], key_size)) {
+				leaves[base + i] = NULL;
+				results[base + i] = EFAULT_RADIX;
+			}
 			else
-				return ENOEXIST_RADIX;
+				results[base + i] = lookup_result(root, indexes[base + i], (struct radix_tree_leaf *)slot_node(states[i].slot), &leaves[base + i]);
 		}
 	}
+	radix_epoch_exit();
 }
 
-/* Allocate new leaf and initialize with given INDEX, LENGTH, LOG_ADDR, TX_ID, and return the new leaf. */
-static inline struct radix_tree_node *alloc_init_leaf(unsigned long long index, unsigned long long length, void *log_addr, int tx_id) {
-	struct radix_tree_node *node = get_node(LEAF_NODE);
+/* Copy fields of LEAF to EXTENT under the leaf version. Return false if a writer interfered or LEAF was unlinked. */
+static inline bool read_leaf_extent(struct radix_tree_leaf *leaf, struct radix_tree_extent *extent) {
+	unsigned int version = get_version(&leaf->node);
+
+	if (is_locked(version) || is_obsolete(version))
+		return false;
+	barrier();
+	extent->offset = leaf->node.offset;
+	extent->length = leaf->length;
+	extent->log_addr = leaf->log_addr;
+	extent->tx_id = leaf->tx_id;
+	barrier();
+	return !read_unlock_or_restart(&leaf->node, version);
+}
+
+/* Traverse from ROOT to the leaf for INDEX like radix_tree_do_lookup(), checking node versions along the path. Store
+   the last node reached to NODE. Return false if a writer interfered and the traversal should be redone. */
+static inline __attribute__((always_inline)) bool radix_tree_do_lookup_validated(struct radix_tree_node *root, unsigned long long index,
+										 unsigned char key_size, struct radix_tree_node **node) {
+	struct lookup_state state;
+	unsigned int version;
+
+	lookup_state_init(&state, root, index);
+	while ((*node = slot_node(state.slot)) != NULL) {
+		version = get_version(*node);
+		if (is_locked(version) || is_obsolete(version)) {
+			_mm_pause();
+			return false;
+		}
+		if (!radix_tree_lookup_step(&state, key_size))
+			break;
+		if (read_unlock_or_restart(*node, version))
+			return false;
+	}
+	return true;
+}
+
+/* Validated lookup entry point. Like radix_tree_lookup(), but checks node versions along the path and copies the found
+   leaf out to EXTENT under its version, so the result is a consistent snapshot and no lock is taken. */
+enum radix_tree_lookup_results radix_tree_lookup_extent(struct radix_tree_root *root, unsigned long long index, struct radix_tree_extent *extent) {
+	enum radix_tree_lookup_results ret;
+	struct radix_tree_leaf *leaf;
+	struct radix_tree_node *root_node, *node;
+	unsigned long long seq;
+	bool done;
+
+	if (is_fault_index(index, root->key_size))
+		return EFAULT_RADIX;
+
+	radix_epoch_enter();
+restart:
+	root_node = lookup_root(root, index, &seq);
+	// Specialized by key size as in radix_tree_lookup().
+	switch (root->key_size) {
+		case 5:
+			done = radix_tree_do_lookup_validated(root_node, index, 5, &node);
+			break;
+		case 6:
+			done = radix_tree_do_lookup_validated(root_node, index, 6, &node);
+			break;
+		case 7:
+			done = radix_tree_do_lookup_validated(root_node, index, 7, &node);
+			break;
+		default:
+			done = radix_tree_do_lookup_validated(root_node, index, 8, &node);
+			break;
+	}
+	if (!done || !lookup_valid(root, seq))
+		goto restart;
+
+	if ((ret = lookup_result(root, index, (struct radix_tree_leaf *)node, &leaf)) == ENOEXIST_RADIX) {
+		radix_epoch_exit();
+		return ret;
+	}
+	if (!read_leaf_extent(leaf, extent))
+		goto restart;
+	// The leaf may have been trimmed after it was chosen. Classify again from the snapshot.
+	if (extent->offset == index)
+		ret = RET_MATCH_NODE;
+	else if (extent->offset > index)
+		ret = RET_NEXT_NODE;
+	else if (extent->offset + extent->length > index)
+		ret = RET_PREV_NODE;
+	else
+		goto restart;
+	radix_epoch_exit();
+	return ret;
+}
+
+/* Allocate new leaf on NUMA and initialize with given INDEX, LENGTH, LOG_ADDR, TX_ID, and return the new leaf. */
+static inline struct radix_tree_node *alloc_init_leaf(unsigned char key_size, int numa, unsigned long long index, unsigned long long length, void *log_addr, int tx_id) {
+	struct radix_tree_node *node = get_node_on(LEAF_NODE, numa);
 	struct radix_tree_leaf *leaf = (struct radix_tree_leaf *)node;
 
-	node->level = 5;
+	node->level = key_size;
 	node->offset = index;
 	node->lock_n_obsolete = 0;
 	leaf->length = length;
@@ -998,26 +2266,31 @@ static inline struct radix_tree_node *alloc_init_leaf(unsigned long long index,
 	leaf->log_addr = log_addr;
 	leaf->prev = NULL;
 	leaf->next = NULL;
-	pthread_mutex_init(&leaf->lock, NULL);
-	pthread_mutex_lock(&leaf->lock);
+	leaf->lock = LEAF_LOCKED;
 
 	return node;
 }
 
 static inline struct radix_tree_leaf *get_left_most_leaf(struct radix_tree_node *start) {
-	struct radix_tree_node *node = start;
-	while (!is_leaf(node)) {
-		get_child_range(node, &node, 0, node->level);
+	void *slot = tag_node(start);
+	struct radix_tree_node *node;
+	unsigned char key;
+	while (slot_type(slot) != LEAF_NODE) {
+		node = slot_node(slot);
+		get_child_range(node, slot_type(slot), &slot, &key, 0, node->level, true);
 	}
-	return (struct radix_tree_leaf *)node;
+	return (struct radix_tree_leaf *)slot_node(slot);
 }
 
 static inline struct radix_tree_leaf *get_right_most_leaf(struct radix_tree_node *start) {
-	struct radix_tree_node *node = start;
-	while (!is_leaf(node)) {
-		get_child_range(node, &node, 0xFF, node->level);
+	void *slot = tag_node(start);
+	struct radix_tree_node *node;
+	unsigned char key;
+	while (slot_type(slot) != LEAF_NODE) {
+		node = slot_node(slot);
+		get_child_range(node, slot_type(slot), &slot, &key, 0xFF, node->level, true);
 	}
-	return (struct radix_tree_leaf *)node;
+	return (struct radix_tree_leaf *)slot_node(slot);
 }
 
 static inline void link_and_remove_leaf(struct radix_tree_root *root, unsigned long long index, unsigned long long length, struct radix_tree_leaf *new_leaf, struct radix_tree_leaf *prev_leaf, struct radix_tree_leaf *next_leaf) {
@@ -1026,31 +2299,36 @@ static inline void link_and_remove_leaf(struct radix_tree_root *root, unsigned l
 
 	radix_assert(prev_leaf && next_leaf);
 
-	if (prev_leaf->node.offset != ROOT_END_OFS) {
+	if (!is_sentinel(prev_leaf)) {
 		unsigned long long prev_end = prev_leaf->node.offset + prev_leaf->length;
 		if (prev_end > end) {
 			next_leaf->prev = new_leaf;
+			write_lock(&prev_leaf->node);
 			prev_leaf->length = index - prev_leaf->node.offset;
-			radix_tree_do_insert(root, end, prev_end - end, prev_leaf->log_addr + (end - prev_leaf->node.offset), prev_leaf->tx_id, false);
+			write_unlock(&prev_leaf->node);
+			radix_tree_do_insert(root, end, prev_end - end, leaf_log_addr_at(root, prev_leaf, end), prev_leaf->tx_id, false);
 			return;
 		}
-		if ((prev_leaf->node.offset + prev_leaf->length) > index)
+		if ((prev_leaf->node.offset + prev_leaf->length) > index) {
+			write_lock(&prev_leaf->node);
 			prev_leaf->length = index - prev_leaf->node.offset;
+			write_unlock(&prev_leaf->node);
+		}
 	}
 
 	while (true) {
-		if (leaf == NULL)
+		if ((leaf == NULL) || is_sentinel(leaf))
 			return;
 		if (leaf->node.offset + leaf->length <= end) {
 			next = leaf->next;
 			radix_tree_do_remove(root, leaf, false);
-			pthread_mutex_unlock(&leaf->lock);
+			leaf_unlock(leaf);
 			leaf = next;
 		}
 		else if (leaf->node.offset < end) {
-			radix_tree_do_insert(root, end, leaf->length + leaf->node.offset - end, leaf->log_addr + end - leaf->node.offset, leaf->tx_id, false);
+			radix_tree_do_insert(root, end, leaf->length + leaf->node.offset - end, leaf_log_addr_at(root, leaf, end), leaf->tx_id, false);
 			radix_tree_do_remove(root, leaf, false);
-			pthread_mutex_unlock(&leaf->lock);
+			leaf_unlock(leaf);
 			return;
 		}
 		else
@@ -1059,96 +2337,125 @@ static inline void link_and_remove_leaf(struct radix_tree_root *root, unsigned l
 }
 
 
-/* Unlock leaf sequentially. */
-static inline void unlock_leaf_seq(struct radix_tree_leaf *begin, unsigned long long end) {
+/* Unlock leaf sequentially from BEGIN to LAST returned by lock_leaf_seq_or_restart(). LAST may have been removed
+   meanwhile, then the leaf which took over its end is the last one. Tail is never removed, so stop only at it. */
+static inline void unlock_leaf_seq(struct radix_tree_leaf *begin, struct radix_tree_leaf *last) {
 	struct radix_tree_leaf *cur = begin, *next;
+	unsigned long long end = last->node.offset + last->length;
 
 	radix_assert(cur != NULL);
 	do {
 		next = cur->next;
 		barrier();
-		pthread_mutex_unlock(&cur->lock);
+		leaf_unlock(cur);
 		cur = next;
-	} while ((cur->node.offset + cur->length) != end);
-	pthread_mutex_unlock(&cur->lock);
+	} while ((cur != last) && (is_sentinel(last) || ((cur->node.offset + cur->length) != end)));
+	leaf_unlock(cur);
 }
 
-/* Lock leaf sequentially. Either PREV_LEAF or NEXT_LEAF should be non-NULL.
+/* Lock leaf sequentially. Either PREV_LEAF or NEXT_LEAF should be non-NULL. Return the last locked leaf, or NULL for restart.
  * We can check transaction conflict at this point. */
-static inline unsigned long long lock_leaf_seq_or_restart(struct radix_tree_leaf *prev_leaf, struct radix_tree_leaf *next_leaf, unsigned long long index, unsigned long long length) {
+static inline struct radix_tree_leaf *lock_leaf_seq_or_restart(struct radix_tree_leaf *prev_leaf, struct radix_tree_leaf *next_leaf, unsigned long long index, unsigned long long length) {
 	struct radix_tree_leaf *cur = next_leaf;
 	unsigned long long end = index + length;
 
 	radix_assert(prev_leaf && next_leaf);
 
-	pthread_mutex_lock(&prev_leaf->lock);
+	leaf_lock(prev_leaf);
 	if ((prev_leaf->next != next_leaf) || (next_leaf->prev != prev_leaf)) {
-		radix_assert((prev_leaf->node.offset == ROOT_END_OFS) || (prev_leaf->node.offset < index));
-		pthread_mutex_unlock(&prev_leaf->lock);
-		return ULLONG_MAX;
+		// An overwritten leaf keeps its replacement as prev, so stale PREV_LEAF may start at INDEX.
+		radix_assert(is_sentinel(prev_leaf) || (prev_leaf->node.offset <= index));
+		leaf_unlock(prev_leaf);
+		return NULL;
 	}
 
-	pthread_mutex_lock(&next_leaf->lock);
-	radix_assert((next_leaf->prev == prev_leaf) && (next_leaf->node.offset >= index));
+	leaf_lock(next_leaf);
+	radix_assert((next_leaf->prev == prev_leaf) && (is_sentinel(next_leaf) || (next_leaf->node.offset >= index)));
 
 	while (true) {
-		if (cur->node.offset >= end)
-			return cur->node.offset + cur->length;
+		if (is_sentinel(cur) || (cur->node.offset >= end))
+			return cur;
 		cur = cur->next;
-		pthread_mutex_lock(&cur->lock);
+		leaf_lock(cur);
 	}
 }
 
 /* Insert operation entry point. Insert leaf with INDEX to ROOT. Initialize leaf with given INDEX, LENGTH, LOG_ADDR, TX_ID. */
 void radix_tree_insert(struct radix_tree_root *root, unsigned long long index, unsigned long long length, void *log_addr, int tx_id) {
+	if (is_fault_index(index, root->key_size)) {
+		radix_assert(false);
+		return;
+	}
+	/* Extent should not cross the key space boundary. */
+	if (length > max_extent_length(root->key_size, index))
+		length = max_extent_length(root->key_size, index);
+	radix_epoch_enter();
 	radix_tree_do_insert(root, index, length, log_addr, tx_id, true);
+	radix_epoch_exit();
 }
 
 static inline void radix_tree_do_insert(struct radix_tree_root *root, unsigned long long index, unsigned long long length, void *log_addr, int tx_id, bool lock_leaf_) {
-	radix_assert((index >> 40) == 0);
-	struct radix_tree_node *node, *child_node, *parent_node, *new_node, *new_leaf;
-	struct radix_tree_leaf *prev_leaf, *next_leaf, *new_leaf_;
-	unsigned char parent_key, node_key, level;
-	unsigned long long parent_version, node_version = 0;
-	unsigned long long cur_index, lock_end_idx;
-	bool lock_leaf = lock_leaf_, unlock_leaf = false;
-
-	new_leaf_ = (struct radix_tree_leaf *)(new_leaf = alloc_init_leaf(index, length, log_addr, tx_id));
+	struct radix_tree_node *node, *child_node, *parent_node, *new_node, *new_leaf, **rootp = root_slot(root, index);
+	struct radix_tree_leaf *prev_leaf, *next_leaf, *new_leaf_, *lock_end = NULL;
+	unsigned char parent_key, node_key, level, key_size = root->key_size;
+	unsigned int parent_version, node_version = 0;
+	unsigned long long cur_index;
+	bool lock_leaf = lock_leaf_, unlock_leaf = false, replicated;
+	struct contention cm;
+
+	new_leaf_ = (struct radix_tree_leaf *)(new_leaf = alloc_init_leaf(root->key_size, node_numa(root, root->key_size), index, length, log_addr, tx_id));
+	contention_init(&cm);
+	goto start;
 restart:
+	// Leaf locks, once taken, are kept over restarts.
+	contention_restart(&cm, (node != NULL) ? (void *)node : (void *)rootp, lock_leaf);
+start:
 	parent_node = NULL;
 	node = NULL;
-	child_node = get_root_node(root);
+	child_node = get_root_node(rootp);
 	cur_index = index;
 	node_key = 0;
 	level = 0;
 
 	if (child_node == NULL) {
-		new_leaf_->prev = &root->head;
-		new_leaf_->next = &root->tail;
+		// Empty tree, or an empty subtree of the directory whose neighbour leaves live in other subtrees.
+		if ((root->dir == NULL) || ((next_leaf = dir_neighbor_leaf(root, index)) == NULL))
+			next_leaf = &root->tail;
+		else if (next_leaf->node.offset < index)
+			next_leaf = next_leaf->next;
+		prev_leaf = next_leaf->prev;
+		if (test_leaf_range_or_restart(prev_leaf, next_leaf, index))
+			goto restart;
+
 		if (lock_leaf) {
-			pthread_mutex_lock(&root->head.lock);
-			if (root->head.next != &root->tail) {
-				pthread_mutex_unlock(&root->head.lock);
+			if ((lock_end = lock_leaf_seq_or_restart(prev_leaf, next_leaf, index, length)) == NULL)
+				goto restart;
+			// Any insert to the empty subtree links between the same leaves, so it stays empty once they are locked.
+			if (get_root_node(rootp) != NULL) {
+				unlock_leaf_seq(prev_leaf, lock_end);
 				goto restart;
 			}
-			pthread_mutex_lock(&root->tail.lock);
-			radix_assert(root->tail.prev == &root->head);
 			lock_leaf = false;
 			unlock_leaf = true;
 		}
+
+		if (root->dir != NULL)
+			dir_mark_used(root->dir, rootp - root->dir->slots);
+		replicated = replica_write_begin(root, NULL);
+		new_leaf_->prev = prev_leaf;
+		new_leaf_->next = next_leaf;
 		barrier();
-		root->head.next = new_leaf_;
-		root->tail.prev = new_leaf_;
-		if (__sync_val_compare_and_swap(&root->root_node, NULL, new_leaf) == NULL) {
-			if (unlock_leaf) {
-				pthread_mutex_unlock(&root->head.lock);
-				pthread_mutex_unlock(&new_leaf_->lock);
-				pthread_mutex_unlock(&root->tail.lock);
-			}
-			return;
-		}
-		else
+		prev_leaf->next = new_leaf_;
+		next_leaf->prev = new_leaf_;
+		if (root_cas(rootp, NULL, new_leaf) != NULL)
 			assert(false);
+		link_and_remove_leaf(root, index, length, new_leaf_, prev_leaf, next_leaf);
+		if (unlock_leaf)
+			unlock_leaf_seq(prev_leaf, lock_end);
+		replica_write_end(root, NULL, replicated);
+		contention_done(&cm);
+
+		return;
 	}
 
 	while (true) {
@@ -1162,10 +2469,10 @@ restart:
 			radix_assert(level < node->level);
 			unsigned long long node_prefix = node->offset;
 			enum check_prefix_result result;
-			switch (result = check_prefix(cur_index, node_prefix, level, node->level)) {
+			switch (result = check_prefix(cur_index, node_prefix, level, node->level, key_size)) {
 				case PREFIX_MATCH:
 					level = node->level;
-					cur_index = INDEX_GE(cur_index, 24 + (RADIX_TREE_ENTRY_BIT_SIZE * level));
+					cur_index = index_suffix(cur_index, key_size, level);
 					break;
 				default:
 					if (result == PREFIX_PREV) {
@@ -1183,7 +2490,7 @@ restart:
 					if (test_leaf_range_or_restart(prev_leaf, next_leaf, index))
 						goto restart;
 
-					unsigned long long cur_prefix = cur_index >> ((RADIX_TREE_HEIGHT + 1 - node->level) * RADIX_TREE_ENTRY_BIT_SIZE);
+					unsigned long long cur_prefix = index_prefix(cur_index, key_size, node->level);
 					unsigned char match_len, level_diff = node->level - level;
 					node_prefix = INDEX_GE(node_prefix, BITS_PER_INDEX - (level_diff * 8));
 					for (match_len = level_diff - 1; match_len > 0; match_len--) {
@@ -1193,18 +2500,18 @@ restart:
 						}
 					}
 
-					new_node = get_node(N4);
+					new_node = get_node_on(N4, node_numa(root, level + match_len));
 					new_node->level = level + match_len;
 					new_node->count = 0;
-					new_node->offset = index >> ((RADIX_TREE_HEIGHT + 1 - new_node->level) * RADIX_TREE_ENTRY_BIT_SIZE);
+					new_node->offset = index_prefix(index, key_size, new_node->level);
 					new_node->lock_n_obsolete = 0;
-					insert_child_force(new_node, (node_prefix >> ((level_diff - 1 - match_len) * RADIX_TREE_ENTRY_BIT_SIZE)) & RADIX_TREE_MAP_MASK, node);
-					insert_child_force(new_node, (cur_prefix >> ((level_diff - 1 - match_len) * RADIX_TREE_ENTRY_BIT_SIZE)) & RADIX_TREE_MAP_MASK, new_leaf);
+					insert_child_force(new_node, (node_prefix >> ((level_diff - 1 - match_len) * RADIX_TREE_ENTRY_BIT_SIZE)) & RADIX_TREE_MAP_MASK, tag_node(node));
+					insert_child_force(new_node, (cur_prefix >> ((level_diff - 1 - match_len) * RADIX_TREE_ENTRY_BIT_SIZE)) & RADIX_TREE_MAP_MASK, tag_node(new_leaf));
 
 					barrier();
 
 					if (lock_leaf) {
-						if ((lock_end_idx = lock_leaf_seq_or_restart(prev_leaf, next_leaf, index, length)) == ULLONG_MAX) {
+						if ((lock_end = lock_leaf_seq_or_restart(prev_leaf, next_leaf, index, length)) == NULL) {
 							return_node(new_node);
 							goto restart;
 						}
@@ -1218,7 +2525,7 @@ restart:
 					}
 
 					if (parent_node == NULL) {
-						if (root_write_lock_or_restart(root, node)) {
+						if (root_write_lock_or_restart(rootp, node)) {
 							write_unlock(node);
 							return_node(new_node);
 							goto restart;
@@ -1232,6 +2539,7 @@ restart:
 						}
 					}
 
+					replicated = replica_write_begin(root, parent_node);
 					new_leaf_->prev = prev_leaf;
 					new_leaf_->next = next_leaf;
 					barrier();
@@ -1239,15 +2547,18 @@ restart:
 					next_leaf->prev = new_leaf_;
 
 					if (parent_node == NULL)
-						root_write_unlock(root, new_node);
+						root_write_unlock(rootp, new_node);
 					else {
-						update_child(parent_node, parent_key, new_node);
+						update_child(parent_node, parent_key, tag_node(new_node));
 						write_unlock(parent_node);
 					}
 					write_unlock(node);
 					link_and_remove_leaf(root, index, length, new_leaf_, prev_leaf, next_leaf);
 					if (unlock_leaf)
-						unlock_leaf_seq(prev_leaf, lock_end_idx);
+						unlock_leaf_seq(prev_leaf, lock_end);
+					replica_write_end(root, parent_node, replicated);
+					contention_done(&cm);
+
 					return;
 			}
 		}
@@ -1258,14 +2569,14 @@ restart:
 			next_leaf = (struct radix_tree_leaf *)node;
 			prev_leaf = next_leaf->prev;
 			if (lock_leaf) {
-				if ((lock_end_idx = lock_leaf_seq_or_restart(prev_leaf, next_leaf, index, length)) == ULLONG_MAX)
+				if ((lock_end = lock_leaf_seq_or_restart(prev_leaf, next_leaf, index, length)) == NULL)
 					goto restart;
 				lock_leaf = false;
 				unlock_leaf = true;
 			}
 
 			if (parent_node == NULL) {
-				if (root_write_lock_or_restart(root, node))
+				if (root_write_lock_or_restart(rootp, node))
 					goto restart;
 			}
 			else {
@@ -1273,6 +2584,7 @@ restart:
 					goto restart;
 			}
 
+			replicated = replica_write_begin(root, parent_node);
 			new_leaf_->prev = prev_leaf;
 			new_leaf_->next = next_leaf;
 			barrier();
@@ -1280,40 +2592,46 @@ restart:
 			next_leaf->prev = new_leaf_;
 			barrier();
 			if (parent_node == NULL)
-				root_write_unlock(root, new_leaf);
+				root_write_unlock(rootp, new_leaf);
 			else {
-				update_child(parent_node, parent_key, new_leaf);
+				update_child(parent_node, parent_key, tag_node(new_leaf));
 				write_unlock(parent_node);
 			}
 			barrier();
 			new_leaf_->next = next_leaf->next;
 			next_leaf->next->prev = new_leaf_;
+			mark_obsolete(node);
 			barrier();
 			if (unlock_leaf)
-				pthread_mutex_unlock(&next_leaf->lock);
+				leaf_unlock(next_leaf);
 			return_node_to_gc(node);
 			next_leaf = new_leaf_->next;
 
 			link_and_remove_leaf(root, index, length, new_leaf_, prev_leaf, next_leaf);
 			if (unlock_leaf)
-				unlock_leaf_seq(prev_leaf, lock_end_idx);
+				unlock_leaf_seq(prev_leaf, lock_end);
+			replica_write_end(root, parent_node, replicated);
+			contention_done(&cm);
+
 			return;
 
 		}
 
-		node_key = cur_index >> ((RADIX_TREE_HEIGHT - level) * RADIX_TREE_ENTRY_BIT_SIZE);
+		node_key = key_at_level(cur_index, key_size, level);
 		child_node = get_child(node, node_key, level);
 
 		if (child_node == NULL) {
-			switch (get_child_range(node, &child_node, node_key, level)) {
+			void *child_slot;
+			unsigned char child_key;
+			switch (get_child_range(node, node->type, &child_slot, &child_key, node_key, level, true)) {
 				case RET_PREV_NODE:
-					prev_leaf = get_right_most_leaf(child_node);
+					prev_leaf = get_right_most_leaf(slot_node(child_slot));
 					if (prev_leaf == NULL)
 						goto restart;
 					next_leaf = prev_leaf->next;
 					break;
 				case RET_NEXT_NODE:
-					next_leaf = get_left_most_leaf(child_node);
+					next_leaf = get_left_most_leaf(slot_node(child_slot));
 					if (next_leaf == NULL)
 						goto restart;
 					prev_leaf = next_leaf->prev;
@@ -1326,7 +2644,7 @@ restart:
 			bool need_expand = radix_node_need_expand(node);
 
 			if (lock_leaf) {
-				if ((lock_end_idx = lock_leaf_seq_or_restart(prev_leaf, next_leaf, index, length)) == ULLONG_MAX)
+				if ((lock_end = lock_leaf_seq_or_restart(prev_leaf, next_leaf, index, length)) == NULL)
 					goto restart;
 				lock_leaf = false;
 				unlock_leaf = true;
@@ -1337,7 +2655,7 @@ restart:
 
 			if (need_expand) {
 				if (parent_node == NULL) {
-					if (root_write_lock_or_restart(root, node)) {
+					if (root_write_lock_or_restart(rootp, node)) {
 						write_unlock(node);
 						goto restart;
 					}
@@ -1350,97 +2668,129 @@ restart:
 				}
 			}
 
+			// Expansion writes to the parent instead.
+			replicated = replica_write_begin(root, need_expand ? parent_node : node);
 			new_leaf_->prev = prev_leaf;
 			new_leaf_->next = next_leaf;
 			barrier();
 			prev_leaf->next = new_leaf_;
 			next_leaf->prev = new_leaf_;
 
-			if (insert_child(node, node_key, new_leaf)) {
+			if (insert_child(node, node_key, tag_node(new_leaf))) {
 				radix_assert(!need_expand);
 				write_unlock(node);
 				link_and_remove_leaf(root, index, length, new_leaf_, prev_leaf, next_leaf);
 				if (unlock_leaf)
-					unlock_leaf_seq(prev_leaf, lock_end_idx);
+					unlock_leaf_seq(prev_leaf, lock_end);
+				replica_write_end(root, node, replicated);
+				contention_done(&cm);
+
 				return;
 			}
 
 			radix_assert(need_expand);
-			new_node = radix_node_expand(node);
-			insert_child_force(new_node, node_key, new_leaf);
+			new_node = radix_node_expand(node, node_numa(root, node->level));
+			insert_child_force(new_node, node_key, tag_node(new_leaf));
 			barrier();
 
 			if (parent_node == NULL)
-				root_write_unlock(root, new_node);
+				root_write_unlock(rootp, new_node);
 			else {
-				update_child(parent_node, parent_key, new_node);
+				update_child(parent_node, parent_key, tag_node(new_node));
 				write_unlock(parent_node);
 			}
 			write_unlock_obsolete(node);
 			return_node_to_gc(node);
 			link_and_remove_leaf(root, index, length, new_leaf_, prev_leaf, next_leaf);
 			if (unlock_leaf)
-				unlock_leaf_seq(prev_leaf, lock_end_idx);
+				unlock_leaf_seq(prev_leaf, lock_end);
+			replica_write_end(root, parent_node, replicated);
+			contention_done(&cm);
+
 			return;
 		}
 
 		level++;
-		cur_index = INDEX_GE(cur_index, 24 + (8 * level));
+		cur_index = index_suffix(cur_index, key_size, level);
 	}
 }
 
 static inline void remove_leaf_unlock(struct radix_tree_leaf *leaf, struct radix_tree_leaf *prev, struct radix_tree_leaf *next) {
-	pthread_mutex_unlock(&prev->lock);
-	pthread_mutex_unlock(&leaf->lock);
-	pthread_mutex_unlock(&next->lock);
+	leaf_unlock(prev);
+	leaf_unlock(leaf);
+	leaf_unlock(next);
 }
 
 /* Remove operation entry point. Remove LEAF from ROOT. */
 void radix_tree_remove(struct radix_tree_root *root, struct radix_tree_leaf *leaf) {
+	radix_epoch_enter();
 	radix_tree_do_remove(root, leaf, true);
+	radix_epoch_exit();
 }
 
 static inline void radix_tree_do_remove(struct radix_tree_root *root, struct radix_tree_leaf *leaf, bool lock_leaf) {
 	struct radix_tree_node *node, *child_node, *parent_node, *leaf_node = (struct radix_tree_node *)leaf;
+	struct radix_tree_node **rootp = root_slot(root, leaf->node.offset);
 	struct radix_tree_leaf *prev_leaf = leaf->prev, *next_leaf = leaf->next;
-	unsigned long long parent_version, node_version = 0;
-	unsigned char parent_key, node_key, level;
+	unsigned int parent_version, node_version = 0;
+	unsigned char parent_key, node_key, level, key_size = root->key_size;
 	unsigned long long cur_index;
-	bool unlock_leaf = false;
+	bool unlock_leaf = false, replicated;
+	struct radix_tree_node *written;
+	struct contention cm;
 
+	contention_init(&cm);
 	if (lock_leaf) {
 lock_restart:
-		pthread_mutex_lock(&prev_leaf->lock);
+		leaf_lock(prev_leaf);
 		if ((prev_leaf->next != leaf) || (leaf->prev != prev_leaf)) {
-			pthread_mutex_unlock(&prev_leaf->lock);
+			leaf_unlock(prev_leaf);
+			// Leaf has already been unlinked by others.
+			if (is_obsolete(get_version(leaf_node)))
+				return;
 			prev_leaf = leaf->prev;
 			goto lock_restart;
 		}
-		pthread_mutex_lock(&leaf->lock);
+		leaf_lock(leaf);
 		next_leaf = leaf->next;
-		pthread_mutex_lock(&next_leaf->lock);
+		leaf_lock(next_leaf);
 		unlock_leaf = true;
 	}
+	goto start;
 restart:
+	// Leaves are locked before any restart, so removes never queue.
+	contention_restart(&cm, (node != NULL) ? (void *)node : (void *)rootp, false);
+start:
 	parent_node = NULL;
 	node = NULL;
-	child_node = get_root_node(root);
+	child_node = get_root_node(rootp);
 	cur_index = leaf->node.offset;
 	node_key = 0;
 	level = 0;
 
-	radix_assert(child_node != NULL);
+	if (child_node == NULL) {
+		// This point is reachable only when leaf has already been removed.
+		if (unlock_leaf)
+			remove_leaf_unlock(prev_leaf, leaf, next_leaf);
+		return;
+	}
 	if (child_node == leaf_node) {
-		root->head.next = &root->tail;
-		root->tail.prev = &root->head;
-		if (__sync_val_compare_and_swap(&root->root_node, leaf_node, NULL) == leaf_node) {
+		replicated = replica_write_begin(root, NULL);
+		if (root_cas(rootp, leaf_node, NULL) == leaf_node) {
+			// Neighbours are the sentinels unless other subtrees of the directory hold leaves.
+			prev_leaf->next = next_leaf;
+			next_leaf->prev = prev_leaf;
+			mark_obsolete(leaf_node);
 			if (unlock_leaf)
 				remove_leaf_unlock(prev_leaf, leaf, next_leaf);
 			return_node_to_gc(leaf_node);
+			replica_write_end(root, NULL, replicated);
 			return;
 		}
-		else
+		else {
+			replica_write_end(root, NULL, replicated);
 			goto restart;
+		}
 	}
 	if (is_leaf(child_node)) {
 		// This point is reachable only when leaf has already been removed.
@@ -1459,10 +2809,10 @@ restart:
 		if (level != node->level) {
 			radix_assert(level < node->level);
 			unsigned long long node_prefix = node->offset;
-			switch (check_prefix(cur_index, node_prefix, level, node->level)) {
+			switch (check_prefix(cur_index, node_prefix, level, node->level, key_size)) {
 				case PREFIX_MATCH:
 					level = node->level;
-					cur_index = INDEX_GE(cur_index, 24 + (RADIX_TREE_ENTRY_BIT_SIZE * level));
+					cur_index = index_suffix(cur_index, key_size, level);
 					break;
 				default:
 					// This point is reachable only when leaf has already been removed.
@@ -1471,7 +2821,7 @@ restart:
 					return;
 			}
 		}
-		node_key = cur_index >> ((RADIX_TREE_HEIGHT - level) * RADIX_TREE_ENTRY_BIT_SIZE);
+		node_key = key_at_level(cur_index, key_size, level);
 		child_node = get_child(node, node_key, level);
 
 		if (child_node == NULL) {
@@ -1486,7 +2836,6 @@ restart:
 		if (is_leaf(child_node)) {
 			if (child_node != leaf_node) {
 				// This point is reachable only when leaf has already been removed.
-				radix_assert(child_node->offset == leaf->node.offset);
 				if (unlock_leaf)
 					remove_leaf_unlock(prev_leaf, leaf, next_leaf);
 				return;
@@ -1496,10 +2845,14 @@ restart:
 			radix_assert(node->count != 1);
 
 			if (node->count == 2) {
-				struct radix_tree_node *remaining_child = get_child_remain(node, node_key);
+				void *remaining_child = get_child_remain(node, node_key);
+				written = parent_node;
 				if (parent_node == NULL) {
-					if (__sync_val_compare_and_swap(&root->root_node, node, remaining_child) != node) {
+					replicated = replica_write_begin(root, NULL);
+					// Root pointer is kept untagged, as its top bit is the root lock.
+					if (root_cas(rootp, node, slot_node(remaining_child)) != node) {
 						write_unlock(node);
+						replica_write_end(root, NULL, replicated);
 						goto restart;
 					}
 				}
@@ -1508,25 +2861,441 @@ restart:
 						write_unlock(node);
 						goto restart;
 					}
+					replicated = replica_write_begin(root, parent_node);
 					update_child(parent_node, parent_key, remaining_child);
 					write_unlock(parent_node);
 				}
 				write_unlock_obsolete(node);
 				return_node_to_gc(node);
 			}
+			else if (radix_node_need_shrink(node)) {
+				// Shrinking is optional. Fall back to plain delete if parent is being modified.
+				bool parent_locked;
+				if (parent_node == NULL)
+					parent_locked = !root_write_lock_or_restart(rootp, node);
+				else
+					parent_locked = !lock_version_or_restart(parent_node, &parent_version);
+
+				if (parent_locked) {
+					struct radix_tree_node *new_node = radix_node_shrink(node, node_key, node_numa(root, node->level));
+					written = parent_node;
+					replicated = replica_write_begin(root, parent_node);
+					barrier();
+					if (parent_node == NULL)
+						root_write_unlock(rootp, new_node);
+					else {
+						update_child(parent_node, parent_key, tag_node(new_node));
+						write_unlock(parent_node);
+					}
+					write_unlock_obsolete(node);
+					return_node_to_gc(node);
+				}
+				else {
+					written = node;
+					replicated = replica_write_begin(root, node);
+					delete_child(node, node_key);
+					write_unlock(node);
+				}
+			}
 			else {
+				written = node;
+				replicated = replica_write_begin(root, node);
 				delete_child(node, node_key);
 				write_unlock(node);
 			}
 			// Change link between leaves.
 			prev_leaf->next = next_leaf;
 			next_leaf->prev = prev_leaf;
+			mark_obsolete(leaf_node);
 
 			if (unlock_leaf)
 				remove_leaf_unlock(prev_leaf, leaf, next_leaf);
 			return_node_to_gc(child_node);
+			replica_write_end(root, written, replicated);
 			return;
 		}
 	}
 }
 
+
+/* Lock and return the first leaf whose end is larger than POS, or tail if there is none. HINT is a leaf whose
+   offset is not larger than POS or NULL. Caller should be inside an epoch guard. Leaves are always locked in
+   offset order, same as writers do. */
+static struct radix_tree_leaf *scan_lock_first(struct radix_tree_root *root, struct radix_tree_leaf *hint, unsigned long long pos) {
+	struct radix_tree_leaf *cur = hint, *next;
+	unsigned long long index;
+
+	while (true) {
+		if (cur == NULL) {
+			// Positions past the key space sort after every leaf.
+			index = is_fault_index(pos, root->key_size) ? index_suffix(ULLONG_MAX, root->key_size, 0) : pos;
+			cur = (struct radix_tree_leaf *)radix_tree_do_lookup(get_root_node(root_slot(root, index)), index, root->key_size);
+			if ((cur == NULL) && (root->dir != NULL))
+				cur = dir_neighbor_leaf(root, index);
+			if (cur == NULL)
+				cur = &root->head;
+			else if (cur->node.offset > pos)
+				cur = cur->prev;
+		}
+		leaf_lock(cur);
+		if (is_obsolete(get_version(&cur->node)) || ((cur != &root->head) && (cur->node.offset > pos))) {
+			leaf_unlock(cur);
+			cur = NULL;
+			continue;
+		}
+		break;
+	}
+
+	// CUR is linked and starts before POS, so no leaf before CUR covers POS.
+	while ((cur != &root->tail) && ((cur == &root->head) || (cur->node.offset + cur->length <= pos))) {
+		next = cur->next;
+		leaf_lock(next);
+		leaf_unlock(cur);
+		cur = next;
+	}
+	return cur;
+}
+
+/* Fill EXTENT with LEAF of ROOT clipped to [START, END). */
+static inline void clip_extent(struct radix_tree_root *root, struct radix_tree_extent *extent, struct radix_tree_leaf *leaf, unsigned long long start, unsigned long long end) {
+	unsigned long long leaf_end = leaf->node.offset + leaf->length;
+
+	extent->offset = (leaf->node.offset > start) ? leaf->node.offset : start;
+	extent->length = ((leaf_end < end) ? leaf_end : end) - extent->offset;
+	extent->log_addr = leaf_log_addr_at(root, leaf, extent->offset);
+	extent->tx_id = leaf->tx_id;
+}
+
+/* Scan operation entry point. */
+unsigned long long radix_tree_scan(struct radix_tree_root *root, unsigned long long start, unsigned long long end, radix_tree_scan_fn fn, void *arg) {
+	struct radix_tree_leaf *cur, *next;
+	struct radix_tree_extent extent;
+	unsigned long long cnt = 0;
+
+	if (start >= end)
+		return 0;
+
+	radix_epoch_enter();
+	cur = scan_lock_first(root, NULL, start);
+	while ((cur != &root->tail) && (cur->node.offset < end)) {
+		clip_extent(root, &extent, cur, start, end);
+		cnt++;
+		if (fn(&extent, arg))
+			break;
+		next = cur->next;
+		leaf_lock(next);
+		leaf_unlock(cur);
+		cur = next;
+	}
+	leaf_unlock(cur);
+	radix_epoch_exit();
+	return cnt;
+}
+
+void radix_tree_cursor_init(struct radix_tree_cursor *cursor, struct radix_tree_root *root, unsigned long long start, unsigned long long end) {
+	radix_epoch_enter();
+	cursor->root = root;
+	cursor->leaf = NULL;
+	cursor->pos = start;
+	cursor->end = end;
+}
+
+/* Store next extent to EXTENT. Return false if there is no more extent in range. */
+bool radix_tree_cursor_next(struct radix_tree_cursor *cursor, struct radix_tree_extent *extent) {
+	struct radix_tree_leaf *cur;
+
+	if (cursor->pos >= cursor->end)
+		return false;
+
+	// Last returned leaf is still readable under our epoch guard. Resume from it unless it has been unlinked.
+	cur = scan_lock_first(cursor->root, cursor->leaf, cursor->pos);
+	if ((cur == &cursor->root->tail) || (cur->node.offset >= cursor->end)) {
+		leaf_unlock(cur);
+		cursor->pos = cursor->end;
+		return false;
+	}
+	clip_extent(cursor->root, extent, cur, cursor->pos, cursor->end);
+	cursor->pos = extent->offset + extent->length;
+	cursor->leaf = cur;
+	leaf_unlock(cur);
+	return true;
+}
+
+void radix_tree_cursor_close(struct radix_tree_cursor *cursor) {
+	cursor->leaf = NULL;
+	radix_epoch_exit();
+}
+
+// Bulk load
+#define BULK_THREAD_MIN_EXTENTS (1ULL << 16) /* Below this, threads cost more than they save. */
+
+struct bulk_load_ctx {
+	struct radix_tree_root *root;
+	const struct radix_tree_extent *extents;
+	unsigned char key_size;
+	struct radix_tree_leaf *first;
+	struct radix_tree_leaf *last;
+};
+
+/* Group of extents sharing key byte at the split level. */
+struct bulk_load_group {
+	unsigned long long lo;
+	unsigned long long hi;
+	unsigned char key;
+	struct radix_tree_node *child;
+};
+
+struct bulk_load_work {
+	struct bulk_load_ctx ctx;
+	struct bulk_load_group *groups;
+	int group_lo;
+	int group_hi;
+};
+
+/* Return the first level whose key differs between A and B. A and B should not be equal. */
+static inline unsigned char bulk_split_level(unsigned long long a, unsigned long long b, unsigned char key_size) {
+	return (__builtin_clzll(a ^ b) - (BITS_PER_INDEX - (key_size * RADIX_TREE_ENTRY_BIT_SIZE))) / RADIX_TREE_ENTRY_BIT_SIZE;
+}
+
+/* Allocate a new leaf for EXTENT and append it to leaf list of CTX. */
+static struct radix_tree_node *bulk_build_leaf(struct bulk_load_ctx *ctx, const struct radix_tree_extent *extent) {
+	struct radix_tree_leaf *leaf = (struct radix_tree_leaf *)get_node_on(LEAF_NODE, node_numa(ctx->root, ctx->key_size));
+
+	leaf->node.level = ctx->key_size;
+	leaf->node.offset = extent->offset;
+	leaf->node.lock_n_obsolete = 0;
+	leaf->length = extent->length;
+	leaf->tx_id = extent->tx_id;
+	leaf->log_addr = extent->log_addr;
+	leaf->next = NULL;
+	leaf->prev = ctx->last;
+	leaf->lock = LEAF_UNLOCKED;
+	if (ctx->last != NULL)
+		ctx->last->next = leaf;
+	else
+		ctx->first = leaf;
+	ctx->last = leaf;
+	return &leaf->node;
+}
+
+/* Split extents [LO, HI) sharing prefix up to LEVEL into groups by key at LEVEL. Return the number of groups. */
+static int bulk_split_groups(const struct radix_tree_extent *extents, unsigned long long lo, unsigned long long hi, unsigned char level,
+			     unsigned char key_size, struct bulk_load_group *groups) {
+	unsigned long long i;
+	int cnt = 0;
+
+	groups[0].lo = lo;
+	groups[0].key = key_at_level(extents[lo].offset, key_size, level);
+	for (i = lo + 1; i < hi; i++) {
+		unsigned char key = key_at_level(extents[i].offset, key_size, level);
+		if (key != groups[cnt].key) {
+			groups[cnt++].hi = i;
+			groups[cnt].lo = i;
+			groups[cnt].key = key;
+		}
+	}
+	groups[cnt++].hi = hi;
+	return cnt;
+}
+
+/* Allocate inner node of ROOT of exact size for CNT children at LEVEL with prefix of INDEX. */
+static struct radix_tree_node *bulk_alloc_node(struct radix_tree_root *root, int cnt, unsigned char level, unsigned long long index) {
+	int numa = node_numa(root, level);
+	struct radix_tree_node *node;
+
+	if (cnt <= 4)
+		node = get_node_on(N4, numa);
+	else if (cnt <= 8)
+		node = get_node_on(N8, numa);
+	else if (cnt <= 16)
+		node = get_node_on(N16, numa);
+	else if (cnt <= 32)
+		node = get_node_on(N32, numa);
+	else if (cnt <= 48) {
+		node = get_node_on(N48, numa);
+		memset(((struct N48 *)node)->key, N48_NO_ENT, sizeof(((struct N48 *)node)->key));
+		memset(((struct N48 *)node)->index, 0, sizeof(((struct N48 *)node)->index));
+	}
+	else {
+		node = get_node_on(N256, numa);
+		memset(((struct N256 *)node)->slots, 0, sizeof(((struct N256 *)node)->slots));
+		memset(((struct N256 *)node)->index, 0, sizeof(((struct N256 *)node)->index));
+	}
+	init_node(node, level, 0, index_prefix(index, root->key_size, level));
+	return node;
+}
+
+/* Build subtree for extents [LO, HI). Path is compressed down to the first level where keys differ. */
+static struct radix_tree_node *bulk_build(struct bulk_load_ctx *ctx, unsigned long long lo, unsigned long long hi) {
+	const struct radix_tree_extent *extents = ctx->extents;
+	struct bulk_load_group groups[RADIX_TREE_MAP_SIZE];
+	struct radix_tree_node *node;
+	unsigned char level;
+	int i, cnt;
+
+	if (hi - lo == 1)
+		return bulk_build_leaf(ctx, &extents[lo]);
+
+	level = bulk_split_level(extents[lo].offset, extents[hi - 1].offset, ctx->key_size);
+	cnt = bulk_split_groups(extents, lo, hi, level, ctx->key_size, groups);
+	node = bulk_alloc_node(ctx->root, cnt, level, extents[lo].offset);
+	for (i = 0; i < cnt; i++)
+		insert_child_force(node, groups[i].key, tag_node(bulk_build(ctx, groups[i].lo, groups[i].hi)));
+	return node;
+}
+
+static void *bulk_build_thread(void *aux) {
+	struct bulk_load_work *work = (struct bulk_load_work *)aux;
+	int i;
+
+	for (i = work->group_lo; i < work->group_hi; i++)
+		work->groups[i].child = bulk_build(&work->ctx, work->groups[i].lo, work->groups[i].hi);
+	return NULL;
+}
+
+/* Split extents [0, CNT) into groups by directory slot. Return the number of groups. */
+static int bulk_split_dir(const struct radix_tree_extent *extents, unsigned long long cnt, unsigned char key_size,
+			  struct bulk_load_group *groups) {
+	unsigned long long i;
+	int g = 0;
+
+	groups[0].lo = 0;
+	for (i = 1; i < cnt; i++) {
+		if (dir_index(extents[i].offset, key_size) != dir_index(extents[i - 1].offset, key_size)) {
+			groups[g++].hi = i;
+			groups[g].lo = i;
+		}
+	}
+	groups[g++].hi = cnt;
+	return g;
+}
+
+/* Build children of GROUPS, holding CNT extents of CTX in all, with up to THREAD_CNT threads, and chain their leaves to
+   the leaf list of CTX. */
+static void bulk_build_groups(struct bulk_load_ctx *ctx, struct bulk_load_group *groups, int group_cnt, unsigned long long cnt, int thread_cnt) {
+	struct bulk_load_work *works;
+	pthread_t *threads;
+	bool *created;
+	struct radix_tree_leaf *prev_last;
+	unsigned long long per_thread, assigned;
+	int g, t, work_cnt;
+
+	// Hand contiguous groups to threads.
+	if (thread_cnt > group_cnt)
+		thread_cnt = group_cnt;
+	works = (struct bulk_load_work *)calloc(thread_cnt, sizeof(struct bulk_load_work));
+	threads = (pthread_t *)calloc(thread_cnt, sizeof(pthread_t));
+	created = (bool *)calloc(thread_cnt, sizeof(bool));
+	assert((works != NULL) && (threads != NULL) && (created != NULL));
+
+	per_thread = (cnt + thread_cnt - 1) / thread_cnt;
+	for (g = 0, work_cnt = 0; (g < group_cnt) && (work_cnt < thread_cnt); work_cnt++) {
+		works[work_cnt].ctx.root = ctx->root;
+		works[work_cnt].ctx.extents = ctx->extents;
+		works[work_cnt].ctx.key_size = ctx->key_size;
+		works[work_cnt].groups = groups;
+		works[work_cnt].group_lo = g;
+		assigned = 0;
+		do {
+			assigned += groups[g].hi - groups[g].lo;
+			g++;
+		} while ((g < group_cnt) && (assigned < per_thread));
+		works[work_cnt].group_hi = (work_cnt == thread_cnt - 1) ? group_cnt : g;
+		g = works[work_cnt].group_hi;
+	}
+	for (t = 1; t < work_cnt; t++) {
+		// Build it ourselves if thread creation fails.
+		if (pthread_create(&threads[t], NULL, bulk_build_thread, &works[t]) != 0)
+			bulk_build_thread(&works[t]);
+		else
+			created[t] = true;
+	}
+	bulk_build_thread(&works[0]);
+	for (t = 1; t < work_cnt; t++) {
+		if (created[t])
+			pthread_join(threads[t], NULL);
+	}
+
+	// Stitch leaf lists of threads.
+	prev_last = NULL;
+	for (t = 0; t < work_cnt; t++) {
+		if (works[t].ctx.first == NULL)
+			continue;
+		if (prev_last != NULL) {
+			prev_last->next = works[t].ctx.first;
+			works[t].ctx.first->prev = prev_last;
+		}
+		else
+			ctx->first = works[t].ctx.first;
+		prev_last = works[t].ctx.last;
+	}
+	ctx->last = prev_last;
+	free(works);
+	free(threads);
+	free(created);
+}
+
+/* Bulk load entry point. */
+int radix_tree_bulk_load(struct radix_tree_root *root, const struct radix_tree_extent *extents, unsigned long long cnt, int thread_cnt) {
+	struct bulk_load_group groups[RADIX_TREE_MAP_SIZE], *dir_groups;
+	struct bulk_load_ctx ctx = {root, extents, root->key_size, NULL, NULL};
+	struct radix_tree_node *node;
+	unsigned long long i;
+	unsigned char level;
+	int group_cnt, g, slot;
+	bool replicated;
+
+	if ((root->head.next != &root->tail) || (cnt == 0))
+		return (cnt == 0) ? 0 : -1;
+	for (i = 0; i < cnt; i++) {
+		if (is_fault_index(extents[i].offset, root->key_size) || (extents[i].length > max_extent_length(root->key_size, extents[i].offset)))
+			return -1;
+		if ((i > 0) && (extents[i - 1].offset + extents[i - 1].length > extents[i].offset ||
+				extents[i - 1].offset == extents[i].offset))
+			return -1;
+	}
+	if ((thread_cnt < 1) || (cnt < BULK_THREAD_MIN_EXTENTS))
+		thread_cnt = 1;
+
+	if (root->dir != NULL) {
+		// Subtrees of the directory are built as groups, and published once the leaf list is in place.
+		dir_groups = (struct bulk_load_group *)malloc(((cnt < RADIX_DIR_SIZE) ? cnt : RADIX_DIR_SIZE) * sizeof(struct bulk_load_group));
+		assert(dir_groups != NULL);
+		group_cnt = bulk_split_dir(extents, cnt, root->key_size, dir_groups);
+		bulk_build_groups(&ctx, dir_groups, group_cnt, cnt, thread_cnt);
+		ctx.first->prev = &root->head;
+		ctx.last->next = &root->tail;
+		root->head.next = ctx.first;
+		root->tail.prev = ctx.last;
+		for (g = 0; g < group_cnt; g++) {
+			slot = dir_index(extents[dir_groups[g].lo].offset, root->key_size);
+			dir_mark_used(root->dir, slot);
+			root_write_unlock(&root->dir->slots[slot], dir_groups[g].child);
+		}
+		free(dir_groups);
+		return 0;
+	}
+
+	if (thread_cnt == 1) {
+		node = bulk_build(&ctx, 0, cnt);
+		goto publish;
+	}
+
+	// Partition children of the root by key byte.
+	level = bulk_split_level(extents[0].offset, extents[cnt - 1].offset, root->key_size);
+	group_cnt = bulk_split_groups(extents, 0, cnt, level, root->key_size, groups);
+	bulk_build_groups(&ctx, groups, group_cnt, cnt, thread_cnt);
+	node = bulk_alloc_node(root, group_cnt, level, extents[0].offset);
+	for (g = 0; g < group_cnt; g++)
+		insert_child_force(node, groups[g].key, tag_node(groups[g].child));
+
+publish:
+	ctx.first->prev = &root->head;
+	ctx.last->next = &root->tail;
+	root->head.next = ctx.first;
+	root->tail.prev = ctx.last;
+	replicated = replica_write_begin(root, NULL);
+	root_write_unlock(&root->root_node, node);
+	replica_write_end(root, NULL, replicated);
+	return 0;
+}
@@ -4,11 +4,13 @@ extern "C"
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <limits.h>
+#include <assert.h>
 #include <pthread.h>
 
 #define RADIX_TREE_ENTRY_BIT_SIZE 8
-#define RADIX_TREE_HEIGHT 4 /* Starts from 0 */
+#define RADIX_TREE_HEIGHT 4 /* Starts from 0. Default for 40-bit keys, trees may use up to 64-bit keys. */
 #define RADIX_TREE_MAP_SIZE (1ULL<<RADIX_TREE_ENTRY_BIT_SIZE)
 #define RADIX_TREE_INDEX_SIZE (RADIX_TREE_MAP_SIZE / (sizeof(unsigned long long) * 8))
 #define RADIX_TREE_MAP_MASK (RADIX_TREE_MAP_SIZE - 1)
@@ -23,38 +25,53 @@ extern "C"
 #define barrier() asm volatile("": : :"memory")
 
 #define MOVE_BLOCK_SIZE (1UL<<12)
-#define MAX_TRANSACTION (1UL<<5) //32
 
 enum radix_tree_lookup_results {
 	RET_MATCH_NODE, /* Node with requested offset found. */
 	RET_PREV_NODE, /* Node offset is smaller than request but the node contains requested offset*/
 	RET_NEXT_NODE, /* Look up node does not exist, return next. */
 	ENOEXIST_RADIX, /* Look up node does not exist. */
-	EFAULT_RADIX /* Offset out of 40 bits boundary. */
+	EFAULT_RADIX /* Offset out of key space of the tree. */
 };
-enum node_types {LEAF_NODE, N4, N16, N48, N256};
+enum node_types {LEAF_NODE, N4, N8, N16, N32, N48, N256};
+#define NODE_TYPE_CNT (N256 + 1)
 
 #define N48_NO_ENT (50)
 #define BITS_PER_INDEX (sizeof(unsigned long long) * 8)
 #define INDEX_LE(INDEX, POS) (((INDEX) >> ((BITS_PER_INDEX - 1) - (POS)) << ((BITS_PER_INDEX - 1) - (POS))))
 #define INDEX_GE(INDEX, POS) (((INDEX) << (POS)) >> (POS))
+/* Prefix of INDEX above LEVEL of KEY_SIZE byte keys. Shifted in two halves, as the shift reaches 64 at level 0 of
+   64-bit keys. */
+#define index_prefix(INDEX, KEY_SIZE, LEVEL) \
+	(((INDEX) >> (((KEY_SIZE) - (LEVEL)) * (RADIX_TREE_ENTRY_BIT_SIZE / 2))) >> (((KEY_SIZE) - (LEVEL)) * (RADIX_TREE_ENTRY_BIT_SIZE / 2)))
+/* Return true if INDEX is out of the key space of KEY_SIZE byte keys. */
+static inline bool is_fault_index(unsigned long long index, unsigned char key_size) {
+	return index_prefix(index, key_size, 0) != 0;
+}
+
+/* Nodes are laid out for 64 byte lines, and the node allocator hands them out aligned to NODE_ALIGN. Header is 16 bytes,
+   N4 fits in one line and the first line of other nodes holds the header with the keys or the bitmap searched first. */
+#define NODE_ALIGN 64
 
 struct radix_tree_node {
 	unsigned char type;
 	unsigned char level;
 	unsigned char count;
+	unsigned char numa; /* NUMA node of the memory, stamped once per slab by the node allocator. */
+	unsigned int lock_n_obsolete; /* Version counter, bit 1 for lock and bit 0 for obsolete. */
 	unsigned long long offset;
-	unsigned long long lock_n_obsolete;
 };
 
+/* Every extent has a leaf, however small. The leaf list orders extents for scans and overlap trimming, and leaf locks
+   serialize writers over a range, so an extent cannot live in a parent slot alone. */
 struct radix_tree_leaf {
 	struct radix_tree_node node;
 	unsigned long long length;
 	int tx_id;
+	unsigned int lock; /* Futex word serializing writers over the leaf list. */
 	void *log_addr;
 	struct radix_tree_leaf *prev;
 	struct radix_tree_leaf *next;
-	pthread_mutex_t lock;
 };
 
 struct N4 {
@@ -63,31 +80,103 @@ struct N4 {
 	void* slots[4];
 };
 
+struct N8 {
+	struct radix_tree_node node;
+	unsigned char key[8];
+	void* slots[8];
+};
+
 struct N16 {
 	struct radix_tree_node node;
 	unsigned char key[16];
 	void* slots[16];
 };
 
+struct N32 {
+	struct radix_tree_node node;
+	unsigned char key[32];
+	void* slots[32];
+};
+
 struct N48 {
 	struct radix_tree_node node;
+	unsigned long long index[RADIX_TREE_INDEX_SIZE];
 	unsigned char key[256];
 	void* slots[48];
-	unsigned long long index[RADIX_TREE_INDEX_SIZE];
 };
 
 struct N256 {
 	struct radix_tree_node node;
-	void* slots[256];
 	unsigned long long index[RADIX_TREE_INDEX_SIZE];
+	void* slots[256];
+};
+
+static_assert(sizeof(struct radix_tree_node) == 16, "node header should be 16 bytes");
+static_assert(sizeof(struct radix_tree_leaf) <= NODE_ALIGN, "leaf should fit in a line");
+static_assert(sizeof(struct N4) <= NODE_ALIGN, "N4 should fit in a line");
+static_assert(offsetof(struct N8, slots) <= NODE_ALIGN, "N8 keys should share the line of the header");
+static_assert(offsetof(struct N16, slots) <= NODE_ALIGN, "N16 keys should share the line of the header");
+static_assert(offsetof(struct N32, slots) <= NODE_ALIGN, "N32 keys should share the line of the header");
+static_assert(offsetof(struct N48, key) + sizeof(((struct N48 *)0)->key) == offsetof(struct N48, slots), "N48 slots should follow the key map");
+static_assert(offsetof(struct N48, key) <= NODE_ALIGN, "N48 bitmap should share the line of the header");
+static_assert(offsetof(struct N256, slots) <= NODE_ALIGN, "N256 bitmap should share the line of the header");
+
+#define RADIX_NUMA_MAX 8
+
+/* Placement of nodes allocated for a tree. */
+enum radix_numa_policy {
+	RADIX_NUMA_FIRST_TOUCH, /* On the NUMA node of the allocating thread. Default. */
+	RADIX_NUMA_BIND, /* On one NUMA node. */
+};
+
+/* Direct-mapped table of subtrees by the top RADIX_DIR_BITS bits of keys, in place of the first two levels. Each slot
+   is the root pointer of a normal subtree, with its own lock bit. Slots that ever held a subtree are marked in USED,
+   and words of USED with a mark in USED_WORDS, to find neighbours of an empty slot. Marks are never cleared. */
+#define RADIX_DIR_BITS 16
+#define RADIX_DIR_SIZE (1 << RADIX_DIR_BITS)
+struct radix_tree_dir {
+	struct radix_tree_node *slots[RADIX_DIR_SIZE];
+	unsigned long long used[RADIX_DIR_SIZE / 64];
+	unsigned long long used_words[RADIX_DIR_SIZE / 64 / 64];
 };
 
 struct radix_tree_root {
 	struct radix_tree_node *root_node;
+	struct radix_tree_dir *dir; /* Replaces ROOT_NODE if not NULL. */
+	unsigned char key_size; /* Key width in bytes, which is also the level of leaves. */
+	unsigned char numa_policy;
+	unsigned char numa_node; /* Target of RADIX_NUMA_BIND. */
+	unsigned char numa_interleave_levels; /* Nodes of this many top levels are spread round robin over NUMA nodes. */
+	unsigned char replica_levels; /* Inner nodes above this level are copied per NUMA node for lookups, 0 for none. */
+	bool opaque_values; /* LOG_ADDR of leaves is a value, kept as is where an address would be advanced. */
+	struct radix_tree_node *replica[RADIX_NUMA_MAX]; /* Top of the copy for each NUMA node. */
+	/* Writes to replicated nodes started, and ended with copies updated. Lookups use copies while both are equal. */
+	unsigned long long replica_begin;
+	unsigned long long replica_end;
+	pthread_mutex_t replica_lock; /* Serializes copy updates. */
 	struct radix_tree_leaf head;
 	struct radix_tree_leaf tail;
 };
 
+/* Snapshot of a leaf, clipped to the requested range. */
+struct radix_tree_extent {
+	unsigned long long offset;
+	unsigned long long length;
+	void *log_addr;
+	int tx_id;
+};
+
+/* Iterator over extents in [pos, end). Holds an epoch guard between init and close. */
+struct radix_tree_cursor {
+	struct radix_tree_root *root;
+	struct radix_tree_leaf *leaf;
+	unsigned long long pos;
+	unsigned long long end;
+};
+
+/* Scan callback. Called with the leaf locked, so it should not modify the tree. Return non-zero to stop. */
+typedef int (*radix_tree_scan_fn)(const struct radix_tree_extent *extent, void *arg);
+
 struct radix_tree_node_list {
 	struct radix_tree_node *node;
 };
@@ -96,17 +185,218 @@ struct radix_tree_leaf_list {
 	struct radix_tree_leaf *leaf;
 };
 
+/* Per-thread state indexed by thread id. Grows by chunks on demand, elements never move. */
+#define PTHREAD_CHUNK_SHIFT 6
+#define PTHREAD_CHUNK_SIZE (1 << PTHREAD_CHUNK_SHIFT)
+#define PTHREAD_CHUNK_CNT 1024
+struct pthread_arr {
+	unsigned long long elem_size;
+	void *chunks[PTHREAD_CHUNK_CNT];
+};
+#define PTHREAD_ARR_INITIALIZER(TYPE) {sizeof(TYPE), {NULL, }}
+
+void *build_pthread_chunk(struct pthread_arr *arr, int idx);
+
+static inline void *get_pthread_elem(struct pthread_arr *arr, int tid) {
+	char *chunk = (char *)__atomic_load_n(&arr->chunks[tid >> PTHREAD_CHUNK_SHIFT], __ATOMIC_ACQUIRE);
+	if (chunk == NULL)
+		chunk = (char *)build_pthread_chunk(arr, tid >> PTHREAD_CHUNK_SHIFT);
+	return chunk + (tid & (PTHREAD_CHUNK_SIZE - 1)) * arr->elem_size;
+}
+
+/* Return NULL if element for TID has never been allocated. */
+static inline void *peek_pthread_elem(struct pthread_arr *arr, int tid) {
+	char *chunk = (char *)__atomic_load_n(&arr->chunks[tid >> PTHREAD_CHUNK_SHIFT], __ATOMIC_ACQUIRE);
+	if (chunk == NULL)
+		return NULL;
+	return chunk + (tid & (PTHREAD_CHUNK_SIZE - 1)) * arr->elem_size;
+}
+
+/* Threads are registered on first use and unregistered at exit. Explicit calls let thread pools release
+   per-thread state early. Ids of unregistered threads are reused. */
+int radix_thread_register(void);
+void radix_thread_unregister(void);
 int get_tid(void);
+int get_tid_cnt(void);
+void node_allocator_unregister(void);
+/* Node allocator. Pools are kept per NUMA node and freed nodes go back to the pools of their own NUMA node. */
+#define RADIX_NUMA_LOCAL (-1) /* NUMA node of the calling thread. */
+#define RADIX_NUMA_INTERLEAVE (-2) /* Round robin over NUMA nodes per thread. */
 int build_node(unsigned long long n, enum node_types type);
-struct radix_tree_node *get_node(enum node_types type);
+/* Allocate a node of TYPE on NUMA node NUMA, or one of RADIX_NUMA_LOCAL and RADIX_NUMA_INTERLEAVE. */
+struct radix_tree_node *get_node_on(enum node_types type, int numa);
+static inline struct radix_tree_node *get_node(enum node_types type) {
+	return get_node_on(type, RADIX_NUMA_LOCAL);
+}
 void return_node(struct radix_tree_node *new_node);
+/* NUMA node of the calling thread, refreshed now and then. */
+int get_thread_numa(void);
+int get_numa_cnt(void);
+void count_numa_access(int numa);
 
+/* Node search kernels for one instruction set. KEYS should be readable for 16 or 32 bytes. Callers mask match results by
+   node count. */
+struct node_search_ops {
+	const char *name;
+	/* Mask of lanes among the first 16 or 32 KEYS equal to KEY. */
+	unsigned int (*match_key16)(const unsigned char *keys, unsigned char key);
+	unsigned int (*match_key32)(const unsigned char *keys, unsigned char key);
+	/* Find the key closest to KEY among the first COUNT lanes of KEYS with non-NULL SLOTS, store its lane to POS and the
+	   key to RET_KEY, and return how it relates to KEY. Equal key is preferred, then the largest smaller key, then the
+	   smallest larger key. Keys are read before slots. All CAPACITY slots, a multiple of 4, may be read regardless of
+	   COUNT, so that slot loads do not wait for the count. */
+	enum radix_tree_lookup_results (*closest_key16)(const unsigned char *keys, void *const *slots, int capacity, int count,
+							unsigned char key, int *pos, unsigned char *ret_key);
+	enum radix_tree_lookup_results (*closest_key32)(const unsigned char *keys, void *const *slots, int capacity, int count,
+							unsigned char key, int *pos, unsigned char *ret_key);
+	/* Position of the first byte equal to VAL among 256 bytes of MAP, -1 if none. */
+	int (*find_byte256)(const unsigned char *map, unsigned char val);
+	/* Copy the 256 bit BITMAP of N48 or N256 to SNAPSHOT, in one load where the instruction set allows, and find the set
+	   bit closest to KEY other than KEY itself. The largest smaller key is preferred, then the smallest larger key. Store
+	   it to RET_KEY and return how it relates to KEY, or ENOEXIST_RADIX if no other bit is set. */
+	enum radix_tree_lookup_results (*closest_bit256)(const unsigned long long *bitmap, unsigned long long *snapshot,
+							 unsigned char key, unsigned char *ret_key);
+};
+extern struct node_search_ops radix_search_ops;
+/* Widest kernels the CPU supports if NAME is NULL. Return NULL for unknown or unsupported NAME. */
+const struct node_search_ops *get_node_search_ops(const char *name);
+void node_search_init(void);
+
+/* Epoch based reclamation. Nodes and leaves unlinked from a tree are retired and returned to the node allocator
+   once every thread has left the epoch they were retired in. Guards may be nested. Leaf pointers returned by
+   radix_tree_lookup() stay valid only until the enclosing radix_epoch_exit(). */
+void radix_epoch_enter(void);
+void radix_epoch_exit(void);
+void radix_epoch_retire(struct radix_tree_node *node);
+void radix_epoch_unregister(void);
+
+/* Building radix_tree.c and epoch.c with RADIX_SINGLE_THREAD gives the same API without locks or atomics, for trees
+   each used by a single thread only. Bulk load may still use helper threads. */
+/* Pick node search kernels and fill node pools. Only the first call does the work, so libraries may call it freely. */
 int radix_tree_init();
+/* Node search kernels are picked for the running CPU by radix_tree_init(), among "avx512", "avx2", "sse4.2" and "scalar".
+   Setting them is for benchmarks and should be done while no tree is in use. Return -1 if the CPU lacks support. */
+const char *radix_tree_search_kernel(void);
+int radix_tree_set_search_kernel(const char *name);
+/* Carve nodes from 2 MiB pages grouped by node type, to cut TLB misses on large trees. Reserved huge pages are used if
+   any, transparent huge pages otherwise. Applies to slabs built afterwards, so should be called before radix_tree_init(). */
+void radix_tree_set_huge_pages(bool enable);
+/* Bytes of node arenas mapped from reserved huge pages and advised for transparent huge pages. */
+void radix_tree_huge_page_stats(unsigned long long *hugetlb_bytes, unsigned long long *thp_bytes);
+/* Allocation and lookup counters per NUMA node. Lookups are counted only by radix_tree.c built with RADIX_NUMA_STATS. */
+struct radix_numa_stats {
+	int node_cnt;
+	unsigned long long alloc[RADIX_NUMA_MAX]; /* Nodes handed out from pools of each NUMA node. */
+	unsigned long long remote_alloc[RADIX_NUMA_MAX]; /* Of them, to threads running on another NUMA node. */
+	unsigned long long local_access[RADIX_NUMA_MAX]; /* Nodes visited by lookups of threads on each NUMA node, on the same one. */
+	unsigned long long remote_access[RADIX_NUMA_MAX]; /* Nodes visited by lookups of threads on each NUMA node, on other ones. */
+};
+void radix_tree_numa_stats(struct radix_numa_stats *stats);
+/* Writers restart when a node or leaf they read changes under them. Restarts back off for a random number of pauses,
+   up to MAX_BACKOFF pauses as they repeat, 0 for no backoff. An insert which restarts more than BUDGET times before
+   locking its leaves queues behind others stuck on the same node, -1 for never. Applies to all trees. */
+void radix_tree_set_contention(int budget, unsigned int max_backoff);
+struct radix_contention_stats {
+	unsigned long long restarts;
+	unsigned long long backoffs;
+	unsigned long long backoff_pauses;
+	unsigned long long fallbacks; /* Inserts over budget, which took the queue lock of the node. */
+	unsigned long long queued; /* Of them, those which waited behind others. */
+	unsigned long long spin_yields; /* Lock waits which gave up the CPU to a possibly preempted holder. */
+};
+/* Counters of writers, summed over threads. Always zero in the RADIX_SINGLE_THREAD build. */
+void radix_tree_contention_stats(struct radix_contention_stats *stats);
+/* Free the directory and the replicas of ROOT. Leaves should have been removed, which retires the nodes as well. */
 void radix_tree_destroy(struct radix_tree_root *root);
+/* Create tree with 40-bit keys. */
 void radix_tree_create(struct radix_tree_root *root);
+/* Create tree with KEY_BITS wide keys, one of 40, 48, 56 or 64. Return 0 for success, -1 for unsupported width. */
+int radix_tree_create_key_bits(struct radix_tree_root *root, int key_bits);
+/* Caller should hold an epoch guard while using the returned LEAF. */
 enum radix_tree_lookup_results radix_tree_lookup(struct radix_tree_root *root, unsigned long long index, struct radix_tree_leaf **leaf);
+/* Look up CNT INDEXES at once, storing each result to RESULTS and LEAVES as radix_tree_lookup() does.
+   Interleaves traversals to overlap cache misses. Caller should hold an epoch guard while using LEAVES. */
+void radix_tree_lookup_batch(struct radix_tree_root *root, const unsigned long long *indexes, int cnt,
+			     struct radix_tree_leaf **leaves, enum radix_tree_lookup_results *results);
+/* Look up INDEX like radix_tree_lookup(), validating node versions on the way, and copy the found leaf to EXTENT.
+   Takes no lock and needs no epoch guard from the caller. EXTENT is left untouched for ENOEXIST_RADIX and EFAULT_RADIX. */
+enum radix_tree_lookup_results radix_tree_lookup_extent(struct radix_tree_root *root, unsigned long long index, struct radix_tree_extent *extent);
 void radix_tree_insert(struct radix_tree_root *root, unsigned long long index, unsigned long long length, void *log_addr, int tx_id);
 void radix_tree_remove(struct radix_tree_root *root, struct radix_tree_leaf *leaf);
+/* Call FN for every extent overlapping [START, END) in offset order. Return the number of extents visited. */
+unsigned long long radix_tree_scan(struct radix_tree_root *root, unsigned long long start, unsigned long long end, radix_tree_scan_fn fn, void *arg);
+void radix_tree_cursor_init(struct radix_tree_cursor *cursor, struct radix_tree_root *root, unsigned long long start, unsigned long long end);
+bool radix_tree_cursor_next(struct radix_tree_cursor *cursor, struct radix_tree_extent *extent);
+void radix_tree_cursor_close(struct radix_tree_cursor *cursor);
+/* Place nodes of ROOT allocated from now on by POLICY, with NUMA_NODE the target of RADIX_NUMA_BIND. Nodes of the top
+   INTERLEAVE_LEVELS levels, which every lookup visits, are spread round robin over NUMA nodes instead, 0 for none.
+   Return -1 for an invalid NUMA_NODE or INTERLEAVE_LEVELS. */
+int radix_tree_set_numa_policy(struct radix_tree_root *root, enum radix_numa_policy policy, int numa_node, int interleave_levels);
+/* Keep a copy of the inner nodes of ROOT above key level LEVELS on every NUMA node, from which lookups of threads on that
+   NUMA node start, 0 to drop copies. Leaves and lower levels stay shared. Every write to a copied node recopies it, so
+   this suits trees whose upper levels have settled. ROOT should not be accessed concurrently. Return -1 for LEVELS not
+   below the key size, for a tree with a directory, and in the RADIX_SINGLE_THREAD build. */
+int radix_tree_set_replicas(struct radix_tree_root *root, int levels);
+/* Index ROOT by a table of 2^16 subtrees on the top two key bytes if ENABLE, so that operations skip two levels and
+   writes at the top of different subtrees do not contend on a single root. Costs 520KB per tree, and lookups of keys
+   in an empty subtree search the table for a neighbour. ROOT should be empty and not accessed concurrently. Return -1
+   otherwise, or if ROOT keeps replicas. */
+int radix_tree_set_directory(struct radix_tree_root *root, bool enable);
+/* Treat LOG_ADDR of ROOT as an opaque value if ENABLE. The pieces left of an extent trimmed or split by an overwrite,
+   and extents clipped by scans, then keep the value as is instead of advancing it along with the offset like an
+   address. ROOT should be empty. Return -1 otherwise. */
+int radix_tree_set_opaque_values(struct radix_tree_root *root, bool enable);
+/* Build ROOT bottom-up from EXTENTS sorted by offset and non-overlapping, using up to THREAD_CNT threads.
+   ROOT should be empty and not accessed concurrently. Return 0 for success, -1 for invalid input. */
+int radix_tree_bulk_load(struct radix_tree_root *root, const struct radix_tree_extent *extents, unsigned long long cnt, int thread_cnt);
+
+/* Forest of trees, each owning a shard of the key space selected by the top SHARD_BITS bits of keys. Shards are
+   independent trees with absolute keys, so each may be tuned on its own through radix_forest_shard_root(). An extent
+   that straddles shards is stored as one piece per shard. Operations are counted per shard and per thread. */
+#define RADIX_FOREST_MAX_SHARD_BITS 16
+struct radix_forest_stats {
+	unsigned long long inserts; /* Pieces inserted. */
+	unsigned long long removes;
+	unsigned long long lookups;
+	unsigned long long scanned; /* Pieces visited by scans. */
+};
+
+struct radix_forest {
+	struct radix_tree_root *shards;
+	int shard_cnt;
+	unsigned char key_size;
+	unsigned char shard_shift; /* Bits below the shard number. */
+	struct pthread_arr stats; /* SHARD_CNT radix_forest_stats per thread. */
+};
+
+/* Create FOREST of 2^SHARD_BITS trees with KEY_BITS wide keys. Return -1 for unsupported KEY_BITS or SHARD_BITS out of
+   1 to RADIX_FOREST_MAX_SHARD_BITS. */
+int radix_forest_create(struct radix_forest *forest, int key_bits, int shard_bits);
+/* Free trees and counters of FOREST. Leaves should have been removed, as for radix_tree_destroy(). */
+void radix_forest_destroy(struct radix_forest *forest);
+static inline int radix_forest_shard(struct radix_forest *forest, unsigned long long index) {
+	return (int)(index >> forest->shard_shift);
+}
+static inline struct radix_tree_root *radix_forest_shard_root(struct radix_forest *forest, int shard) {
+	return &forest->shards[shard];
+}
+/* Insert an extent, split at shard boundaries with LOG_ADDR advanced along each piece. */
+void radix_forest_insert(struct radix_forest *forest, unsigned long long index, unsigned long long length, void *log_addr, int tx_id);
+/* Look up INDEX as radix_tree_lookup() does, going on to following shards for the next leaf. LEAF is the piece in the
+   shard of its offset. Caller should hold an epoch guard while using LEAF. */
+enum radix_tree_lookup_results radix_forest_lookup(struct radix_forest *forest, unsigned long long index, struct radix_tree_leaf **leaf);
+/* Look up INDEX as radix_tree_lookup_extent() does, across shards as radix_forest_lookup() does. */
+enum radix_tree_lookup_results radix_forest_lookup_extent(struct radix_forest *forest, unsigned long long index, struct radix_tree_extent *extent);
+/* Remove LEAF found by radix_forest_lookup(). Other pieces of its extent, if any, stay in their shards. */
+void radix_forest_remove(struct radix_forest *forest, struct radix_tree_leaf *leaf);
+/* Call FN for every extent overlapping [START, END) in offset order, as radix_tree_scan() does. Pieces which meet at a
+   shard boundary and continue each other in LOG_ADDR and TX_ID are passed as one extent, after the shard scan of the
+   first piece has released its leaf. Return the number of extents passed to FN. */
+unsigned long long radix_forest_scan(struct radix_forest *forest, unsigned long long start, unsigned long long end, radix_tree_scan_fn fn, void *arg);
+/* Sum counters of SHARD over threads into STATS. */
+void radix_forest_shard_stats(struct radix_forest *forest, int shard, struct radix_forest_stats *stats);
+/* Count pieces stored in SHARD by walking it. */
+unsigned long long radix_forest_shard_extents(struct radix_forest *forest, int shard);
 
 #ifdef __cplusplus
 }
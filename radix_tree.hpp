@@ -0,0 +1,238 @@
+#ifndef RADIX_TREE_HPP
+#define RADIX_TREE_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include "radix_tree.h"
+
+/* Header-only C++ front end over the C tree. Key width is a template parameter, so key space checks fold to constants.
+   Lookups go through radix_tree_lookup() and radix_tree_lookup_extent(), which pick a traversal built for each key width
+   with its level loop unrolled. */
+namespace radix {
+
+/* RAII epoch guard. Leaf pointers and iterators are valid while a guard is alive. Guards may be nested. */
+class EpochGuard {
+public:
+	EpochGuard() {
+		radix_epoch_enter();
+	}
+	~EpochGuard() {
+		radix_epoch_exit();
+	}
+	EpochGuard(const EpochGuard &) = delete;
+	EpochGuard &operator=(const EpochGuard &) = delete;
+};
+
+/* Tree of extents keyed by KeyBits wide offsets. Value is copied into the leaf in place of log_addr, and the tree treats
+   it as opaque, so the pieces of an extent trimmed or split by an overwrite keep the value of the extent unchanged. */
+template <int KeyBits, typename Value>
+class RadixTree {
+	static_assert((KeyBits >= 40) && (KeyBits <= 64) && (KeyBits % RADIX_TREE_ENTRY_BIT_SIZE == 0), "key width should be one of 40, 48, 56 or 64");
+	static_assert(std::is_trivially_copyable_v<Value> && (sizeof(Value) <= sizeof(void *)),
+		      "value should be trivially copyable and fit in log_addr");
+
+public:
+	static constexpr int key_bits = KeyBits;
+	static constexpr int key_size = KeyBits / RADIX_TREE_ENTRY_BIT_SIZE;
+	static constexpr int fan_out = RADIX_TREE_MAP_SIZE;
+	static constexpr unsigned long long max_key = (KeyBits == 64) ? ULLONG_MAX : ((1ULL << (KeyBits % 64)) - 1);
+
+	/* Snapshot of an extent. */
+	struct Extent {
+		unsigned long long offset;
+		unsigned long long length;
+		Value value;
+		int tx_id;
+
+		bool contains(unsigned long long index) const {
+			return (offset <= index) && (index - offset < length);
+		}
+	};
+
+	/* Extents overlapping [start, end) in offset order, on top of radix_tree_cursor. Holds an epoch guard while alive. */
+	class Range {
+	public:
+		class iterator {
+		public:
+			using iterator_category = std::input_iterator_tag;
+			using value_type = Extent;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const Extent *;
+			using reference = const Extent &;
+
+			iterator() : range(nullptr) {}
+			explicit iterator(Range *range_) : range(range_) {
+				advance();
+			}
+			reference operator*() const {
+				return extent;
+			}
+			pointer operator->() const {
+				return &extent;
+			}
+			iterator &operator++() {
+				advance();
+				return *this;
+			}
+			bool operator==(const iterator &other) const {
+				return range == other.range;
+			}
+			bool operator!=(const iterator &other) const {
+				return range != other.range;
+			}
+
+		private:
+			Range *range;
+			Extent extent;
+
+			void advance() {
+				struct radix_tree_extent next;
+
+				if (radix_tree_cursor_next(&range->cursor, &next))
+					extent = to_extent(next);
+				else
+					range = nullptr;
+			}
+		};
+
+		Range(struct radix_tree_root *root, unsigned long long start, unsigned long long end) {
+			radix_tree_cursor_init(&cursor, root, start, end);
+		}
+		~Range() {
+			radix_tree_cursor_close(&cursor);
+		}
+		Range(const Range &) = delete;
+		Range &operator=(const Range &) = delete;
+
+		/* Cursor only moves forward, so begin() should be called once. */
+		iterator begin() {
+			return iterator(this);
+		}
+		iterator end() {
+			return iterator();
+		}
+
+	private:
+		struct radix_tree_cursor cursor;
+	};
+
+	RadixTree() {
+		radix_tree_init();
+		radix_tree_create_key_bits(&root, KeyBits);
+		radix_tree_set_opaque_values(&root, true);
+	}
+	/* radix_tree_destroy() does not free leaves and nodes, so extents are removed first and retired to the
+	   collector. */
+	~RadixTree() {
+		while (root.head.next != &root.tail)
+			radix_tree_remove(&root, root.head.next);
+		radix_tree_destroy(&root);
+	}
+	/* Leaves point back to sentinels inside the root, so the tree cannot move. */
+	RadixTree(const RadixTree &) = delete;
+	RadixTree &operator=(const RadixTree &) = delete;
+
+	static constexpr bool in_key_space(unsigned long long index) {
+		return (KeyBits == 64) || (index <= max_key);
+	}
+
+	/* Insert extent, overwriting overlapped ones. Return false if OFFSET is out of key space. */
+	bool insert(unsigned long long offset, unsigned long long length, Value value, int tx_id = 0) {
+		if (!in_key_space(offset))
+			return false;
+		radix_tree_insert(&root, offset, length, to_addr(value), tx_id);
+		return true;
+	}
+
+	/* Look up INDEX and store a consistent snapshot of the found extent to EXTENT, as radix_tree_lookup_extent() does. */
+	enum radix_tree_lookup_results lookup(unsigned long long index, Extent &extent) {
+		struct radix_tree_extent found;
+		enum radix_tree_lookup_results ret;
+
+		if (!in_key_space(index))
+			return EFAULT_RADIX;
+		if ((ret = radix_tree_lookup_extent(&root, index, &found)) < ENOEXIST_RADIX)
+			extent = to_extent(found);
+		return ret;
+	}
+
+	/* Return extent containing INDEX if any. */
+	std::optional<Extent> find(unsigned long long index) {
+		Extent extent;
+
+		switch (lookup(index, extent)) {
+			case RET_MATCH_NODE:
+			case RET_PREV_NODE:
+				return extent;
+			default:
+				return std::nullopt;
+		}
+	}
+
+	/* Remove extent starting at OFFSET. Return false if there is none. */
+	bool erase(unsigned long long offset) {
+		EpochGuard guard;
+		struct radix_tree_leaf *leaf;
+
+		if (!in_key_space(offset) || (radix_tree_lookup(&root, offset, &leaf) != RET_MATCH_NODE))
+			return false;
+		radix_tree_remove(&root, leaf);
+		return true;
+	}
+
+	Range extents(unsigned long long start = 0, unsigned long long end = ULLONG_MAX) {
+		return Range(&root, start, end);
+	}
+
+	/* Call FN with every extent overlapping [START, END) in offset order, until it returns true. Return the number of
+	   extents visited. FN is called with the leaf locked, so it should not modify the tree. */
+	template <typename Fn>
+	unsigned long long scan(unsigned long long start, unsigned long long end, Fn &&fn) {
+		auto trampoline = [](const struct radix_tree_extent *extent, void *arg) -> int {
+			return (*static_cast<std::remove_reference_t<Fn> *>(arg))(to_extent(*extent)) ? 1 : 0;
+		};
+		return radix_tree_scan(&root, start, end, trampoline, &fn);
+	}
+
+	/* Build empty tree from EXTENTS sorted by offset and non-overlapping. Return false for invalid input. */
+	bool bulk_load(const std::vector<Extent> &extents, int thread_cnt) {
+		std::vector<struct radix_tree_extent> raw(extents.size());
+
+		for (size_t i = 0; i < extents.size(); i++)
+			raw[i] = {extents[i].offset, extents[i].length, to_addr(extents[i].value), extents[i].tx_id};
+		return radix_tree_bulk_load(&root, raw.data(), raw.size(), thread_cnt) == 0;
+	}
+
+	struct radix_tree_root *c_root() {
+		return &root;
+	}
+
+private:
+	struct radix_tree_root root;
+
+	static void *to_addr(Value value) {
+		void *addr = nullptr;
+
+		std::memcpy(&addr, &value, sizeof(Value));
+		return addr;
+	}
+
+	static Value to_value(void *addr) {
+		Value value;
+
+		std::memcpy(&value, &addr, sizeof(Value));
+		return value;
+	}
+
+	static Extent to_extent(const struct radix_tree_extent &extent) {
+		return {extent.offset, extent.length, to_value(extent.log_addr), extent.tx_id};
+	}
+};
+
+}
+
+#endif
@@ -6,4 +6,16 @@ do
 	./mixed 1000000 >> mixed.out
 	./remove 10000000 100000000 >> remove.out
 	./overlap 10000000 >> overlap.out
+	./scan 10000000 >> scan.out
+	./bulk 10000000 >> bulk.out
+	./keys 1000000 >> keys.out
+	./single 1000000 >> single.out
+	./single_st 1000000 >> single_st.out
+	./cpp 1000000 >> cpp.out
+	./kernels 1000000 >> kernels.out
+	./huge 10000000 >> huge.out
+	./numa 10000000 >> numa.out
+	./dir 10000000 >> dir.out
+	./forest 10000000 >> forest.out
+	./contention 10000000 >> contention.out
 done
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <limits.h>
+
+#include "radix_tree.h"
+
+#define THREAD_CNT 16
+#define BATCH_SIZE 64
+
+#define GAP_MASK 0xFFFFULL // 64KB
+#define LEN_MASK 0xFFFULL // 4KB
+
+struct radix_tree_root root, insert_root;
+struct radix_tree_extent *extents;
+unsigned long long total_extents;
+
+static inline unsigned long long rand_ull(void) {
+	return ((((unsigned long long)rand()) << 32) | ((unsigned long long)rand()));
+}
+
+static inline double elapsed(struct timespec *begin, struct timespec *end) {
+	return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/* Overwrite random extents after bulk load to check the tree accepts regular operations. */
+void *thread_main(void *aux) {
+	unsigned long long ops = (unsigned long long)aux, i, j;
+	struct radix_tree_leaf *leaf;
+
+	for (i = 0; i < ops; i++) {
+		j = rand_ull() % total_extents;
+		radix_tree_insert(&root, extents[j].offset, extents[j].length, extents[j].log_addr, 1);
+		radix_epoch_enter();
+		if ((radix_tree_lookup(&root, extents[j].offset, &leaf) == RET_MATCH_NODE) &&
+				(leaf->log_addr != extents[j].log_addr)) {
+			printf("consistency check failed - overwrite\n");
+			exit(-1);
+		}
+		radix_epoch_exit();
+	}
+	return NULL;
+}
+
+/* Compare batched lookups of random offsets against single lookups, and return the time batched lookups took. */
+double check_batch_lookup(struct radix_tree_root *root) {
+	unsigned long long indexes[BATCH_SIZE], i, j, max_ofs = extents[total_extents - 1].offset + LEN_MASK + 1;
+	struct radix_tree_leaf *leaves[BATCH_SIZE], *leaf;
+	enum radix_tree_lookup_results results[BATCH_SIZE];
+	struct timespec begin, end;
+	double batch_time = 0;
+
+	for (i = 0; i < total_extents; i += BATCH_SIZE) {
+		for (j = 0; j < BATCH_SIZE; j++)
+			indexes[j] = (j == BATCH_SIZE - 1) ? ULLONG_MAX : rand_ull() % max_ofs;
+		radix_epoch_enter();
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		radix_tree_lookup_batch(root, indexes, BATCH_SIZE, leaves, results);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		batch_time += elapsed(&begin, &end);
+		for (j = 0; j < BATCH_SIZE; j++) {
+			if ((radix_tree_lookup(root, indexes[j], &leaf) != results[j]) || (leaf != leaves[j])) {
+				printf("batch lookup mismatch %llx\n", indexes[j]);
+				exit(-1);
+			}
+		}
+		radix_epoch_exit();
+	}
+	return batch_time;
+}
+
+unsigned long long check_inserted_leaf(struct radix_tree_root *root) {
+	struct radix_tree_leaf *leaf;
+	unsigned long long cnt = 0;
+
+	for (leaf = root->head.next; leaf != &root->tail; leaf = leaf->next) {
+		if ((leaf->node.offset != extents[cnt].offset) || (leaf->length != extents[cnt].length) ||
+				(leaf->next->prev != leaf))
+			return -1;
+		cnt++;
+	}
+	return cnt;
+}
+
+int main(int argc, char *argv[]) {
+	pthread_t threads[THREAD_CNT];
+	struct radix_tree_leaf *leaf;
+	struct timespec begin, end;
+	unsigned long long i, ofs = 0;
+	double bulk_time, insert_time, batch_time;
+
+	if (argc < 2) {
+		printf("input total extents\n");
+		return -1;
+	}
+	total_extents = atoll(argv[1]);
+	if ((total_extents == 0) || (total_extents > (1ULL << 24))) {
+		printf("wrong input\n");
+		return -1;
+	}
+
+	unsigned int seed = (unsigned int)time(NULL);
+	printf("seed: %u\n", seed);
+	fflush(stdout);
+	srand(seed);
+
+	extents = (struct radix_tree_extent *)malloc(total_extents * sizeof(struct radix_tree_extent));
+	for (i = 0; i < total_extents; i++) {
+		ofs += (rand_ull() & GAP_MASK) + LEN_MASK + 1;
+		extents[i].offset = ofs;
+		extents[i].length = (rand_ull() & LEN_MASK) + 1;
+		extents[i].log_addr = (void *)ofs;
+		extents[i].tx_id = 0;
+	}
+
+	radix_tree_init();
+	radix_tree_create(&root);
+	radix_tree_create(&insert_root);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	if (radix_tree_bulk_load(&root, extents, total_extents, THREAD_CNT) != 0) {
+		printf("bulk load failed\n");
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	bulk_time = elapsed(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < total_extents; i++)
+		radix_tree_insert(&insert_root, extents[i].offset, extents[i].length, extents[i].log_addr, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	insert_time = elapsed(&begin, &end);
+
+	if (check_inserted_leaf(&root) != total_extents) {
+		printf("leaf list check failed\n");
+		return -1;
+	}
+	for (i = 0; i < total_extents; i++) {
+		radix_epoch_enter();
+		if ((radix_tree_lookup(&root, extents[i].offset + extents[i].length - 1, &leaf) == RET_NEXT_NODE) ||
+				(leaf->node.offset != extents[i].offset)) {
+			printf("failed to lookup loaded key %llx\n", extents[i].offset);
+			return -1;
+		}
+		radix_epoch_exit();
+	}
+	batch_time = check_batch_lookup(&root);
+	if (radix_tree_bulk_load(&root, extents, total_extents, THREAD_CNT) != -1) {
+		printf("bulk load into non-empty tree succeeded\n");
+		return -1;
+	}
+
+	for (i = 0; i < THREAD_CNT; i++) {
+		if (pthread_create(&threads[i], NULL, &thread_main, (void *)(total_extents / THREAD_CNT))) {
+			printf("thread creation failed\n");
+			return -1;
+		}
+	}
+	for (i = 0; i < THREAD_CNT; i++)
+		pthread_join(threads[i], NULL);
+	if (check_inserted_leaf(&root) != total_extents) {
+		printf("leaf list check failed after overwrite\n");
+		return -1;
+	}
+
+	printf("bulk load: %.3fs, insert: %.3fs, batch lookup: %.3fs\n", bulk_time, insert_time, batch_time);
+	return 0;
+}
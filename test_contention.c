@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "radix_tree.h"
+
+#define THREAD_CNT 16
+#define OFS_MASK 0xFFFFFULL // 1MB, so that overlapping inserts keep hitting the same nodes and leaves.
+#define LEN_MASK 0xFFFFULL // 64KB
+
+struct radix_tree_root root;
+unsigned long long ops_per_thread;
+unsigned long long *latencies; /* Nanoseconds per insert, OPS_PER_THREAD for each thread. */
+unsigned int seed;
+
+static inline unsigned long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void *insert_thread(void *aux) {
+	unsigned long long tid = (unsigned long long)aux, i, ofs, len, begin;
+	unsigned int thread_seed = seed + tid;
+
+	for (i = 0; i < ops_per_thread; i++) {
+		ofs = rand_r(&thread_seed) & OFS_MASK;
+		len = (rand_r(&thread_seed) & LEN_MASK) + 1;
+		begin = now_ns();
+		radix_tree_insert(&root, ofs, len, (void *)ofs, tid);
+		latencies[tid * ops_per_thread + i] = now_ns() - begin;
+	}
+	radix_thread_unregister();
+	return NULL;
+}
+
+/* Leaves should be sorted, disjoint and linked both ways. */
+static unsigned long long check_leaves(void) {
+	struct radix_tree_leaf *leaf;
+	unsigned long long cnt = 0;
+
+	for (leaf = root.head.next; leaf != &root.tail; leaf = leaf->next, cnt++) {
+		if ((leaf->length == 0) || (leaf->next->prev != leaf) ||
+		    ((leaf->next != &root.tail) && (leaf->node.offset + leaf->length > leaf->next->node.offset))) {
+			printf("broken leaf %llx+%llx\n", leaf->node.offset, leaf->length);
+			exit(-1);
+		}
+	}
+	return cnt;
+}
+
+static int cmp_ull(const void *a, const void *b) {
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Run overlapping inserts in a fresh process, so that modes do not share warmed pools. */
+static void run(const char *name, int budget, unsigned int max_backoff) {
+	unsigned long long total = ops_per_thread * THREAD_CNT, begin, end, t, leaves;
+	struct radix_contention_stats stats;
+	pthread_t threads[THREAD_CNT];
+
+	radix_tree_set_contention(budget, max_backoff);
+	radix_tree_init();
+	radix_tree_create(&root);
+
+	begin = now_ns();
+	for (t = 0; t < THREAD_CNT; t++)
+		pthread_create(&threads[t], NULL, insert_thread, (void *)t);
+	for (t = 0; t < THREAD_CNT; t++)
+		pthread_join(threads[t], NULL);
+	end = now_ns();
+
+	leaves = check_leaves();
+	radix_tree_contention_stats(&stats);
+	if ((stats.fallbacks > stats.restarts) || (stats.queued > stats.fallbacks) || (stats.backoffs > stats.restarts) ||
+	    ((budget < 0) && stats.fallbacks) || ((max_backoff == 0) && stats.backoffs)) {
+		printf("%s: counters do not match the settings\n", name);
+		exit(-1);
+	}
+	qsort(latencies, total, sizeof(unsigned long long), cmp_ull);
+	printf("%s: %.3fs, p50 %.1fus, p99 %.1fus, p99.9 %.1fus, max %.1fus, %llu leaves\n", name, (end - begin) / 1e9,
+	       latencies[total / 2] / 1e3, latencies[total * 99 / 100] / 1e3, latencies[total * 999 / 1000] / 1e3,
+	       latencies[total - 1] / 1e3, leaves);
+	printf("  restarts %llu, backoffs %llu (%llu pauses), fallbacks %llu (queued %llu), spin yields %llu\n", stats.restarts,
+	       stats.backoffs, stats.backoff_pauses, stats.fallbacks, stats.queued, stats.spin_yields);
+}
+
+int main(int argc, char *argv[]) {
+	static const struct {
+		const char *name;
+		int budget;
+		unsigned int max_backoff;
+	} modes[] = {
+		{"unmanaged", -1, 0},
+		{"backoff", -1, 1024},
+		{"adaptive", 8, 1024},
+		{"queue", 0, 1024}, // Every restart before leaves are locked queues.
+	};
+	int mode, status;
+	pid_t pid;
+
+	if (argc < 2) {
+		printf("input total ops\n");
+		return -1;
+	}
+	ops_per_thread = atoll(argv[1]) / THREAD_CNT;
+	if (ops_per_thread == 0) {
+		printf("wrong input\n");
+		return -1;
+	}
+
+	seed = (unsigned int)time(NULL);
+	printf("seed: %u\n", seed);
+	fflush(stdout);
+	latencies = (unsigned long long *)malloc(ops_per_thread * THREAD_CNT * sizeof(unsigned long long));
+
+	for (mode = 0; mode < sizeof(modes) / sizeof(modes[0]); mode++) {
+		if ((pid = fork()) == 0) {
+			run(modes[mode].name, modes[mode].budget, modes[mode].max_backoff);
+			fflush(stdout);
+			_exit(0);
+		}
+		if ((pid < 0) || (waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+			printf("%s run failed\n", modes[mode].name);
+			return -1;
+		}
+	}
+
+	free(latencies);
+	return 0;
+}
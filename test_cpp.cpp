@@ -0,0 +1,196 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <climits>
+#include <vector>
+
+#include "radix_tree.hpp"
+
+#define OFS_MASK 0xFFFFFFF000ULL // 4KB aligned in 40-bit key space
+#define EXTENT_SIZE 0x1000ULL // 4KB
+
+using Tree = radix::RadixTree<40, unsigned long long>;
+
+unsigned long long *keys;
+unsigned long long total_ops;
+
+static inline unsigned long long rand_ull(void) {
+	return ((((unsigned long long)rand()) << 32) | ((unsigned long long)rand()));
+}
+
+static inline double elapsed(struct timespec *begin, struct timespec *end) {
+	return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+static void fail(const char *msg, unsigned long long key) {
+	printf("%s: %llx\n", msg, key);
+	exit(-1);
+}
+
+/* Insert and look up KEYS through the C API. Return elapsed time. */
+double run_c(void) {
+	struct radix_tree_root root;
+	struct radix_tree_extent extent;
+	struct timespec begin, end;
+	unsigned long long i;
+
+	radix_tree_create(&root);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < total_ops; i++)
+		radix_tree_insert(&root, keys[i], EXTENT_SIZE, (void *)keys[i], 0);
+	for (i = 0; i < total_ops; i++) {
+		if ((radix_tree_lookup_extent(&root, keys[i] + (EXTENT_SIZE / 2), &extent) != RET_PREV_NODE) ||
+		    (extent.log_addr != (void *)keys[i]))
+			fail("c: failed to lookup inserted key", keys[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	radix_tree_destroy(&root);
+	return elapsed(&begin, &end);
+}
+
+/* Same workload through the wrapper. */
+double run_cpp(void) {
+	Tree tree;
+	struct timespec begin, end;
+	unsigned long long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < total_ops; i++)
+		tree.insert(keys[i], EXTENT_SIZE, keys[i]);
+	for (i = 0; i < total_ops; i++) {
+		auto extent = tree.find(keys[i] + (EXTENT_SIZE / 2));
+
+		if (!extent || (extent->offset != keys[i]) || (extent->value != keys[i]))
+			fail("c++: failed to lookup inserted key", keys[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return elapsed(&begin, &end);
+}
+
+/* Iterators, values kept on overwrite, erase and scan. */
+void check_tree(void) {
+	Tree tree;
+	unsigned long long i, cnt = 0, last_end = 0, scanned;
+	std::vector<unsigned long long> offsets;
+
+	// Values are opaque, so both pieces of a split extent and clipped scans keep the value of the extent.
+	tree.insert(0, EXTENT_SIZE * 4, 7);
+	tree.insert(EXTENT_SIZE, EXTENT_SIZE, 9);
+	auto head = tree.find(0), split = tree.find(EXTENT_SIZE * 3);
+	if (!head || (head->length != EXTENT_SIZE) || (head->value != 7))
+		fail("trimmed value check failed", head ? head->value : 0);
+	if (!split || (split->offset != EXTENT_SIZE * 2) || (split->length != EXTENT_SIZE * 2) || (split->value != 7))
+		fail("split value check failed", split ? split->value : 0);
+	scanned = tree.scan(EXTENT_SIZE * 3, EXTENT_SIZE * 4, [](const Tree::Extent &extent) {
+		return (extent.offset != EXTENT_SIZE * 3) || (extent.value != 7);
+	});
+	if (scanned != 1)
+		fail("clipped scan changed value", scanned);
+	for (i = 0; i < 3; i++) {
+		if (!tree.erase(EXTENT_SIZE * i))
+			fail("failed to erase split extent", EXTENT_SIZE * i);
+	}
+
+	for (i = 0; i < total_ops; i++)
+		tree.insert(keys[i], EXTENT_SIZE, keys[i]);
+	for (auto &extent : tree.extents()) {
+		if ((cnt && (extent.offset < last_end)) || (extent.value != extent.offset))
+			fail("iterator check failed", extent.offset);
+		last_end = extent.offset + extent.length;
+		offsets.push_back(extent.offset);
+		cnt++;
+	}
+	scanned = tree.scan(0, ULLONG_MAX, [](const Tree::Extent &extent) {
+		return extent.value != extent.offset;
+	});
+	if (scanned != cnt)
+		fail("scan count mismatch", scanned);
+
+	for (auto offset : offsets) {
+		if (!tree.erase(offset))
+			fail("failed to erase", offset);
+	}
+	if (tree.extents().begin() != tree.extents().end())
+		fail("erase check failed", 0);
+}
+
+/* Pointer values, key space check and bulk load on a wider key. */
+void check_wide_tree(void) {
+	radix::RadixTree<48, char *> tree;
+	std::vector<radix::RadixTree<48, char *>::Extent> extents;
+	radix::RadixTree<48, char *>::Extent found;
+	static char buf[EXTENT_SIZE * 16];
+	unsigned long long i;
+
+	static_assert(decltype(tree)::key_size == 6);
+	static_assert(!decltype(tree)::in_key_space(1ULL << 48));
+	if (tree.insert(1ULL << 48, EXTENT_SIZE, buf) || (tree.lookup(1ULL << 48, found) != EFAULT_RADIX))
+		fail("insert out of key space succeeded", 1ULL << 48);
+
+	for (i = 0; i < 16; i++)
+		extents.push_back({i << 40, EXTENT_SIZE, buf + i * EXTENT_SIZE, 0});
+	if (!tree.bulk_load(extents, 4))
+		fail("bulk load failed", 0);
+
+	radix::EpochGuard guard;
+	for (i = 0; i < 16; i++) {
+		auto extent = tree.find((i << 40) + 8);
+
+		if (!extent || (extent->value != buf + i * EXTENT_SIZE))
+			fail("failed to lookup bulk loaded key", i << 40);
+	}
+}
+
+/* Small struct values, stored inline and kept by the pieces of an overwritten extent. */
+struct Handle {
+	unsigned int id;
+	unsigned short gen;
+};
+
+void check_struct_tree(void) {
+	radix::RadixTree<56, Handle> tree;
+
+	tree.insert(0, EXTENT_SIZE * 3, {42, 3});
+	tree.insert(EXTENT_SIZE, EXTENT_SIZE, {43, 1});
+	for (unsigned long long i = 0; i < 3; i++) {
+		auto extent = tree.find(EXTENT_SIZE * i);
+
+		if (!extent || (extent->value.id != ((i == 1) ? 43U : 42U)) || (extent->value.gen != ((i == 1) ? 1 : 3)))
+			fail("struct value check failed", EXTENT_SIZE * i);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	double c_time, cpp_time;
+	unsigned long long i;
+
+	if (argc < 2) {
+		printf("input total ops\n");
+		return -1;
+	}
+	total_ops = atoll(argv[1]);
+	if (total_ops == 0) {
+		printf("wrong input\n");
+		return -1;
+	}
+
+	unsigned int seed = (unsigned int)time(NULL);
+	printf("seed: %u\n", seed);
+	fflush(stdout);
+	srand(seed);
+
+	keys = (unsigned long long *)malloc(total_ops * sizeof(unsigned long long));
+	for (i = 0; i < total_ops; i++)
+		keys[i] = rand_ull() & OFS_MASK;
+
+	radix_tree_init();
+	check_tree();
+	check_wide_tree();
+	check_struct_tree();
+	c_time = run_c();
+	cpp_time = run_cpp();
+
+	printf("c: %.3fs, c++: %.3fs\n", c_time, cpp_time);
+	free(keys);
+	return 0;
+}
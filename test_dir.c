@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "radix_tree.h"
+
+#define THREAD_CNT 32
+#define EXTENT_SIZE 0x1000ULL // 4KB
+#define EXTENT_MASK ((1ULL << 28) - 1) // Extents in 40-bit key space
+#define SPREAD 0x9E3779B1ULL // Odd, so that keys of distinct extents differ
+#define RETRY_CNT 1000
+#define SPARSE_CNT 4096
+#define PROBE_CNT 100000
+
+struct radix_tree_root root;
+unsigned long long total_ops;
+int key_bits;
+
+/* Extents of the sparse check, sorted and disjoint, with PRESENT telling which are in the tree. */
+struct radix_tree_extent model[SPARSE_CNT];
+bool present[SPARSE_CNT];
+
+static inline unsigned long long rand_ull(void) {
+	return ((((unsigned long long)rand()) << 33) ^ (((unsigned long long)rand()) << 12) ^ ((unsigned long long)rand()));
+}
+
+static inline double elapsed(struct timespec *begin, struct timespec *end) {
+	return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+static inline unsigned long long key_mask(void) {
+	return (key_bits == 64) ? ULLONG_MAX : (1ULL << key_bits) - 1;
+}
+
+static void create(bool dir) {
+	radix_tree_create_key_bits(&root, key_bits);
+	if (radix_tree_set_directory(&root, dir) != 0) {
+		printf("failed to set directory\n");
+		exit(-1);
+	}
+}
+
+static unsigned long long count_leaves(void) {
+	struct radix_tree_leaf *leaf;
+	unsigned long long cnt = 0;
+
+	for (leaf = root.head.next; leaf != &root.tail; leaf = leaf->next, cnt++) {
+		if ((leaf->next != &root.tail) && (leaf->node.offset + leaf->length > leaf->next->node.offset)) {
+			printf("leaves %llx and %llx out of order\n", leaf->node.offset, leaf->next->node.offset);
+			exit(-1);
+		}
+		if (leaf->next->prev != leaf) {
+			printf("leaf %llx has broken links\n", leaf->node.offset);
+			exit(-1);
+		}
+	}
+	return cnt;
+}
+
+/* Look up KEY inserted by the caller, under an epoch guard the caller should exit. Plain lookups may miss a leaf while
+   others write nearby, so they are tried again before giving up. */
+static enum radix_tree_lookup_results lookup_retry(unsigned long long key, struct radix_tree_leaf **leaf) {
+	enum radix_tree_lookup_results ret;
+	int i;
+
+	radix_epoch_enter();
+	for (i = 0; ((ret = radix_tree_lookup(&root, key, leaf)) != RET_MATCH_NODE) && (i < RETRY_CNT); i++);
+	return ret;
+}
+
+/* Each thread inserts keys of its own and looks them up, then removes them, like test_isolated with removes. */
+void *isolated_thread(void *aux) {
+	unsigned long long tid = (unsigned long long)aux, ops = total_ops / THREAD_CNT, *keys, i;
+	struct radix_tree_leaf *leaf;
+
+	keys = (unsigned long long *)malloc(ops * sizeof(unsigned long long));
+	for (i = 0; i < ops; i++) {
+		keys[i] = (((i * THREAD_CNT + tid) * SPREAD) & EXTENT_MASK) * EXTENT_SIZE;
+		radix_tree_insert(&root, keys[i], 0, (void *)keys[i], 0);
+	}
+	for (i = 0; i < ops; i++) {
+		if ((lookup_retry(keys[i], &leaf) != RET_MATCH_NODE) || (leaf->log_addr != (void *)keys[i])) {
+			printf("failed to lookup inserted key %llx\n", keys[i]);
+			exit(-1);
+		}
+		radix_epoch_exit();
+	}
+	for (i = 0; i < ops; i++) {
+		if (lookup_retry(keys[i], &leaf) != RET_MATCH_NODE) {
+			printf("failed to lookup key %llx to remove\n", keys[i]);
+			exit(-1);
+		}
+		radix_tree_remove(&root, leaf);
+		radix_epoch_exit();
+	}
+	free(keys);
+	radix_thread_unregister();
+	return NULL;
+}
+
+/* Time threads of isolated_thread() in a fresh process, so that node pools of both modes do not mix. */
+static void run_isolated(bool dir) {
+	pthread_t threads[THREAD_CNT];
+	struct timespec begin, end;
+	unsigned long long t;
+	int status;
+	pid_t pid;
+
+	if ((pid = fork()) != 0) {
+		if ((pid < 0) || (waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+			printf("%s run failed\n", dir ? "directory" : "plain");
+			exit(-1);
+		}
+		return;
+	}
+
+	key_bits = 40;
+	create(dir);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (t = 0; t < THREAD_CNT; t++)
+		pthread_create(&threads[t], NULL, isolated_thread, (void *)t);
+	for (t = 0; t < THREAD_CNT; t++)
+		pthread_join(threads[t], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (count_leaves() != 0) {
+		printf("%s: leaves left after removes\n", dir ? "directory" : "plain");
+		exit(-1);
+	}
+	printf("%s: %.3fs\n", dir ? "directory" : "plain", elapsed(&begin, &end));
+	fflush(stdout);
+	radix_tree_destroy(&root);
+	_exit(0);
+}
+
+static int cmp_extent(const void *a, const void *b) {
+	unsigned long long x = ((const struct radix_tree_extent *)a)->offset, y = ((const struct radix_tree_extent *)b)->offset;
+
+	return (x > y) - (x < y);
+}
+
+/* Sorted disjoint extents scattered over the key space, clustered in a few top bytes once in a while, so that most
+   subtrees of the directory are empty and some extents cross into the next subtree. */
+static void build_model(void) {
+	unsigned long long gap, i;
+
+	for (i = 0; i < SPARSE_CNT; i++) {
+		model[i].offset = (rand_ull() ^ (rand_ull() << 24)) & key_mask();
+		if (rand() % 4 == 0)
+			model[i].offset &= ~(0xFFULL << (key_bits - 8));
+	}
+	qsort(model, SPARSE_CNT, sizeof(model[0]), cmp_extent);
+	for (i = 0; i < SPARSE_CNT; i++) {
+		gap = (i + 1 < SPARSE_CNT) ? model[i + 1].offset - model[i].offset : key_mask() - model[i].offset;
+		// Duplicates get no room, and are dropped with the last extent if it would reach the end.
+		model[i].length = (gap <= 1) ? 0 : 1 + rand_ull() % (gap - 1);
+		if ((rand() % 2) && (model[i].length > EXTENT_SIZE))
+			model[i].length = EXTENT_SIZE;
+		model[i].log_addr = (void *)model[i].offset;
+		model[i].tx_id = 0;
+		present[i] = (model[i].length != 0);
+	}
+}
+
+/* Expected lookup of INDEX from the model. */
+static enum radix_tree_lookup_results expect(unsigned long long index, struct radix_tree_extent **extent) {
+	int lo = 0, hi = SPARSE_CNT, mid, i;
+
+	// First extent starting after INDEX.
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (model[mid].offset <= index)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (i = lo - 1; (i >= 0) && !present[i]; i--);
+	if ((i >= 0) && (model[i].offset + model[i].length > index)) {
+		*extent = &model[i];
+		return (model[i].offset == index) ? RET_MATCH_NODE : RET_PREV_NODE;
+	}
+	for (i = lo; (i < SPARSE_CNT) && !present[i]; i++);
+	if (i == SPARSE_CNT)
+		return ENOEXIST_RADIX;
+	*extent = &model[i];
+	return RET_NEXT_NODE;
+}
+
+/* Probe INDEX through every lookup entry point against the model. */
+static void check_index(unsigned long long index) {
+	struct radix_tree_extent *expected = NULL, extent;
+	enum radix_tree_lookup_results ret, results[1];
+	struct radix_tree_leaf *leaf, *leaves[1];
+
+	if (index > key_mask())
+		return;
+	ret = expect(index, &expected);
+	radix_epoch_enter();
+	if ((radix_tree_lookup(&root, index, &leaf) != ret) || ((ret != ENOEXIST_RADIX) && (leaf->node.offset != expected->offset))) {
+		printf("lookup %llx (%d bits) differs from model, expected %d\n", index, key_bits, ret);
+		exit(-1);
+	}
+	radix_tree_lookup_batch(&root, &index, 1, leaves, results);
+	if ((results[0] != ret) || ((ret != ENOEXIST_RADIX) && (leaves[0]->node.offset != expected->offset))) {
+		printf("batch lookup %llx (%d bits) differs from model, expected %d\n", index, key_bits, ret);
+		exit(-1);
+	}
+	radix_epoch_exit();
+	if ((radix_tree_lookup_extent(&root, index, &extent) != ret) || ((ret != ENOEXIST_RADIX) && (extent.offset != expected->offset))) {
+		printf("extent lookup %llx (%d bits) differs from model, expected %d\n", index, key_bits, ret);
+		exit(-1);
+	}
+}
+
+static int count_extent(const struct radix_tree_extent *extent, void *arg) {
+	(*(unsigned long long *)arg)++;
+	return 0;
+}
+
+static void check_model(const char *stage) {
+	unsigned long long i, cnt = 0, scanned = 0;
+
+	for (i = 0; i < SPARSE_CNT; i++) {
+		cnt += present[i];
+		if (present[i]) {
+			check_index(model[i].offset);
+			check_index(model[i].offset + model[i].length - 1);
+			check_index(model[i].offset + model[i].length);
+			check_index(model[i].offset - 1);
+		}
+	}
+	for (i = 0; i < PROBE_CNT; i++)
+		check_index(rand_ull() & key_mask());
+	if (count_leaves() != cnt) {
+		printf("%s: leaf list differs from model\n", stage);
+		exit(-1);
+	}
+	radix_tree_scan(&root, 0, ULLONG_MAX, count_extent, &scanned);
+	if (scanned != cnt) {
+		printf("%s: scanned %llu extents, expected %llu\n", stage, scanned, cnt);
+		exit(-1);
+	}
+}
+
+/* Sparse extents in a tree with directory, inserted, removed and bulk loaded, checked against the model. */
+static void check_sparse(void) {
+	struct radix_tree_extent *bulk, *expected;
+	struct radix_tree_leaf *leaf;
+	unsigned long long i, j, cnt;
+	int order[SPARSE_CNT];
+
+	build_model();
+	create(true);
+	for (i = 0; i < SPARSE_CNT; i++)
+		order[i] = i;
+	for (i = SPARSE_CNT - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		int tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for (i = 0; i < SPARSE_CNT; i++) {
+		if (present[order[i]])
+			radix_tree_insert(&root, model[order[i]].offset, model[order[i]].length, model[order[i]].log_addr, 0);
+	}
+	check_model("insert");
+
+	for (i = 0; i < SPARSE_CNT; i += 2) {
+		if (!present[order[i]])
+			continue;
+		radix_epoch_enter();
+		if (radix_tree_lookup(&root, model[order[i]].offset, &leaf) != RET_MATCH_NODE) {
+			printf("failed to lookup extent %llx to remove\n", model[order[i]].offset);
+			exit(-1);
+		}
+		radix_tree_remove(&root, leaf);
+		radix_epoch_exit();
+		present[order[i]] = false;
+	}
+	check_model("remove");
+
+	// Overwriting an extent over many subtrees removes leaves of all of them.
+	if ((expect(model[SPARSE_CNT / 4].offset, &expected) != ENOEXIST_RADIX) && (expected->offset < model[SPARSE_CNT * 3 / 4].offset)) {
+		unsigned long long begin = expected->offset, end = model[SPARSE_CNT * 3 / 4].offset;
+		radix_tree_insert(&root, begin, end - begin, (void *)begin, 0);
+		for (i = expected - model; (i < SPARSE_CNT) && (model[i].offset < end); i++)
+			present[i] = false;
+		model[expected - model].length = end - begin;
+		present[expected - model] = true;
+		check_model("overwrite");
+	}
+	if (radix_tree_set_directory(&root, false) == 0) {
+		printf("directory of non-empty tree dropped\n");
+		exit(-1);
+	}
+	if (radix_tree_set_replicas(&root, 1) == 0) {
+		printf("replicas accepted with directory\n");
+		exit(-1);
+	}
+	radix_tree_destroy(&root);
+
+	// Bulk load of what is left.
+	bulk = (struct radix_tree_extent *)malloc(SPARSE_CNT * sizeof(*bulk));
+	for (i = 0, cnt = 0; i < SPARSE_CNT; i++) {
+		if (present[i])
+			bulk[cnt++] = model[i];
+	}
+	create(true);
+	if (radix_tree_bulk_load(&root, bulk, cnt, 4) != 0) {
+		printf("bulk load with directory failed\n");
+		exit(-1);
+	}
+	check_model("bulk load");
+	free(bulk);
+	radix_tree_destroy(&root);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("input total ops\n");
+		return -1;
+	}
+	total_ops = atoll(argv[1]);
+	if (total_ops == 0) {
+		printf("wrong input\n");
+		return -1;
+	}
+	if (total_ops > EXTENT_MASK + 1) {
+		printf("too many ops\n");
+		return -1;
+	}
+
+	unsigned int seed = (unsigned int)time(NULL);
+	printf("seed: %u\n", seed);
+	fflush(stdout);
+	srand(seed);
+
+	radix_tree_init();
+	for (key_bits = 40; key_bits <= 64; key_bits += 24)
+		check_sparse();
+	run_isolated(false);
+	run_isolated(true);
+	return 0;
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <limits.h>
+
+#include "radix_tree.h"
+
+#define THREAD_CNT 16
+#define SHARD_BITS 8
+#define EXTENT_SIZE 0x1000ULL // 4KB
+#define KEY_STRIDE (4 * EXTENT_SIZE) // Extents leave gaps, where extents over shard boundaries fit.
+#define EXTENT_MASK ((1ULL << 26) - 1) // Extents in 40-bit key space
+#define SPREAD 0x9E3779B1ULL // Odd, so that keys of distinct extents differ
+#define RETRY_CNT 1000
+
+struct radix_forest forest;
+unsigned long long *keys;
+unsigned long long total_ops;
+
+static inline double elapsed(struct timespec *begin, struct timespec *end) {
+	return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+static inline unsigned long long shard_base(int shard) {
+	return (unsigned long long)shard << forest.shard_shift;
+}
+
+static double run_threads(void *(*fn)(void *)) {
+	pthread_t threads[THREAD_CNT];
+	struct timespec begin, end;
+	unsigned long long t;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (t = 0; t < THREAD_CNT; t++)
+		pthread_create(&threads[t], NULL, fn, (void *)t);
+	for (t = 0; t < THREAD_CNT; t++)
+		pthread_join(threads[t], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return elapsed(&begin, &end);
+}
+
+void *insert_thread(void *arg) {
+	unsigned long long tid = (unsigned long long)arg, i;
+
+	for (i = tid; i < total_ops; i += THREAD_CNT)
+		radix_forest_insert(&forest, keys[i], EXTENT_SIZE, (void *)keys[i], 0);
+	radix_thread_unregister();
+	return NULL;
+}
+
+void *lookup_thread(void *arg) {
+	unsigned long long tid = (unsigned long long)arg, i;
+	struct radix_tree_extent extent;
+
+	for (i = tid; i < total_ops; i += THREAD_CNT) {
+		if ((radix_forest_lookup_extent(&forest, keys[i] + (EXTENT_SIZE / 2), &extent) != RET_PREV_NODE) ||
+		    (extent.log_addr != (void *)keys[i])) {
+			printf("failed to lookup inserted key %llx\n", keys[i]);
+			exit(-1);
+		}
+	}
+	radix_thread_unregister();
+	return NULL;
+}
+
+/* Plain lookups may miss a leaf while others write nearby, so they are tried again before giving up. */
+void *remove_thread(void *arg) {
+	unsigned long long tid = (unsigned long long)arg, i;
+	struct radix_tree_leaf *leaf;
+	int j;
+
+	for (i = tid; i < total_ops; i += THREAD_CNT) {
+		radix_epoch_enter();
+		for (j = 0; (radix_forest_lookup(&forest, keys[i], &leaf) != RET_MATCH_NODE) && (j < RETRY_CNT); j++);
+		if ((j == RETRY_CNT) || (leaf->log_addr != (void *)keys[i])) {
+			printf("failed to lookup key %llx to remove\n", keys[i]);
+			exit(-1);
+		}
+		radix_forest_remove(&forest, leaf);
+		radix_epoch_exit();
+	}
+	radix_thread_unregister();
+	return NULL;
+}
+
+/* Every extent of the threaded run is EXTENT_SIZE long and maps to its own offset, pieces over boundaries included. */
+static int check_extent(const struct radix_tree_extent *extent, void *arg) {
+	unsigned long long *last_end = (unsigned long long *)arg;
+
+	if ((extent->length != EXTENT_SIZE) || (extent->log_addr != (void *)extent->offset) || (extent->offset < *last_end)) {
+		printf("scanned wrong extent %llx+%llx\n", extent->offset, extent->length);
+		exit(-1);
+	}
+	*last_end = extent->offset + extent->length;
+	return 0;
+}
+
+static int collect_extent(const struct radix_tree_extent *extent, void *arg) {
+	struct radix_tree_extent **out = (struct radix_tree_extent **)arg;
+
+	*(*out)++ = *extent;
+	return 0;
+}
+
+static int stop_extent(const struct radix_tree_extent *extent, void *arg) {
+	return 1;
+}
+
+static void fail(const char *what) {
+	printf("%s\n", what);
+	exit(-1);
+}
+
+/* Routing, lookups over empty shards, scan merges and stops on a small forest of KEY_BITS wide keys. */
+static void check_edges(int key_bits) {
+	unsigned long long span, last, mid;
+	struct radix_tree_extent extents[8], *out;
+	struct radix_forest_stats stats;
+	struct radix_tree_leaf *leaf;
+	int i;
+
+	if (radix_forest_create(&forest, key_bits, 4) != 0)
+		fail("failed to create forest");
+	span = 1ULL << forest.shard_shift;
+	last = shard_base(15);
+	mid = shard_base(8);
+
+	// One extent over shards 1 to 3, one over the boundary of 7 and 8 in two writes, and one at the end of the key space.
+	radix_forest_insert(&forest, span - EXTENT_SIZE, 2 * span + 2 * EXTENT_SIZE, (void *)0x10000, 1);
+	radix_forest_insert(&forest, mid - EXTENT_SIZE, EXTENT_SIZE, (void *)0x20000, 1);
+	radix_forest_insert(&forest, mid, EXTENT_SIZE, (void *)0x20000 + EXTENT_SIZE, 2);
+	radix_forest_insert(&forest, last + span - EXTENT_SIZE, 2 * EXTENT_SIZE, (void *)0x30000, 1);
+	for (i = 0; i < 4; i++)
+		if (radix_forest_shard_extents(&forest, i) != 1)
+			fail("extent not split at shard boundaries");
+	radix_forest_shard_stats(&forest, 2, &stats);
+	if ((stats.inserts != 1) || (radix_forest_shard_extents(&forest, 15) != 1))
+		fail("wrong shard counters");
+
+	radix_epoch_enter();
+	if ((radix_forest_lookup(&forest, 2 * span + 5, &leaf) != RET_PREV_NODE) || (leaf->node.offset != 2 * span) ||
+	    (leaf->log_addr != (void *)0x10000 + EXTENT_SIZE + span))
+		fail("failed to lookup middle piece");
+	if ((radix_forest_lookup(&forest, 3 * span + 2 * EXTENT_SIZE, &leaf) != RET_NEXT_NODE) || (leaf->node.offset != mid - EXTENT_SIZE))
+		fail("failed to lookup next over empty shards");
+	if ((radix_forest_lookup(&forest, mid + EXTENT_SIZE, &leaf) != RET_NEXT_NODE) || (leaf->node.offset != last + span - EXTENT_SIZE))
+		fail("failed to lookup next at the last shard");
+	if (radix_forest_lookup(&forest, last + span - EXTENT_SIZE / 2, &leaf) != RET_PREV_NODE)
+		fail("failed to lookup the end of the key space");
+	radix_epoch_exit();
+	if ((key_bits < 64) && (radix_forest_lookup(&forest, 1ULL << key_bits, &leaf) != EFAULT_RADIX))
+		fail("fault index accepted");
+
+	// Pieces of the first extent merge back, those of different TX_ID do not, and a scan from the middle clips.
+	out = extents;
+	if ((radix_forest_scan(&forest, 0, ULLONG_MAX, collect_extent, &out) != 4) || (out - extents != 4) ||
+	    (extents[0].offset != span - EXTENT_SIZE) || (extents[0].length != 2 * span + 2 * EXTENT_SIZE) ||
+	    (extents[1].length != EXTENT_SIZE) || (extents[2].offset != mid) || (extents[2].tx_id != 2))
+		fail("wrong scan over shards");
+	out = extents;
+	if ((radix_forest_scan(&forest, span + 5, 3 * span + 5, collect_extent, &out) != 1) || (extents[0].offset != span + 5) ||
+	    (extents[0].length != 2 * span) || (extents[0].log_addr != (void *)0x10000 + EXTENT_SIZE + 5))
+		fail("wrong clipped scan");
+	if (radix_forest_scan(&forest, 0, ULLONG_MAX, stop_extent, NULL) != 1)
+		fail("scan did not stop");
+
+	for (i = 0; i < forest.shard_cnt; i++) {
+		radix_epoch_enter();
+		while (radix_forest_lookup(&forest, shard_base(i), &leaf) != ENOEXIST_RADIX) {
+			if (radix_forest_shard(&forest, leaf->node.offset) != i)
+				break;
+			radix_forest_remove(&forest, leaf);
+		}
+		radix_epoch_exit();
+		if (radix_forest_shard_extents(&forest, i) != 0)
+			fail("extent left after removes");
+	}
+	radix_forest_destroy(&forest);
+}
+
+int main(int argc, char *argv[]) {
+	struct radix_forest_stats stats, total;
+	double insert_time, lookup_time, remove_time;
+	unsigned long long i, last_end = 0, max_inserts = 0;
+	int shard;
+
+	if (argc < 2) {
+		printf("input total ops\n");
+		return -1;
+	}
+	total_ops = atoll(argv[1]);
+	if (total_ops == 0) {
+		printf("wrong input\n");
+		return -1;
+	}
+	if (total_ops > EXTENT_MASK + 1) {
+		printf("too many ops\n");
+		return -1;
+	}
+
+	radix_tree_init();
+	if ((radix_forest_create(&forest, 40, 0) == 0) || (radix_forest_create(&forest, 40, RADIX_FOREST_MAX_SHARD_BITS + 1) == 0) ||
+	    (radix_forest_create(&forest, 44, SHARD_BITS) == 0))
+		fail("invalid forest accepted");
+	check_edges(40);
+	check_edges(64);
+
+	// Keys are scattered but unique and one stride apart at least, so extents over boundaries fit between them.
+	keys = (unsigned long long *)malloc(total_ops * sizeof(unsigned long long));
+	for (i = 0; i < total_ops; i++)
+		keys[i] = ((i * SPREAD) & EXTENT_MASK) * KEY_STRIDE + EXTENT_SIZE;
+
+	radix_forest_create(&forest, 40, SHARD_BITS);
+	for (shard = 1; shard < forest.shard_cnt; shard++)
+		radix_forest_insert(&forest, shard_base(shard) - EXTENT_SIZE / 2, EXTENT_SIZE, (void *)(shard_base(shard) - EXTENT_SIZE / 2), 0);
+	insert_time = run_threads(insert_thread);
+	lookup_time = run_threads(lookup_thread);
+	if (radix_forest_scan(&forest, 0, ULLONG_MAX, check_extent, &last_end) != total_ops + forest.shard_cnt - 1)
+		fail("scan count mismatch");
+
+	memset(&total, 0, sizeof(total));
+	for (shard = 0; shard < forest.shard_cnt; shard++) {
+		radix_forest_shard_stats(&forest, shard, &stats);
+		total.inserts += stats.inserts;
+		total.lookups += stats.lookups;
+		total.scanned += stats.scanned;
+		if (stats.inserts > max_inserts)
+			max_inserts = stats.inserts;
+	}
+	if ((total.inserts != total_ops + 2 * (forest.shard_cnt - 1)) || (total.lookups != total_ops) ||
+	    (total.scanned != total_ops + 2 * (forest.shard_cnt - 1)))
+		fail("shard counters mismatch");
+
+	remove_time = run_threads(remove_thread);
+	for (shard = 1; shard < forest.shard_cnt; shard++) {
+		struct radix_tree_leaf *leaf;
+
+		radix_epoch_enter();
+		for (i = 0; i < 2; i++) {
+			if (radix_forest_lookup(&forest, shard_base(shard) - EXTENT_SIZE / 2 + i * EXTENT_SIZE / 2, &leaf) != RET_MATCH_NODE)
+				fail("failed to lookup piece over shard boundary");
+			radix_forest_remove(&forest, leaf);
+		}
+		radix_epoch_exit();
+	}
+	for (shard = 0; shard < forest.shard_cnt; shard++)
+		if (radix_forest_shard_extents(&forest, shard) != 0)
+			fail("extent left after removes");
+	radix_forest_destroy(&forest);
+
+	printf("%d shards: insert %.3fs, lookup %.3fs, remove %.3fs, hottest shard %.2fx of average inserts\n", 1 << SHARD_BITS,
+	       insert_time, lookup_time, remove_time, (double)max_inserts * (1 << SHARD_BITS) / total.inserts);
+	free(keys);
+	return 0;
+}
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "radix_tree.h"
+
+#define OFS_MASK 0xFFFFFFF000ULL // 4KB aligned in 40-bit key space
+#define EXTENT_SIZE 0x1000ULL // 4KB
+
+struct radix_tree_root root;
+unsigned long long *keys;
+unsigned long long *order; /* Lookup order, the same for both runs. */
+unsigned long long total_ops;
+
+static inline unsigned long long rand_ull(void) {
+	return ((((unsigned long long)rand()) << 32) | ((unsigned long long)rand()));
+}
+
+static inline double elapsed(struct timespec *begin, struct timespec *end) {
+	return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/* Counter of dTLB load misses of this thread in user space. Return -1 if the CPU or kernel exposes none. */
+static int open_dtlb_counter(void) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* AnonHugePages of this process in kB. */
+static unsigned long long anon_huge_kb(void) {
+	FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+	unsigned long long kb = 0;
+	char line[256];
+
+	if (fp == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "AnonHugePages: %llu kB", &kb) == 1)
+			break;
+	}
+	fclose(fp);
+	return kb;
+}
+
+/* Build the tree and time lookups in random order in a fresh process, so that node pools of both modes do not mix. */
+static void run(bool huge) {
+	unsigned long long i, j, misses = 0, hugetlb_bytes, thp_bytes;
+	struct radix_tree_leaf *leaf;
+	struct timespec begin, end;
+	int fd;
+
+	radix_tree_set_huge_pages(huge);
+	radix_tree_init();
+	radix_tree_create(&root);
+	for (i = 0; i < total_ops; i++)
+		radix_tree_insert(&root, keys[i], EXTENT_SIZE, (void *)keys[i], 0);
+
+	fd = open_dtlb_counter();
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	radix_epoch_enter();
+	for (i = 0; i < total_ops; i++) {
+		j = order[i];
+		if ((radix_tree_lookup(&root, keys[j] + (EXTENT_SIZE / 2), &leaf) != RET_PREV_NODE) || (leaf->log_addr != (void *)keys[j])) {
+			printf("failed to lookup inserted key %llx\n", keys[j]);
+			exit(-1);
+		}
+	}
+	radix_epoch_exit();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if ((fd >= 0) && (read(fd, &misses, sizeof(misses)) != sizeof(misses)))
+		misses = 0;
+
+	radix_tree_huge_page_stats(&hugetlb_bytes, &thp_bytes);
+	printf("%s: lookup %.3fs, dTLB misses ", huge ? "huge" : "base", elapsed(&begin, &end));
+	if (fd >= 0)
+		printf("%llu (%.2f per lookup)", misses, (double)misses / total_ops);
+	else
+		printf("n/a");
+	printf(", hugetlb %lluMB, thp %lluMB, AnonHugePages %lluMB\n", hugetlb_bytes >> 20, thp_bytes >> 20, anon_huge_kb() >> 10);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned long long i;
+	int mode, status;
+	pid_t pid;
+
+	if (argc < 2) {
+		printf("input total ops\n");
+		return -1;
+	}
+	total_ops = atoll(argv[1]);
+	if (total_ops == 0) {
+		printf("wrong input\n");
+		return -1;
+	}
+
+	unsigned int seed = (unsigned int)time(NULL);
+	printf("seed: %u\n", seed);
+	fflush(stdout);
+	srand(seed);
+
+	keys = (unsigned long long *)malloc(total_ops * sizeof(unsigned long long));
+	order = (unsigned long long *)malloc(total_ops * sizeof(unsigned long long));
+	for (i = 0; i < total_ops; i++) {
+		keys[i] = rand_ull() & OFS_MASK;
+		order[i] = rand_ull() % total_ops;
+	}
+
+	for (mode = 0; mode < 2; mode++) {
+		if ((pid = fork()) == 0) {
+			run(mode == 1);
+			fflush(stdout);
+			_exit(0);
+		}
+		if ((pid < 0) || (waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+			printf("%s run failed\n", (mode == 1) ? "huge" : "base");
+			return -1;
+		}
+	}
+
+	free(order);
+	free(keys);
+	return 0;
+}
@@ -45,6 +45,7 @@ void *thread_main(void *aux) {
                 bk_fn();
             leaf = NULL;
             enum radix_tree_lookup_results r;
+            radix_epoch_enter();
             if ((r = radix_tree_lookup(&root, arr[j], &leaf)) != RET_MATCH_NODE) {
                 bk_fn();
                 if (leaf != NULL) {
@@ -52,16 +53,19 @@ void *thread_main(void *aux) {
                 }
                 else{
                     printf("(%lld)NULL leaf: %d, %llu\n", cur_ops, r, j);
+                    radix_epoch_exit();
                     continue;
                 }
             }
             if (leaf->log_addr != (void *)arr[j]) {
                 printf("seed: %u\n", seed);
                 printf(" failed(consistency check failed), %llu\n", j);
+                radix_epoch_exit();
                 return NULL;
             }
             if (!quiet)
                 printf(" succeed: %llx\n", (unsigned long long)leaf->log_addr);
+            radix_epoch_exit();
         }
     }
     return NULL;
@@ -71,15 +75,19 @@ unsigned long long check_inserted_leaf() {
     struct radix_tree_leaf *leaf, *next_leaf;
     unsigned long long cnt = 0;
 
+    radix_epoch_enter();
     radix_tree_lookup(&root, 0, &leaf);
 
     while (leaf) {
 	    cnt++;
 	    next_leaf = leaf->next;
-	    if (next_leaf && (leaf->node.offset >= next_leaf->node.offset))
+	    if (next_leaf && (leaf->node.offset >= next_leaf->node.offset)) {
+		    radix_epoch_exit();
 		    return -1;
+	    }
 	    leaf = next_leaf;
     }
+    radix_epoch_exit();
     return cnt;
 }
 
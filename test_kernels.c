@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+
+#include "radix_tree.h"
+
+#define OFS_MASK 0xFFFFFFF000ULL // 4KB aligned in 40-bit key space
+#define EXTENT_SIZE 0x1000ULL // 4KB
+#define NODE_CNT 4096
+#define KERNEL_OPS 10000000
+
+static const char *kernel_names[] = {"avx512", "avx2", "sse4.2", "scalar"};
+#define KERNEL_CNT (sizeof(kernel_names) / sizeof(kernel_names[0]))
+
+struct radix_tree_root root;
+struct N32 *nodes;
+struct N48 *maps;
+unsigned char *search_keys;
+unsigned long long *keys;
+unsigned long long total_ops;
+
+static inline unsigned long long rand_ull(void) {
+	return ((((unsigned long long)rand()) << 32) | ((unsigned long long)rand()));
+}
+
+static inline double elapsed(struct timespec *begin, struct timespec *end) {
+	return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/* Nodes with random keys, duplicates included, and one in four slots NULL as if being deleted. */
+void build_nodes(void) {
+	int i, j;
+
+	nodes = (struct N32 *)aligned_alloc(NODE_ALIGN, NODE_CNT * sizeof(struct N32));
+	maps = (struct N48 *)aligned_alloc(NODE_ALIGN, NODE_CNT * sizeof(struct N48));
+	search_keys = (unsigned char *)malloc(NODE_CNT);
+	for (i = 0; i < NODE_CNT; i++) {
+		nodes[i].node.count = rand() % 33;
+		for (j = 0; j < 32; j++) {
+			nodes[i].key[j] = (rand() % 4) ? rand() : 0x80;
+			nodes[i].slots[j] = (rand() % 4) ? &nodes[i] : NULL;
+		}
+		for (j = 0; j < 256; j++)
+			maps[i].key[j] = rand() % 64;
+		// Sparse bitmaps with empty words, as in N48 and N256 nodes.
+		for (j = 0; j < RADIX_TREE_INDEX_SIZE; j++)
+			maps[i].index[j] = (rand() % 2) ? rand_ull() & rand_ull() & rand_ull() : 0;
+		search_keys[i] = (rand() % 4) ? rand() : 0x80;
+	}
+}
+
+/* Closest set bit to KEY in INDEX bit by bit, keys most significant first, for checking the scalar kernel. */
+static enum radix_tree_lookup_results closest_bit_naive(const unsigned long long *index, unsigned char key, unsigned char *ret_key) {
+	int k;
+
+	for (k = key - 1; k >= 0; k--) {
+		if ((index[k / 64] >> (63 - (k % 64))) & 1) {
+			*ret_key = k;
+			return RET_PREV_NODE;
+		}
+	}
+	for (k = key + 1; k < 256; k++) {
+		if ((index[k / 64] >> (63 - (k % 64))) & 1) {
+			*ret_key = k;
+			return RET_NEXT_NODE;
+		}
+	}
+	return ENOEXIST_RADIX;
+}
+
+/* Compare every kernel of OPS with the scalar ones. */
+void check_kernels(const struct node_search_ops *ops) {
+	const struct node_search_ops *ref = get_node_search_ops("scalar");
+	enum radix_tree_lookup_results ret, ref_ret;
+	unsigned long long snapshot[RADIX_TREE_INDEX_SIZE], ref_snapshot[RADIX_TREE_INDEX_SIZE];
+	unsigned char ret_key, ref_key;
+	int i, count, pos, ref_pos;
+
+	for (i = 0; i < NODE_CNT; i++) {
+		struct N32 *node = &nodes[i];
+		unsigned char key = search_keys[i];
+
+		count = (node->node.count > 16) ? 16 : node->node.count;
+		ret = ops->closest_key16(node->key, node->slots, 16, count, key, &pos, &ret_key);
+		ref_ret = ref->closest_key16(node->key, node->slots, 16, count, key, &ref_pos, &ref_key);
+		if ((ret != ref_ret) || ((ret != ENOEXIST_RADIX) && ((pos != ref_pos) || (ret_key != ref_key)))) {
+			printf("%s: closest_key16 mismatch at %d: %d/%d, %d/%d\n", ops->name, i, ret, ref_ret, pos, ref_pos);
+			exit(-1);
+		}
+		count = node->node.count;
+		ret = ops->closest_key32(node->key, node->slots, 32, count, key, &pos, &ret_key);
+		ref_ret = ref->closest_key32(node->key, node->slots, 32, count, key, &ref_pos, &ref_key);
+		if ((ret != ref_ret) || ((ret != ENOEXIST_RADIX) && ((pos != ref_pos) || (ret_key != ref_key)))) {
+			printf("%s: closest_key32 mismatch at %d: %d/%d, %d/%d\n", ops->name, i, ret, ref_ret, pos, ref_pos);
+			exit(-1);
+		}
+		if ((ops->match_key16(node->key, key) != ref->match_key16(node->key, key)) ||
+		    (ops->match_key32(node->key, key) != ref->match_key32(node->key, key))) {
+			printf("%s: match_key mismatch at %d\n", ops->name, i);
+			exit(-1);
+		}
+		if (ops->find_byte256(maps[i].key, key % 64) != ref->find_byte256(maps[i].key, key % 64)) {
+			printf("%s: find_byte256 mismatch at %d\n", ops->name, i);
+			exit(-1);
+		}
+		ref_ret = ref->closest_bit256(maps[i].index, ref_snapshot, key, &ref_key);
+		if ((ref_ret != closest_bit_naive(maps[i].index, key, &ret_key)) || ((ref_ret != ENOEXIST_RADIX) && (ret_key != ref_key))) {
+			printf("scalar: closest_bit256 wrong at %d\n", i);
+			exit(-1);
+		}
+		ret = ops->closest_bit256(maps[i].index, snapshot, key, &ret_key);
+		if ((ret != ref_ret) || ((ret != ENOEXIST_RADIX) && (ret_key != ref_key)) || memcmp(snapshot, ref_snapshot, sizeof(snapshot))) {
+			printf("%s: closest_bit256 mismatch at %d: %d/%d, %d/%d\n", ops->name, i, ret, ref_ret, ret_key, ref_key);
+			exit(-1);
+		}
+	}
+}
+
+/* Nanoseconds per call of each kernel, printed in one line. */
+void bench_kernels(const struct node_search_ops *ops) {
+	struct timespec begin, end;
+	unsigned long long sum = 0, snapshot[RADIX_TREE_INDEX_SIZE];
+	unsigned char ret_key = 0;
+	int i, n, pos;
+
+#define BENCH(NAME, EXP) \
+	do { \
+		clock_gettime(CLOCK_MONOTONIC, &begin); \
+		for (i = 0; i < KERNEL_OPS; i++) { \
+			n = i & (NODE_CNT - 1); \
+			sum += (EXP); \
+		} \
+		clock_gettime(CLOCK_MONOTONIC, &end); \
+		printf(NAME ": %.2fns, ", elapsed(&begin, &end) * 1e9 / KERNEL_OPS); \
+	} while (0)
+
+	printf("%s: ", ops->name);
+	BENCH("closest16", ops->closest_key16(nodes[n].key, nodes[n].slots, 16, nodes[n].node.count / 2, search_keys[n], &pos, &ret_key) + pos);
+	BENCH("closest32", ops->closest_key32(nodes[n].key, nodes[n].slots, 32, nodes[n].node.count, search_keys[n], &pos, &ret_key) + pos);
+	BENCH("match16", ops->match_key16(nodes[n].key, search_keys[n]));
+	BENCH("match32", ops->match_key32(nodes[n].key, search_keys[n]));
+	BENCH("find256", ops->find_byte256(maps[n].key, search_keys[n] % 64));
+	BENCH("closest256", ops->closest_bit256(maps[n].index, snapshot, search_keys[n], &ret_key) + ret_key);
+#undef BENCH
+	printf("(%llx)\n", sum & 0xF);
+}
+
+/* Look up every inserted key through the tree with the current kernels. */
+double bench_lookup(void) {
+	struct radix_tree_leaf *leaf;
+	struct timespec begin, end;
+	unsigned long long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	radix_epoch_enter();
+	for (i = 0; i < total_ops; i++) {
+		if ((radix_tree_lookup(&root, keys[i] + (EXTENT_SIZE / 2), &leaf) != RET_PREV_NODE) || (leaf->log_addr != (void *)keys[i])) {
+			printf("%s: failed to lookup inserted key %llx\n", radix_tree_search_kernel(), keys[i]);
+			exit(-1);
+		}
+	}
+	radix_epoch_exit();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return elapsed(&begin, &end);
+}
+
+int main(int argc, char *argv[]) {
+	const struct node_search_ops *ops;
+	const char *best;
+	unsigned long long i;
+	int k;
+
+	if (argc < 2) {
+		printf("input total ops\n");
+		return -1;
+	}
+	total_ops = atoll(argv[1]);
+	if (total_ops == 0) {
+		printf("wrong input\n");
+		return -1;
+	}
+
+	unsigned int seed = (unsigned int)time(NULL);
+	printf("seed: %u\n", seed);
+	fflush(stdout);
+	srand(seed);
+
+	radix_tree_init();
+	best = radix_tree_search_kernel();
+	printf("selected: %s\n", best);
+	build_nodes();
+	keys = (unsigned long long *)malloc(total_ops * sizeof(unsigned long long));
+	for (i = 0; i < total_ops; i++)
+		keys[i] = rand_ull() & OFS_MASK;
+	radix_tree_create(&root);
+	for (i = 0; i < total_ops; i++)
+		radix_tree_insert(&root, keys[i], EXTENT_SIZE, (void *)keys[i], 0);
+
+	for (k = 0; k < KERNEL_CNT; k++) {
+		if ((ops = get_node_search_ops(kernel_names[k])) == NULL) {
+			printf("%s: not supported\n", kernel_names[k]);
+			continue;
+		}
+		check_kernels(ops);
+		bench_kernels(ops);
+		radix_tree_set_search_kernel(kernel_names[k]);
+		printf("%s: lookup %.3fs\n", kernel_names[k], bench_lookup());
+	}
+	radix_tree_set_search_kernel(best);
+
+	free(keys);
+	free(search_keys);
+	free(maps);
+	free(nodes);
+	return 0;
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <limits.h>
+
+#include "radix_tree.h"
+
+#define THREAD_CNT 8
+#define EXTENT_SIZE 0x1000ULL // 4KB
+
+struct radix_tree_root root;
+int key_bits;
+unsigned long long key_mask;
+
+struct scan_state {
+	unsigned long long cnt;
+	unsigned long long last_end;
+};
+
+static inline unsigned long long rand_ull(void) {
+	return ((((unsigned long long)rand()) << 33) ^ (((unsigned long long)rand()) << 12) ^ ((unsigned long long)rand()));
+}
+
+/* Random extent aligned to EXTENT_SIZE, skewed to both ends of key space once in a while. */
+static inline unsigned long long rand_key(void) {
+	unsigned long long key = rand_ull() & key_mask & ~(EXTENT_SIZE - 1);
+
+	switch (rand() % 8) {
+		case 0:
+			return key & 0xFFFFFFFULL;
+		case 1:
+			return key | (key_mask & ~0xFFFFFFFULL);
+		default:
+			return key;
+	}
+}
+
+static void check_lookup(unsigned long long key) {
+	struct radix_tree_extent extent;
+	enum radix_tree_lookup_results ret;
+
+	ret = radix_tree_lookup_extent(&root, key + (EXTENT_SIZE / 2), &extent);
+	if ((ret != RET_PREV_NODE) || (extent.offset != key) || (extent.log_addr != (void *)key)) {
+		printf("failed to lookup key %llx (%d bits): %d, %llx\n", key, key_bits, ret, extent.offset);
+		exit(-1);
+	}
+}
+
+void *thread_main(void *aux) {
+	unsigned long long ops = (unsigned long long)aux, i, key;
+
+	for (i = 0; i < ops; i++) {
+		key = rand_key();
+		radix_tree_insert(&root, key, EXTENT_SIZE, (void *)key, 0);
+		check_lookup(key);
+	}
+	return NULL;
+}
+
+int scan_fn(const struct radix_tree_extent *extent, void *arg) {
+	struct scan_state *state = (struct scan_state *)arg;
+
+	if ((state->cnt && (extent->offset < state->last_end)) || (extent->log_addr != (void *)extent->offset)) {
+		printf("scan check failed: %llx (%d bits)\n", extent->offset, key_bits);
+		exit(-1);
+	}
+	state->last_end = extent->offset + extent->length;
+	state->cnt++;
+	return 0;
+}
+
+/* Remove every leaf and return the number of removed leaves. */
+unsigned long long remove_all(void) {
+	struct radix_tree_leaf *leaf;
+	unsigned long long cnt = 0;
+
+	while (true) {
+		radix_epoch_enter();
+		if (radix_tree_lookup(&root, 0, &leaf) >= ENOEXIST_RADIX) {
+			radix_epoch_exit();
+			return cnt;
+		}
+		radix_tree_remove(&root, leaf);
+		radix_epoch_exit();
+		cnt++;
+	}
+}
+
+void test_key_bits(unsigned long long ops) {
+	pthread_t threads[THREAD_CNT];
+	struct scan_state state = {0, 0};
+	struct radix_tree_extent *extents;
+	struct radix_tree_leaf *leaf;
+	unsigned long long i, last, cnt;
+
+	key_mask = (key_bits == 64) ? ULLONG_MAX : ((1ULL << key_bits) - 1);
+	last = key_mask & ~(EXTENT_SIZE - 1);
+	if (radix_tree_create_key_bits(&root, key_bits) != 0) {
+		printf("failed to create tree with %d bits key\n", key_bits);
+		exit(-1);
+	}
+
+	// Extents at both ends of key space. The last one is clipped to the key space boundary.
+	radix_tree_insert(&root, 0, EXTENT_SIZE, (void *)0, 0);
+	radix_tree_insert(&root, last, EXTENT_SIZE, (void *)last, 0);
+	check_lookup(0);
+	check_lookup(last);
+	if ((key_bits < 64) && (radix_tree_lookup(&root, key_mask + 1, &leaf) != EFAULT_RADIX)) {
+		printf("lookup out of key space succeeded (%d bits)\n", key_bits);
+		exit(-1);
+	}
+
+	for (i = 0; i < THREAD_CNT; i++) {
+		if (pthread_create(&threads[i], NULL, &thread_main, (void *)(ops / THREAD_CNT))) {
+			printf("thread creation failed\n");
+			exit(-1);
+		}
+	}
+	for (i = 0; i < THREAD_CNT; i++)
+		pthread_join(threads[i], NULL);
+
+	cnt = radix_tree_scan(&root, 0, ULLONG_MAX, scan_fn, &state);
+	if ((cnt != state.cnt) || (remove_all() != cnt) || (radix_tree_scan(&root, 0, ULLONG_MAX, scan_fn, &state) != 0)) {
+		printf("remove check failed (%d bits)\n", key_bits);
+		exit(-1);
+	}
+
+	// Bulk load spreads extents over the whole key space.
+	extents = (struct radix_tree_extent *)malloc(ops * sizeof(struct radix_tree_extent));
+	for (i = 0; i < ops; i++) {
+		extents[i].offset = (key_mask / ops) * i & ~(EXTENT_SIZE - 1);
+		extents[i].length = EXTENT_SIZE;
+		extents[i].log_addr = (void *)extents[i].offset;
+		extents[i].tx_id = 0;
+	}
+	extents[ops - 1].offset = last;
+	extents[ops - 1].length = key_mask - last + (key_bits < 64);
+	extents[ops - 1].log_addr = (void *)last;
+	radix_tree_create_key_bits(&root, key_bits);
+	if (radix_tree_bulk_load(&root, extents, ops, THREAD_CNT) != 0) {
+		printf("bulk load failed (%d bits)\n", key_bits);
+		exit(-1);
+	}
+	for (i = 0; i < ops; i++)
+		check_lookup(extents[i].offset);
+	free(extents);
+
+	printf("%d bits: %llu leaves\n", key_bits, cnt);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned long long total_ops;
+
+	if (argc < 2) {
+		printf("input total ops\n");
+		return -1;
+	}
+	total_ops = atoll(argv[1]);
+	if (total_ops < THREAD_CNT) {
+		printf("wrong input\n");
+		return -1;
+	}
+
+	unsigned int seed = (unsigned int)time(NULL);
+	printf("seed: %u\n", seed);
+	fflush(stdout);
+	srand(seed);
+
+	radix_tree_init();
+	if (radix_tree_create_key_bits(&root, 44) != -1) {
+		printf("unsupported key width accepted\n");
+		return -1;
+	}
+	for (key_bits = 40; key_bits <= 64; key_bits += 8)
+		test_key_bits(total_ops);
+	return 0;
+}
@@ -19,6 +19,7 @@ void *read_thread_main(void *aux) {
     struct radix_tree_leaf *leaf = NULL;
     while (!write_ended) {
         unsigned long long key = ((((unsigned long long)rand()) << 32) | ((unsigned long long)rand())) & 0xFFFFFFFFFF;
+        radix_epoch_enter();
         switch (radix_tree_lookup(&root, key, &leaf)) {
             case RET_PREV_NODE:
             case RET_MATCH_NODE:
@@ -28,7 +29,7 @@ void *read_thread_main(void *aux) {
                     fflush(NULL);
                     exit(-1);
                 }
-                continue;
+                break;
             case ENOEXIST_RADIX:
                 printf("ENOEXIST_RADIX\n");
                 break;
@@ -37,6 +38,7 @@ void *read_thread_main(void *aux) {
                 break;
             exit(-1);
         }
+        radix_epoch_exit();
     }
     return NULL;
 }
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "radix_tree.h"
+
+#define THREAD_CNT 8
+#define EXTENT_SIZE 0x1000ULL // 4KB
+#define EXTENT_MASK ((1ULL << 28) - 1) // Extents in 40-bit key space
+#define SPREAD 0x9E3779B1ULL // Odd, so that keys of distinct extents differ
+#define PAGE_SAMPLE_CNT 1024
+#define INTERLEAVE_LEVELS 2
+#define REPLICA_LEVELS 2
+#define BATCH_SIZE 16
+
+struct radix_tree_root root;
+unsigned long long *keys;
+unsigned long long total_ops;
+
+static inline double elapsed(struct timespec *begin, struct timespec *end) {
+	return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+void *insert_thread(void *arg) {
+	unsigned long long tid = (unsigned long long)arg, i;
+
+	for (i = tid; i < total_ops; i += THREAD_CNT)
+		radix_tree_insert(&root, keys[i], EXTENT_SIZE, (void *)keys[i], 0);
+	radix_thread_unregister();
+	return NULL;
+}
+
+void *lookup_thread(void *arg) {
+	unsigned long long tid = (unsigned long long)arg, i;
+	struct radix_tree_leaf *leaf;
+
+	radix_epoch_enter();
+	for (i = tid; i < total_ops; i += THREAD_CNT) {
+		if ((radix_tree_lookup(&root, keys[i] + (EXTENT_SIZE / 2), &leaf) != RET_PREV_NODE) || (leaf->log_addr != (void *)keys[i])) {
+			printf("failed to lookup inserted key %llx\n", keys[i]);
+			exit(-1);
+		}
+	}
+	radix_epoch_exit();
+	radix_thread_unregister();
+	return NULL;
+}
+
+/* Half of threads remove keys of odd index while the others look up keys of even index in every way. */
+void *remove_or_lookup_thread(void *arg) {
+	unsigned long long tid = (unsigned long long)arg, i, indexes[BATCH_SIZE];
+	struct radix_tree_leaf *leaf, *leaves[BATCH_SIZE];
+	enum radix_tree_lookup_results results[BATCH_SIZE];
+	struct radix_tree_extent extent;
+	int j;
+
+	if (tid % 2) {
+		for (i = tid / 2 * 2 + 1; i < total_ops; i += THREAD_CNT) {
+			radix_epoch_enter();
+			if ((radix_tree_lookup(&root, keys[i], &leaf) != RET_MATCH_NODE) || (leaf->log_addr != (void *)keys[i])) {
+				printf("failed to lookup key %llx to remove\n", keys[i]);
+				exit(-1);
+			}
+			radix_tree_remove(&root, leaf);
+			radix_epoch_exit();
+		}
+	}
+	else {
+		for (i = tid; i + BATCH_SIZE * THREAD_CNT < total_ops; i += BATCH_SIZE * THREAD_CNT) {
+			if ((radix_tree_lookup_extent(&root, keys[i], &extent) != RET_MATCH_NODE) || (extent.log_addr != (void *)keys[i])) {
+				printf("failed to lookup extent %llx\n", keys[i]);
+				exit(-1);
+			}
+			for (j = 0; j < BATCH_SIZE; j++)
+				indexes[j] = keys[i + j * THREAD_CNT];
+			radix_epoch_enter();
+			radix_tree_lookup_batch(&root, indexes, BATCH_SIZE, leaves, results);
+			for (j = 0; j < BATCH_SIZE; j++) {
+				if ((results[j] != RET_MATCH_NODE) || (leaves[j]->log_addr != (void *)indexes[j])) {
+					printf("failed to batch lookup %llx\n", indexes[j]);
+					exit(-1);
+				}
+			}
+			radix_epoch_exit();
+		}
+	}
+	radix_thread_unregister();
+	return NULL;
+}
+
+static double run_threads(void *(*fn)(void *)) {
+	pthread_t threads[THREAD_CNT];
+	struct timespec begin, end;
+	unsigned long long t;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (t = 0; t < THREAD_CNT; t++)
+		pthread_create(&threads[t], NULL, fn, (void *)t);
+	for (t = 0; t < THREAD_CNT; t++)
+		pthread_join(threads[t], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return elapsed(&begin, &end);
+}
+
+/* NUMA node the page of ADDR is on, -1 if unknown. */
+static int page_numa(void *addr) {
+	int node = -1;
+
+	if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+		return -1;
+	return node;
+}
+
+/* Check that every leaf is stamped with a valid NUMA node, BIND if not negative, and that sampled pages are there. */
+static void check_leaves(int node_cnt, int bind) {
+	unsigned long long cnt = 0, sampled = 0, placed = 0;
+	struct radix_tree_leaf *leaf;
+
+	for (leaf = root.head.next; leaf != &root.tail; leaf = leaf->next, cnt++) {
+		if ((leaf->node.numa >= node_cnt) || ((bind >= 0) && (leaf->node.numa != bind))) {
+			printf("leaf %llx on wrong NUMA node %d\n", leaf->node.offset, leaf->node.numa);
+			exit(-1);
+		}
+		if ((cnt % (total_ops / PAGE_SAMPLE_CNT + 1)) == 0) {
+			sampled++;
+			placed += (page_numa(leaf) == leaf->node.numa);
+		}
+	}
+	if (cnt != total_ops) {
+		printf("leaf list has %llu leaves, expected %llu\n", cnt, total_ops);
+		exit(-1);
+	}
+	printf("pages on stamped node: %llu/%llu\n", placed, sampled);
+}
+
+static void print_stats(const char *name, struct radix_numa_stats *before, struct radix_numa_stats *after) {
+	int i;
+
+	printf("%s:", name);
+	for (i = 0; i < after->node_cnt; i++) {
+		printf(" node%d alloc %llu (remote %llu), access local %llu remote %llu;", i,
+		       after->alloc[i] - before->alloc[i], after->remote_alloc[i] - before->remote_alloc[i],
+		       after->local_access[i] - before->local_access[i], after->remote_access[i] - before->remote_access[i]);
+	}
+	printf("\n");
+}
+
+static void run(const char *name, enum radix_numa_policy policy, int numa_node, int interleave_levels, int replica_levels) {
+	struct radix_numa_stats begin, built, looked_up;
+	double insert_time, lookup_time;
+
+	radix_tree_create(&root);
+	if ((radix_tree_set_numa_policy(&root, policy, numa_node, interleave_levels) != 0) ||
+	    (radix_tree_set_replicas(&root, replica_levels) != 0)) {
+		printf("%s: failed to set policy\n", name);
+		exit(-1);
+	}
+	radix_tree_numa_stats(&begin);
+	insert_time = run_threads(insert_thread);
+	radix_tree_numa_stats(&built);
+	lookup_time = run_threads(lookup_thread);
+	radix_tree_numa_stats(&looked_up);
+
+	printf("%s: insert %.3fs, lookup %.3fs, ", name, insert_time, lookup_time);
+	check_leaves(looked_up.node_cnt, (policy == RADIX_NUMA_BIND) ? numa_node : -1);
+	print_stats("  insert", &begin, &built);
+	print_stats("  lookup", &built, &looked_up);
+}
+
+/* Remove keys of odd index under lookups of the others, and check both from copies and the shared tree. */
+static void check_replicas(void) {
+	struct radix_tree_leaf *leaf;
+	double remove_time;
+	unsigned long long i;
+	int levels, numa;
+
+	remove_time = run_threads(remove_or_lookup_thread);
+	for (levels = REPLICA_LEVELS; levels >= 0; levels -= REPLICA_LEVELS) {
+		radix_tree_set_replicas(&root, levels);
+		radix_epoch_enter();
+		for (i = 0; i < total_ops; i++) {
+			bool found = (radix_tree_lookup(&root, keys[i], &leaf) == RET_MATCH_NODE);
+			if (found != (i % 2 == 0)) {
+				printf("key %llx %s after removes\n", keys[i], found ? "left" : "lost");
+				exit(-1);
+			}
+		}
+		radix_epoch_exit();
+	}
+	printf("  remove under lookups %.3fs\n", remove_time);
+
+	// Destroy returns the copies of a tree emptied with replicas kept.
+	radix_tree_set_replicas(&root, REPLICA_LEVELS);
+	while (root.head.next != &root.tail)
+		radix_tree_remove(&root, root.head.next);
+	radix_tree_destroy(&root);
+	for (numa = 0; numa < RADIX_NUMA_MAX; numa++) {
+		if (root.replica[numa] != NULL) {
+			printf("replica left after destroy\n");
+			exit(-1);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	struct radix_numa_stats stats;
+	unsigned long long i;
+
+	if (argc < 2) {
+		printf("input total ops\n");
+		return -1;
+	}
+	total_ops = atoll(argv[1]);
+	if (total_ops == 0) {
+		printf("wrong input\n");
+		return -1;
+	}
+	if (total_ops > EXTENT_MASK + 1) {
+		printf("too many ops\n");
+		return -1;
+	}
+
+	// Keys are scattered but unique, so that every insert adds a leaf.
+	keys = (unsigned long long *)malloc(total_ops * sizeof(unsigned long long));
+	for (i = 0; i < total_ops; i++)
+		keys[i] = ((i * SPREAD) & EXTENT_MASK) * EXTENT_SIZE;
+
+	radix_tree_init();
+	radix_tree_numa_stats(&stats);
+	printf("NUMA nodes: %d\n", stats.node_cnt);
+	radix_tree_create(&root);
+	if ((radix_tree_set_numa_policy(&root, RADIX_NUMA_BIND, RADIX_NUMA_MAX, 0) == 0) ||
+	    (radix_tree_set_numa_policy(&root, RADIX_NUMA_FIRST_TOUCH, 0, OFFSET_SIZE + 1) == 0)) {
+		printf("invalid policy accepted\n");
+		return -1;
+	}
+
+	if (radix_tree_set_replicas(&root, OFFSET_SIZE) == 0) {
+		printf("invalid replica levels accepted\n");
+		return -1;
+	}
+
+	run("first touch", RADIX_NUMA_FIRST_TOUCH, 0, 0, 0);
+	run("bind", RADIX_NUMA_BIND, stats.node_cnt - 1, 0, 0);
+	run("interleave", RADIX_NUMA_FIRST_TOUCH, 0, INTERLEAVE_LEVELS, 0);
+	run("replicas", RADIX_NUMA_FIRST_TOUCH, 0, 0, REPLICA_LEVELS);
+	check_replicas();
+
+	free(keys);
+	return 0;
+}
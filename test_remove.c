@@ -8,6 +8,7 @@
 #define THREADS_CNT 16
 
 #define LEAF_LENGTH 0xFFFFFFFFFFULL //1TB
+#define FANOUT_KEYS 256
 
 struct radix_tree_root root;
 
@@ -36,6 +37,7 @@ void *thread_main(void *aux) {
     end = (tid + 1) * (total_key / (THREADS_CNT * 2));
     for (i = start; i < end; i++) {
         radix_tree_insert(&root, key[i], LEAF_LENGTH, (void *)key[i], 0);
+        radix_epoch_enter();
         if (radix_tree_lookup(&root, key[i], &leaf) != RET_MATCH_NODE) {
             printf("failed to lookup inserted key\n");
             exit(-1);
@@ -44,12 +46,14 @@ void *thread_main(void *aux) {
             printf("consistency check failed - insert\n");
             exit(-1);
         }
+        radix_epoch_exit();
     }
 
     __sync_fetch_and_add(&inserted, 0x1);
     while(inserted < THREADS_CNT);
 
     for (i = 0; i < ops_per_thread; i++) {
+        radix_epoch_enter();
         if (rand() % 2) { // Try to insert.
             j = rand_ull();
             if (radix_tree_lookup(&root, j, &leaf) == RET_MATCH_NODE)
@@ -77,12 +81,56 @@ remove:
             }
             stat_delete++;
         }
+        radix_epoch_exit();
     }
     __sync_fetch_and_add(&total_insert, stat_insert);
     __sync_fetch_and_add(&total_delete, stat_delete);
     return NULL;
 }
 
+static void check_fanout_lookup(struct radix_tree_root *fanout_root, unsigned long long k, bool exist) {
+    struct radix_tree_leaf *leaf;
+
+    radix_epoch_enter();
+    if ((radix_tree_lookup(fanout_root, k, &leaf) == RET_MATCH_NODE) != exist) {
+        printf("fanout check failed: %llx\n", k);
+        exit(-1);
+    }
+    radix_epoch_exit();
+}
+
+/* Grow one node through every node class and shrink it back, checking all children at each step. */
+void check_fanout(void) {
+    struct radix_tree_root fanout_root;
+    struct radix_tree_leaf *leaf;
+    unsigned long long keys[FANOUT_KEYS], tmp, i, j;
+
+    radix_tree_create(&fanout_root);
+    for (i = 0; i < FANOUT_KEYS; i++)
+        keys[i] = i << 8;
+    for (i = FANOUT_KEYS - 1; i > 0; i--) {
+        j = rand() % (i + 1);
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+
+    for (i = 0; i < FANOUT_KEYS; i++) {
+        radix_tree_insert(&fanout_root, keys[i], 1, (void *)keys[i], 0);
+        for (j = 0; j <= i; j++)
+            check_fanout_lookup(&fanout_root, keys[j], true);
+    }
+    for (i = 0; i < FANOUT_KEYS; i++) {
+        radix_epoch_enter();
+        radix_tree_lookup(&fanout_root, keys[i], &leaf);
+        radix_tree_remove(&fanout_root, leaf);
+        radix_epoch_exit();
+        check_fanout_lookup(&fanout_root, keys[i], false);
+        for (j = i + 1; j < FANOUT_KEYS; j++)
+            check_fanout_lookup(&fanout_root, keys[j], true);
+    }
+}
+
 int main(int argv, char *argc[]) {
     pthread_t threads[THREADS_CNT];
     unsigned long long i = 0;
@@ -109,6 +157,7 @@ int main(int argv, char *argc[]) {
     srand(seed);
 
     radix_tree_init();
+    check_fanout();
     radix_tree_create(&root);
     
     for (i = 0; i < (total_key / 2); i++)
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <limits.h>
+
+#include "radix_tree.h"
+
+#define WRITE_THREAD_CNT 8
+#define SCAN_THREAD_CNT 8
+
+#define OFS_MASK 0xFFFFFFFFULL // 4GB
+#define LEN_MASK 0xFFFFFULL // 1MB
+#define SCAN_LEN_MASK 0xFFFFFFULL // 16MB
+
+struct radix_tree_root root;
+
+volatile bool write_ended = false;
+
+struct scan_state {
+	unsigned long long start;
+	unsigned long long end;
+	unsigned long long last_end;
+};
+
+static inline unsigned long long rand_ull(void) {
+	return ((((unsigned long long)rand()) << 32) | ((unsigned long long)rand()));
+}
+
+/* Every extent is inserted with log_addr equal to its offset, and splits keep it so. */
+static void check_extent(const struct radix_tree_extent *extent, struct scan_state *state) {
+	if ((extent->length == 0) || (extent->offset < state->last_end) || (extent->offset + extent->length > state->end)) {
+		printf("scan range check failed: [%llx, %llx) in [%llx, %llx), last end %llx\n", extent->offset,
+		       extent->offset + extent->length, state->start, state->end, state->last_end);
+		exit(-1);
+	}
+	if (extent->log_addr != (void *)extent->offset) {
+		printf("scan consistency check failed: %llx, %p\n", extent->offset, extent->log_addr);
+		exit(-1);
+	}
+	state->last_end = extent->offset + extent->length;
+}
+
+int scan_fn(const struct radix_tree_extent *extent, void *arg) {
+	check_extent(extent, (struct scan_state *)arg);
+	return 0;
+}
+
+void *scan_thread_main(void *aux) {
+	struct radix_tree_cursor cursor;
+	struct radix_tree_extent extent;
+	struct scan_state state;
+	unsigned long long scans = 0, extents = 0;
+
+	while (!write_ended) {
+		state.start = rand_ull() & OFS_MASK;
+		state.end = state.start + (rand_ull() & SCAN_LEN_MASK) + 1;
+		state.last_end = state.start;
+		if (rand() % 3 == 0)
+			extents += radix_tree_scan(&root, state.start, state.end, scan_fn, &state);
+		else if (rand() % 2) {
+			switch (radix_tree_lookup_extent(&root, state.start, &extent)) {
+				case RET_MATCH_NODE:
+				case RET_PREV_NODE:
+					if ((extent.offset > state.start) || (extent.offset + extent.length <= state.start))
+						goto lookup_fail;
+					break;
+				case RET_NEXT_NODE:
+					if (extent.offset <= state.start)
+						goto lookup_fail;
+					break;
+				default:
+					continue;
+			}
+			if ((extent.length == 0) || (extent.log_addr != (void *)extent.offset))
+				goto lookup_fail;
+			extents++;
+		}
+		else {
+			radix_tree_cursor_init(&cursor, &root, state.start, state.end);
+			while (radix_tree_cursor_next(&cursor, &extent)) {
+				check_extent(&extent, &state);
+				extents++;
+			}
+			radix_tree_cursor_close(&cursor);
+		}
+		scans++;
+	}
+	return (void *)(scans + extents);
+
+lookup_fail:
+	printf("lookup extent check failed: %llx, [%llx, %llx), %p\n", state.start, extent.offset,
+	       extent.offset + extent.length, extent.log_addr);
+	exit(-1);
+}
+
+void *write_thread_main(void *aux) {
+	unsigned long long ops = (unsigned long long)aux, i, ofs, len;
+
+	for (i = 0; i < ops; i++) {
+		ofs = rand_ull() & OFS_MASK;
+		len = (rand_ull() & LEN_MASK) + 1;
+		radix_tree_insert(&root, ofs, len, (void *)ofs, 0);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	pthread_t write_threads[WRITE_THREAD_CNT], scan_threads[SCAN_THREAD_CNT];
+	long long total_ops, ops_per_thread;
+	struct scan_state state = {0, ULLONG_MAX, 0};
+	unsigned long long total = 0;
+	void *ret;
+	int i;
+
+	if (argc < 2) {
+		printf("input total ops\n");
+		return -1;
+	}
+	else {
+		total_ops = atoll(argv[1]);
+		if (total_ops < 0) {
+			printf("wrong input\n");
+			return -1;
+		}
+		ops_per_thread = total_ops / WRITE_THREAD_CNT;
+	}
+
+	unsigned int seed = (unsigned int)time(NULL);
+	printf("seed: %u\n", seed);
+	fflush(stdout);
+	srand(seed);
+
+	radix_tree_init();
+	radix_tree_create(&root);
+
+	for (i = 0; i < WRITE_THREAD_CNT; i++) {
+		if (pthread_create(&write_threads[i], NULL, &write_thread_main, (void *)ops_per_thread)) {
+			printf("thread creation failed\n");
+			return -1;
+		}
+	}
+	for (i = 0; i < SCAN_THREAD_CNT; i++) {
+		if (pthread_create(&scan_threads[i], NULL, &scan_thread_main, NULL)) {
+			printf("thread creation failed\n");
+			return -1;
+		}
+	}
+	for (i = 0; i < WRITE_THREAD_CNT; i++)
+		pthread_join(write_threads[i], &ret);
+	write_ended = true;
+	for (i = 0; i < SCAN_THREAD_CNT; i++) {
+		pthread_join(scan_threads[i], &ret);
+		total += (unsigned long long)ret;
+	}
+
+	printf("total leaf: %llu\n", radix_tree_scan(&root, 0, ULLONG_MAX, scan_fn, &state));
+	printf("scanned: %llu\n", total);
+	return 0;
+}
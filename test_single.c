@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <limits.h>
+
+#include "radix_tree.h"
+
+#define OFS_MASK 0xFFFFFFF000ULL // 4KB aligned in 40-bit key space
+#define EXTENT_SIZE 0x1000ULL // 4KB
+
+struct radix_tree_root root;
+unsigned long long *keys;
+unsigned long long total_ops;
+
+static inline unsigned long long rand_ull(void) {
+	return ((((unsigned long long)rand()) << 32) | ((unsigned long long)rand()));
+}
+
+static inline double elapsed(struct timespec *begin, struct timespec *end) {
+	return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+int scan_fn(const struct radix_tree_extent *extent, void *arg) {
+	if (extent->log_addr != (void *)extent->offset) {
+		printf("scan consistency check failed: %llx\n", extent->offset);
+		exit(-1);
+	}
+	return 0;
+}
+
+/* Same workload for the concurrent and single threaded builds. One thread inserts, looks up, scans and removes. */
+int main(int argc, char *argv[]) {
+	struct radix_tree_leaf *leaf;
+	struct timespec begin, end;
+	double insert_time, lookup_time, scan_time, remove_time;
+	unsigned long long i, cnt;
+
+	if (argc < 2) {
+		printf("input total ops\n");
+		return -1;
+	}
+	total_ops = atoll(argv[1]);
+	if (total_ops == 0) {
+		printf("wrong input\n");
+		return -1;
+	}
+
+	unsigned int seed = (unsigned int)time(NULL);
+	printf("seed: %u\n", seed);
+	fflush(stdout);
+	srand(seed);
+
+	keys = (unsigned long long *)malloc(total_ops * sizeof(unsigned long long));
+	for (i = 0; i < total_ops; i++)
+		keys[i] = rand_ull() & OFS_MASK;
+
+	radix_tree_init();
+	radix_tree_create(&root);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < total_ops; i++)
+		radix_tree_insert(&root, keys[i], EXTENT_SIZE, (void *)keys[i], 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	insert_time = elapsed(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	radix_epoch_enter();
+	for (i = 0; i < total_ops; i++) {
+		if ((radix_tree_lookup(&root, keys[i] + (EXTENT_SIZE / 2), &leaf) != RET_PREV_NODE) || (leaf->log_addr != (void *)keys[i])) {
+			printf("failed to lookup inserted key %llx\n", keys[i]);
+			return -1;
+		}
+	}
+	radix_epoch_exit();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	lookup_time = elapsed(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	cnt = radix_tree_scan(&root, 0, ULLONG_MAX, scan_fn, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	scan_time = elapsed(&begin, &end);
+
+	// Keys may repeat, so only the first remove of each key finds it.
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < total_ops; i++) {
+		radix_epoch_enter();
+		if (radix_tree_lookup(&root, keys[i], &leaf) == RET_MATCH_NODE) {
+			radix_tree_remove(&root, leaf);
+			cnt--;
+		}
+		radix_epoch_exit();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	remove_time = elapsed(&begin, &end);
+
+	if ((cnt != 0) || (radix_tree_scan(&root, 0, ULLONG_MAX, scan_fn, NULL) != 0)) {
+		printf("remove check failed: %llu left\n", cnt);
+		return -1;
+	}
+
+	printf("insert: %.3fs, lookup: %.3fs, scan: %.3fs, remove: %.3fs\n", insert_time, lookup_time, scan_time, remove_time);
+	free(keys);
+	return 0;
+}